@@ -12,6 +12,12 @@ static char const rcsid[] = "$Id: SnoopFilterMapper.c,v 1.3 2023/01/12 17:53:11
 #include <assert.h>				// assert() function
 #include <unistd.h>				// sysconf() function, sleep() function
 #include <sys/mman.h>			// support for mmap() function
+#include <sys/ioctl.h>			// for the msr-safe batch interface
+#include <stddef.h>				// offsetof()
+#include <pthread.h>			// the trace writer thread, one mapping thread per socket, or the prefault threads
+#if defined(PER_SOCKET_WORKERS) || defined(FAST_PREFAULT) || defined(ROLLING_BUFFER) || defined(LATENCY_ENGINE)
+#include <sys/syscall.h>		// raw mbind() and sched_setaffinity() system calls
+#endif // PER_SOCKET_WORKERS || FAST_PREFAULT || ROLLING_BUFFER || LATENCY_ENGINE
 #include <linux/mman.h>			// required for 1GiB page support in mmap()
 #include <math.h>				// for pow() function used in RAPL computations
 #include <time.h>
@@ -19,7 +25,9 @@ static char const rcsid[] = "$Id: SnoopFilterMapper.c,v 1.3 2023/01/12 17:53:11
 
 #define MYPAGESIZE 2097152L
 #define NUMPAGES 2048L			// 40960L (80 GiB) for big production runs
+#ifndef PAGES_MAPPED
 #define PAGES_MAPPED 16L		// 128L or 256L for production runs
+#endif
 
 
 // interfaces for va2pa_lib.c
@@ -31,7 +39,13 @@ double *page_pointers[NUMPAGES];		// one pointer for each page allocated
 uint64_t pageframenumber[NUMPAGES];	// one PFN entry for each page allocated
 
 // constant value defines for pre-allocated arrays
+#ifndef NUM_SOCKETS
+#ifdef PER_SOCKET_WORKERS
+# define NUM_SOCKETS 8                  // upper bound -- the sockets present are discovered from sysfs
+#else
 # define NUM_SOCKETS 2
+#endif // PER_SOCKET_WORKERS
+#endif // NUM_SOCKETS
 # define NUM_CHA_BOXES 60               // largest number of CHAs per socket in current product line (2023-07-30)
 # define NUM_CHA_COUNTERS 4
 
@@ -39,8 +53,10 @@ long cha_counts[NUM_SOCKETS][NUM_CHA_BOXES][NUM_CHA_COUNTERS][2];		// 2 sockets,
 uint64_t cha_perfevtsel[NUM_CHA_COUNTERS];
 long cha_pkg_sums[NUM_SOCKETS][NUM_CHA_COUNTERS];
 
-int8_t cha_by_page[NUMPAGES][32768];				// L3 numbers for each of the 32,768 cache lines in each of the first PAGES_MAPPED 2MiB pages
 uint64_t paddr_by_page[NUMPAGES];					// physical addresses of the base of each of the first PAGES_MAPPED 2MiB pages used
+#ifdef FAST_PREFAULT
+int8_t page_verified[NUMPAGES];						// 1 if the page is backed by a 2MiB huge page
+#endif // FAST_PREFAULT
 long lines_by_cha[NUM_CHA_BOXES];			// bulk count of lines assigned to each CHA
 
 # ifndef MIN
@@ -54,8 +70,48 @@ long lines_by_cha[NUM_CHA_BOXES];			// bulk count of lines assigned to each CHA
 #include "low_overhead_timers.c"        // probably need to link this to my official github version
 #include "cpuid_check_inline.c"         // CPUID "signatures" (CPUID/leaf 0x01, return value in eax with stepping masked out)
 // #include "program_CHA_PMC_ICX.c"        // off-loading code with details of CHA PMON MSR indexing
-#include "program_CHA_counters.c"       // program all CHA counters -- contains model-specific code
-#include "read_CHA_counter.c"           // read one CHA counter from one CHA in one socket -- contains model-specific code
+#include "cha_pmon.c"                   // descriptor table of the CHA PMON MSRs of each processor -- contains model-specific data
+#include "program_CHA_counters.c"       // program all CHA counters
+#include "read_CHA_counter.c"           // read one CHA counter from one CHA in one socket
+#include "msr_batch.c"                  // read a precomputed list of MSRs with one msr-safe ioctl (or pread() per MSR)
+#ifdef MAPPER_BENCH
+#include "mapper_bench.c"               // per-phase timing of the mapper and the JSON throughput report
+#else
+#define BENCH_PHASE(p)
+#define BENCH_MSR_READ(backend, num_msrs)
+#define BENCH_UNIT(tries, lines)
+#endif // MAPPER_BENCH
+#include "goodness.c"                   // the goodness tests of one try of the full measurement
+#include "trace_format.c"               // binary trace file layout
+#include "mapper_trace.c"               // runtime-enabled trace of every try (L3_TRACE=<file>)
+#ifdef SIM_UNCORE
+#include "sim_uncore.c"                 // simulated CHA counters driven by the hash tables in Results/ (no MSR access)
+#endif // SIM_UNCORE
+#include "map_cache_line.c"             // measure the CHA that owns one cache line (optionally predict-and-verify from Results/)
+#ifdef MUX_LINES
+#include "map_cache_line_group.c"       // map MUX_LINES cache lines per counter window
+#endif // MUX_LINES
+#ifdef INFER_PERMUTATION
+#include "infer_page.c"                 // synthesize a page map from a few measured lines and the base sequence
+#endif // INFER_PERMUTATION
+#include "contiguous_pages.c"          // 1GiB page allocation and runs of physically contiguous 2MiB pages
+#ifdef FAST_PREFAULT
+#include "prefault.c"                   // parallel first touch, bulk pagemap read and huge page verification
+#endif // FAST_PREFAULT
+#include "checkpoint.c"                 // atomic file writes, and checkpoint/resume of the page in progress
+#include "map_page.c"                   // map the lines of one 2MiB page, read/write the PADDR_*.map files
+#ifdef SELECT_PAGES
+#include "select_pages.c"               // order the pages by the unresolved high address bits they add
+#endif // SELECT_PAGES
+#ifdef PER_SOCKET_WORKERS
+#include "socket_workers.c"             // sysfs topology discovery and one mapping worker per socket
+#endif // PER_SOCKET_WORKERS
+#ifdef ROLLING_BUFFER
+#include "rolling_buffer.c"             // map new physical pages from a small window that is released and reallocated
+#endif // ROLLING_BUFFER
+#ifdef LATENCY_ENGINE
+#include "latency_engine.c"             // slice identification from load latencies measured on several cores (no MSRs)
+#endif // LATENCY_ENGINE
 
 // ===========================================================================================================================================================================
 int main(int argc, char *argv[])
@@ -67,7 +123,9 @@ int main(int argc, char *argv[])
 	int rc;
 	ssize_t rc64;
 	size_t len;
-	unsigned long pagemapentry;
+#if defined(VERBOSE) || !(defined(FAST_PREFAULT) || defined(SIM_UNCORE) || defined(MYHUGEPAGE_1GB))
+	unsigned long pagemapentry;			// only looked up per 2MiB block in the default startup path
+#endif
 	unsigned long paddr, basephysaddr;
 	uint32_t socket, counter;
 	long count,delta;
@@ -79,8 +137,9 @@ int main(int argc, char *argv[])
     int CHA_per_socket;
 	uint64_t msr_val, msr_num;
 	int mem_fd;
-	int msr_fd[2];				// one for each socket
-	int proc_in_pkg[2];			// one Logical Processor number for each socket
+	int msr_fd[NUM_SOCKETS];		// one for each socket
+	int proc_in_pkg[NUM_SOCKETS];	// one Logical Processor number for each socket
+	int num_sockets = NUM_SOCKETS;
 	uid_t my_uid;
 	gid_t my_gid;
 	double sum;
@@ -88,18 +147,46 @@ int main(int argc, char *argv[])
 
     uint32_t CurrentCPUIDSignature;     // CPUID Signature for the current system -- save for later processor-dependent conditionals
 
+#ifdef LATENCY_ENGINE
+	// one cluster per enabled slice -- from the command line, before the buffer is allocated
+	CHA_per_socket = latency_num_clusters(argc, argv);
+	if (CHA_per_socket == 0) {
+		exit(1);
+	}
+#endif // LATENCY_ENGINE
+#ifdef MAPPER_BENCH
+	mapper_bench_start(&mapper_bench);
+#endif // MAPPER_BENCH
+#if !defined(PER_SOCKET_WORKERS) && !defined(ROLLING_BUFFER)
     // ===============================================================================================================================
 	// allocate working array on a huge pages -- either 1GiB or 2MiB
 	len = NUMPAGES * MYPAGESIZE;        // Bytes
+#ifdef MYHUGEPAGE_1GB
+	array = (double *) alloc_1gb_pages((size_t) len);
+#else
 	rc = posix_memalign((void **)&array, (size_t) 2097152, (size_t) len);
 	if (rc != 0) {
 		printf("ERROR: posix_memalign call failed with error code %d\n",rc);
 		exit(3);
 	}
+#endif // MYHUGEPAGE_1GB
 	if (array == (void *)(-1)) {
         perror("ERROR: mmap of array a failed! ");
         exit(1);
     }
+#ifdef FAST_PREFAULT
+	// touch the working array from all processors, then read the pagemap in bulk
+	prefault_buffer((char *) array, (size_t) len, PREFAULT_THREADS);
+	BENCH_PHASE(BENCH_PAGEMAP);
+	if (read_pagemap_2m((char *) array, NUMPAGES, paddr_by_page, page_verified) < 0) {
+		exit(3);
+	}
+	BENCH_PHASE(BENCH_OTHER);
+	for (j=0; j<NUMPAGES; j++) {
+		page_pointers[j] = &array[j*MYPAGESIZE/sizeof(double)];
+		pageframenumber[j] = paddr_by_page[j] >> 12;
+	}
+#else
 	// initialize working array
 	for (j=0; j<len/sizeof(double); j++) {
 		array[j] = 1.0;
@@ -109,15 +196,49 @@ int main(int argc, char *argv[])
 #ifdef VERBOSE
 	printf(" Page    ArrayIndex            VirtAddr        PagemapEntry         PFN           PhysAddr\n");
 #endif // VERBOSE
+	BENCH_PHASE(BENCH_PAGEMAP);
+#if defined(MYHUGEPAGE_1GB) && !defined(SIM_UNCORE)
+	// two lookups per 1GiB page: the 512 2MiB blocks of a 1GiB page should be physically consecutive,
+	// which is checked at the last block -- if not, every block of that 1GiB page is looked up
+	unsigned long base_frame, last_frame;
+	long first_block, last_block;
+	for (first_block=0; first_block<NUMPAGES; first_block+=512) {
+		last_block = MIN(first_block+511, NUMPAGES-1);
+		base_frame = get_pagemap_entry(&array[first_block*MYPAGESIZE/sizeof(double)]) & (unsigned long) 0x007FFFFFFFFFFFFF;
+		last_frame = get_pagemap_entry(&array[last_block*MYPAGESIZE/sizeof(double)]) & (unsigned long) 0x007FFFFFFFFFFFFF;
+		if (last_frame != base_frame + (last_block-first_block)*512) {
+			printf("WARNING: 1GiB page at block %ld: frame 0x%lx of block %ld is not base frame 0x%lx + %ld -- looking up every block\n",
+					first_block,last_frame,last_block,base_frame,(last_block-first_block)*512);
+		}
+		for (j=first_block; j<=last_block; j++) {
+			if (last_frame == base_frame + (last_block-first_block)*512) {
+				pageframenumber[j] = base_frame + (j-first_block)*512;
+			} else {
+				pageframenumber[j] = get_pagemap_entry(&array[j*MYPAGESIZE/sizeof(double)]) & (unsigned long) 0x007FFFFFFFFFFFFF;
+			}
+		}
+	}
+#endif // MYHUGEPAGE_1GB && !SIM_UNCORE
 	for (j=0; j<NUMPAGES; j++) {
 		k = j*MYPAGESIZE/sizeof(double);
 		page_pointers[j] = &array[k];
+#if defined(SIM_UNCORE) || defined(MYHUGEPAGE_1GB)
+#ifdef VERBOSE
+		pagemapentry = 0;				// no pagemap lookup per block
+#endif // VERBOSE
+#ifdef SIM_UNCORE
+		pageframenumber[j] = sim_uncore_page_paddr(j) >> 12;       // synthetic physical address
+#endif // SIM_UNCORE -- with MYHUGEPAGE_1GB, pageframenumber[] was filled in per 1GiB page above
+#else
 		pagemapentry = get_pagemap_entry(&array[k]);
 		pageframenumber[j] = (pagemapentry & (unsigned long) 0x007FFFFFFFFFFFFF);
+#endif // SIM_UNCORE || MYHUGEPAGE_1GB
 #ifdef VERBOSE
 		printf(" %.5ld   %.10ld  %#18lx  %#18lx  %#18lx  %#18lx\n",j,k,&array[k],pagemapentry,pageframenumber[j],(pageframenumber[j]<<12));
 #endif // VERBOSE
 	}
+	BENCH_PHASE(BENCH_OTHER);
+#endif // FAST_PREFAULT
 	printf("PAGE_ADDRESSES\n");
 	for (j=0; j<NUMPAGES; j++) {
 		basephysaddr = pageframenumber[j] << 12;
@@ -130,7 +251,14 @@ int main(int argc, char *argv[])
 		if ( (paddr_by_page[j] & 0x1fffffUL) != 0 ) {
             printf("WARNING: page %d basephysaddr %p is not 2MiB-aligned\n",j,paddr_by_page[j]);
         }
+#ifdef FAST_PREFAULT
+		if (!page_verified[j]) {
+            printf("WARNING: page %ld basephysaddr 0x%.12lx is not a verified 2MiB huge page -- will not be mapped\n",j,paddr_by_page[j]);
+        }
+#endif // FAST_PREFAULT
     }
+	report_contiguous_runs(paddr_by_page, NUMPAGES);
+#endif // !PER_SOCKET_WORKERS && !ROLLING_BUFFER
 
     // ===============================================================================================================================
 	// initialize arrays for CHA counter data (only partially used in this MAP_L3 version, but not big enough to be a problem)
@@ -143,42 +271,40 @@ int main(int argc, char *argv[])
 			}
 		}
 	}
-	// initialize the array that will hold the L3 slice numbers for each cache line for each of the first NUMPAGES 2MiB pages
-	for (i=0; i<NUMPAGES; i++) {
-		for (line_number=0; line_number<32768; line_number++) {
-			cha_by_page[i][line_number] = 0;
-		}
-	}
 
 
 	//========================================================================================================================
 	// Identify the processor by CPUID signature (CPUID leaf 0x01, return value in %eax)
 	// If not supported, Don't abort yet but save the CurrentCPUIDSignature for later processor-dependent conditionals
+#ifdef SIM_UNCORE
+    CurrentCPUIDSignature = sim_uncore_signature(SIM_UNCORE_CONFIG);    // the platform of the simulated hash
+#else
     CurrentCPUIDSignature = cpuid_signature();
+#endif // SIM_UNCORE
 
-    switch(CurrentCPUIDSignature) {
-        case CPUID_SIGNATURE_HASWELL:
-            printf("CPUID Signature 0x%x identified as Haswell EP\n",CurrentCPUIDSignature);
-            break;
-        case CPUID_SIGNATURE_SKX:
-            printf("CPUID Signature 0x%x identified as Skylake Xeon/Cascade Lake Xeon\n",CurrentCPUIDSignature);
-            break;
-        case CPUID_SIGNATURE_ICX:
-            printf("CPUID Signature 0x%x identified as Ice Lake Xeon\n",CurrentCPUIDSignature);
-            break;
-        case CPUID_SIGNATURE_SPR:
-            printf("CPUID Signature 0x%x identified as Sapphire Rapids Xeon\n",CurrentCPUIDSignature);
-            break;
-        default:
-            printf("CPUID Signature 0x%x not a supported value\n",CurrentCPUIDSignature);
+    if (cha_pmon_find(CurrentCPUIDSignature) != NULL) {
+        printf("CPUID Signature 0x%x identified as %s\n",CurrentCPUIDSignature,cha_pmon_find(CurrentCPUIDSignature)->name);
+    } else {
+        printf("CPUID Signature 0x%x not a supported value\n",CurrentCPUIDSignature);
     }
 
 	// ===================================================================================================================
 	// open the MSR driver using one core in socket 0 and one core in socket 1
 	nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#ifdef PER_SOCKET_WORKERS
+	topology_t topology;
+	num_sockets = discover_topology(&topology);
+	if (num_sockets == 0) {
+		printf("ERROR: could not read the socket and NUMA node topology from sysfs\n");
+		exit(1);
+	}
+	for (pkg=0; pkg<num_sockets; pkg++) proc_in_pkg[pkg] = topology.first_cpu[pkg];
+#else
     proc_in_pkg[0] = 0;                 // logical processor 0 is in socket 0 in all TACC systems
     proc_in_pkg[1] = nr_cpus-1;         // logical processor N-1 is in socket 1 in all TACC 2-socket systems
-	for (pkg=0; pkg<NUM_SOCKETS; pkg++) {
+#endif // PER_SOCKET_WORKERS
+#if !defined(LATENCY_ENGINE) && !defined(SIM_UNCORE)
+	for (pkg=0; pkg<num_sockets; pkg++) {
 		sprintf(filename,"/dev/cpu/%d/msr",proc_in_pkg[pkg]);
 		msr_fd[pkg] = open(filename, O_RDWR);
 		if (msr_fd[pkg] == -1) {
@@ -186,10 +312,11 @@ int main(int argc, char *argv[])
 			exit(-1);
 		}
 	}
-	for (pkg=0; pkg<NUM_SOCKETS; pkg++) {
+	for (pkg=0; pkg<num_sockets; pkg++) {
 		pread(msr_fd[pkg],&msr_val,sizeof(msr_val),IA32_TIME_STAMP_COUNTER);
 		fprintf(stdout,"DEBUG: TSC on core %d socket %d is %ld\n",proc_in_pkg[pkg],pkg,msr_val);
 	}
+#endif // !LATENCY_ENGINE && !SIM_UNCORE
 
     int core_under_test, socket_under_test;
     tsc_start = full_rdtscp(&socket_under_test, &core_under_test);
@@ -198,44 +325,25 @@ int main(int argc, char *argv[])
 	printf("VERBOSE: programming CHA counters\n");
 #endif // VERBOSE
 
-    // Model-specific CHA performance counter events
-    switch(CurrentCPUIDSignature) {
-        case CPUID_SIGNATURE_HASWELL:
-            printf("CPUID Signature 0x%x identified as Haswell EP\n",CurrentCPUIDSignature);
-            printf("--- not yet supported\n");
-            exit(1);
-            break;
-        case CPUID_SIGNATURE_SKX:
-            printf("CPUID Signature 0x%x identified as Skylake Xeon/Cascade Lake Xeon\n",CurrentCPUIDSignature);
-            CHA_per_socket = 28;
-            cha_perfevtsel[0] = 0x00400334;		// LLC_LOOKUP.DATA_READ -- requires CHA_FILTER0 bits 26:17
-            cha_perfevtsel[1] = 0x00400334;		// LLC_LOOKUP.DATA_READ -- requires CHA_FILTER0 bits 26:17
-            cha_perfevtsel[2] = 0x00400334;		// LLC_LOOKUP.DATA_READ -- requires CHA_FILTER0 bits 26:17
-            cha_perfevtsel[3] = 0x00400334;		// LLC_LOOKUP.DATA_READ -- requires CHA_FILTER0 bits 26:17
-            break;
-        case CPUID_SIGNATURE_ICX:
-            printf("CPUID Signature 0x%x identified as Ice Lake Xeon\n",CurrentCPUIDSignature);
-            CHA_per_socket = 40;
-            cha_perfevtsel[0] = 0x00400350;		// REQUESTS.READS -- local read requests that miss the SF & LLC and are sent to the HA
-            cha_perfevtsel[1] = 0x00400350;		// REQUESTS.READS -- local read requests that miss the SF & LLC and are sent to the HA
-            cha_perfevtsel[2] = 0x00400350;		// REQUESTS.READS -- local read requests that miss the SF & LLC and are sent to the HA
-            cha_perfevtsel[3] = 0x00400350;		// REQUESTS.READS -- local read requests that miss the SF & LLC and are sent to the HA
-            // program_CHA_PMC_ICX(NUM_CHA_USED, cha_perfevtsel, 4, msr_fd, NUM_SOCKETS);
-            break;
-        case CPUID_SIGNATURE_SPR:
-            printf("CPUID Signature 0x%x identified as Sapphire Rapids Xeon\n",CurrentCPUIDSignature);
-            CHA_per_socket = 60;
-            // Note that SPR does not use the "enable" bit (bit 22), and reserves it -- do not write!
-            cha_perfevtsel[0] = 0x00000350;		// REQUESTS.READS -- local read requests that miss the SF & LLC and are sent to the HA
-            cha_perfevtsel[1] = 0x00000350;		// REQUESTS.READS -- local read requests that miss the SF & LLC and are sent to the HA
-            cha_perfevtsel[2] = 0x00000350;		// REQUESTS.READS -- local read requests that miss the SF & LLC and are sent to the HA
-            cha_perfevtsel[3] = 0x00000350;		// REQUESTS.READS -- local read requests that miss the SF & LLC and are sent to the HA
-            break;
-        default:
-            printf("CPUID Signature 0x%x not a supported value\n",CurrentCPUIDSignature);
-            exit(1);
+#ifdef LATENCY_ENGINE
+    // no CHA PMON table entry is needed: the latency engine does not use the MSRs or the CHA counters
+    printf("INFO: latency engine -- the MSRs and CHA counters are not used\n");
+#else
+    // Model-specific CHA MSR addresses and performance counter events, from the table in cha_pmon.c
+    if (cha_pmon_resolve(&cha_pmon, CurrentCPUIDSignature) != 0) {
+        exit(1);
+    }
+    CHA_per_socket = cha_pmon.num_chas;
+    for (counter=0; counter<NUM_CHA_COUNTERS; counter++) {
+        cha_perfevtsel[counter] = cha_pmon_perfevtsel(cha_pmon.desc);
+    }
+    if (mapper_trace_open(&cha_pmon, FULL_NFLUSHES) != 0) {
+        exit(1);
     }
-    program_CHA_counters(CurrentCPUIDSignature,CHA_per_socket, cha_perfevtsel, 4, msr_fd, NUM_SOCKETS);
+#ifdef SIM_UNCORE
+    printf("INFO: simulated uncore -- the MSRs are not used\n");
+#else
+    program_CHA_counters(&cha_pmon, cha_perfevtsel, 4, msr_fd, num_sockets);
     // document CHA counter programming in output
     for (counter=0; counter<NUM_CHA_COUNTERS; counter++) {
         printf("INFO: CHA_PERFEVTSEL[%d] = 0x%lx\n",counter,cha_perfevtsel[counter]);
@@ -247,7 +355,7 @@ int main(int argc, char *argv[])
 
     // Hit the global "unfreeze counter" function in the uncore global control on each chip
     // Enable the uncore fixed clock while I am at it....
-	for (pkg=0; pkg<NUM_SOCKETS; pkg++) {
+	for (pkg=0; pkg<num_sockets; pkg++) {
         msr_num = U_MSR_PMON_GLOBAL_CTL;
         msr_val = (1UL)<<61;
         pwrite(msr_fd[pkg],&msr_val,sizeof(msr_val),msr_num);
@@ -259,17 +367,28 @@ int main(int argc, char *argv[])
 #ifdef VERBOSE
 	printf("VERBOSE: Triggered UNFREEZE on all Uncore Counters, and enabled Uncore Clock Counter (MSR 0x704)\n");
 #endif // VERBOSE
+#endif // SIM_UNCORE
+#endif // LATENCY_ENGINE
 
 // ========= END OF PERFORMANCE COUNTER SETUP ========================================================================
 
-#ifdef MAP_L3
+#if defined(MAP_L3) && defined(PER_SOCKET_WORKERS)
+	// all sockets in parallel, from buffers on each socket's NUMA nodes
+	run_socket_workers(&topology, &cha_pmon, msr_fd, CHA_per_socket);
+#elif defined(MAP_L3) && defined(LATENCY_ENGINE)
+	// load latencies from several cores instead of CHA counters
+	run_latency_engine(array, paddr_by_page, NUMPAGES, CHA_per_socket);
+#elif defined(MAP_L3) && defined(ROLLING_BUFFER)
+	// a small window of pages, released and reallocated each round to reach new physical frames
+	run_rolling_buffer(&cha_pmon, socket_under_test, proc_in_pkg[socket_under_test], msr_fd, CHA_per_socket);
+#elif defined(MAP_L3)
 // ============== BEGIN L3 MAPPING TESTS ==============================
 // For each of the NUMPAGES 2MiB pages:
 //   1. Use "access()" to see if the mapping file already exists.
 //		If exists:
 //   		2. Use "stat()" to make sure the file is the correct size
 //   		   If right size:
-//   		   	3. Read the contents into the 32768-element int8_t array of L3 numbers.
+//   		   	3. Read the contents into the 32768-element int8_t working buffer of L3 numbers.
 //   		   Else (wrong size):
 //   		   	4. Abort and tell the user to fix it manually.
 //   	Else (not exists):
@@ -277,272 +396,122 @@ int main(int argc, char *argv[])
 //   		5. Create mapping file
 //   		6. Save data in mapping file
 //   		7. Close output file
+//   		8. Add the page to the LINES_BY_CHA counts
 
-	FILE *ptr_mapping_file;
 	int needs_mapping;
-	int good, good_old, good_new, pass1, pass2, pass3, found, numtries;
-    int backoffs;
-	int min_count, max_count, sum_count, old_cha;
-	double avg_count, goodness1, goodness2, goodness3;
-	int globalsum = 0;
-	long totaltries = 0;
-	int NFLUSHES = 1000;
+#ifdef MAPPER_BENCH
+	int map_file_exists;
+#endif // MAPPER_BENCH
+	int8_t *cha;
+	cha = (int8_t *) malloc(32768);		// L3 numbers of the page being mapped (or read) -- not kept afterwards
+	if (cha == NULL) {
+		printf("ERROR: out of memory for the page map buffer\n");
+		exit(8);
+	}
+	line_mapper_t line_mapper;
+	msr_batch_t cha_batch;
+#ifdef SIM_UNCORE
+	if (sim_uncore_init(&sim_uncore, &cha_pmon, array, paddr_by_page, NUMPAGES) != 0) {
+		exit(10);
+	}
+#endif // SIM_UNCORE
+#ifdef CHECKPOINT
+	checkpoint_install();
+#endif // CHECKPOINT
+	if (line_mapper_setup(&line_mapper, &cha_batch, &cha_pmon, socket_under_test, proc_in_pkg[socket_under_test], msr_fd, CHA_per_socket) != 0) {
+		exit(6);
+	}
     int new_pages_mapped = 0;
     int primestride = 797;
-    long page_numbers_mapped[PAGES_MAPPED];
-    for (i=0; i<PAGES_MAPPED; i++) page_numbers_mapped[i] = 0;
+#ifdef SELECT_PAGES
+	page_selector_t page_selector;
+	if (page_selector_init(&page_selector, &line_mapper, NUMPAGES) != 0) {
+		exit(7);
+	}
+#endif // SELECT_PAGES
+	// pages in primestride order, except that pages with a checkpoint (-DCHECKPOINT) come first
+	long *visit_order = (long *) malloc(NUMPAGES * sizeof(long));
+	long num_resume;
+	if (visit_order == NULL) {
+		printf("ERROR: out of memory for the page order\n");
+		exit(8);
+	}
+	for (i=0; i<NUMPAGES; i++) visit_order[i] = (primestride * i) % NUMPAGES;
+	num_resume = checkpoint_first(paddr_by_page, visit_order, NUMPAGES);
+	if (num_resume > 0) printf("INFO: %ld pages have a checkpoint -- resuming them first\n",num_resume);
 
+#ifdef MAPPER_BENCH
+	mapper_bench_begin_mapping(&mapper_bench);
+#endif // MAPPER_BENCH
 	// for (page_number=0; page_number<PAGES_MAPPED; page_number++) {
 	//for (page_number=0; page_number<NUMPAGES; page_number++) {
 	for (int iii=0; iii<NUMPAGES; iii++) {
-        page_number = (primestride * iii) % NUMPAGES;
-		needs_mapping=0;
-		sprintf(filename,"PADDR_0x%.12lx.map",paddr_by_page[page_number]);
-		i = access(filename, F_OK);
-		if (i == -1) {								// file does not exist
-			printf("DEBUG: Mapping file %s does not exist -- will create file after mapping cache lines\n",filename);
-			needs_mapping = 1;
-		} else {									// file exists
-			i = access(filename, R_OK);
-			if (i == -1) {							// file exists without read permissions
-				printf("ERROR: Mapping file %s exists, but without read permission\n",filename);
-				exit(1);
-			} else {								// file exists with read permissions
-				ptr_mapping_file = fopen(filename,"r");
-				if (!ptr_mapping_file) {
-					printf("ERROR: Failed to open Mapping File %s, should not happen\n",filename);
-					exit(2);
-				}
-				k = fread(&cha_by_page[page_number][0],(size_t) 32768,(size_t) 1,ptr_mapping_file);
-				if (k != 1) {					// incorrect read length
-					printf("ERROR: Read from Mapping File %s, returned the wrong record count %ld expected 1\n",filename,k);
-					exit(3);
-				} else {							// correct read length
-					printf("DEBUG: Mapping File read for %s succeeded -- skipping mapping for this page\n",filename);
-					needs_mapping = 0;
-				}
-			}
+#ifdef SELECT_PAGES
+		if (iii < num_resume) {
+			page_number = visit_order[iii];
+			page_selector.visited[page_number] = 1;
+		} else {
+			page_number = page_selector_next(&page_selector, paddr_by_page, primestride);
 		}
+#else
+        page_number = visit_order[iii];
+#endif // SELECT_PAGES
+#ifdef FAST_PREFAULT
+		if (!page_verified[page_number]) continue;
+#endif // FAST_PREFAULT
+		BENCH_PHASE(BENCH_FILE_IO);
+		needs_mapping = 1 - read_map_file(paddr_by_page[page_number], cha);
+		BENCH_PHASE(BENCH_OTHER);
+#ifdef MAPPER_BENCH
+		map_file_exists = !needs_mapping;
+		needs_mapping = 1;				// every page selected is measured, even if its map file exists
+#endif // MAPPER_BENCH
 		if (needs_mapping == 1) {
 			// code imported from SystemMirrors/Hikari/MemSuite/InterventionLatency/L3_mapping.c
 #ifdef VERBOSE
 			printf("DEBUG: here I need to perform the mapping for paddr 0x%.12lx, and then save the file\n",paddr_by_page[page_number]);
 #endif // VERBOSE
 			page_base_index = page_number*262144;		// index of element at beginning of current 2MiB page
-			for (line_number=0; line_number<32768; line_number++) {
-				good = 0;
-				good_old = 0;
-				good_new = 0;
-				numtries = 0;
-                backoffs = 0;
-#ifdef VERBOSE
-				if (line_number%64 == 0) {
-					pagemapentry = get_pagemap_entry(&array[page_base_index+line_number*8]);
-					printf("DEBUG: page_base_index %ld line_number %ld index %ld pagemapentry 0x%lx\n",page_base_index,line_number,page_base_index+line_number*8,pagemapentry);
-				}
-#endif // VERBOSE
-				do  {               // -------------- Inner Repeat Loop until results pass "goodness" tests --------------
-					numtries++;
-					if (numtries > 100) {
-                        backoffs += 1;
-                        sleep(1);
-                        if ( backoffs > 10 ) {
-                            printf("ERROR: No good results for line %d after %d tries and %d backoffs\n",line_number,numtries,backoffs);
-                            exit(101);
-                        }
-					}
-					totaltries++;
-
-				// 1. read L3 counters before starting test
-				for (tile=0; tile<CHA_per_socket; tile++) {
-                    cha_counts[socket_under_test][tile][0][0] = read_CHA_counter(CurrentCPUIDSignature, socket_under_test, tile, 0, msr_fd);
-                }
-
-#if 0
-				// 1. read L3 counters before starting test
-				for (tile=0; tile<CHA_per_socket; tile++) {
-                    if (tile >= 34) {
-                        msr_base = 0x0e00 - 0x47c;       // ICX MSRs skip backwards for CHAs 34-39
-                    } else if (tile >= 18) {              // ICX MSRs skil forward for CHAs 18-33
-                        msr_base = 0x0e00 + 0x0e;
-                    } else {
-                        msr_base = 0x0e00;
-                    }
-					msr_num = msr_base + msr_stride*tile + 0x8 + 1;				// counter 1 is the LLC_LOOKUPS.READ event
-					pread(msr_fd[socket_under_test],&msr_val,sizeof(msr_val),msr_num);
-					cha_counts[socket_under_test][tile][1][0] = msr_val;					//  use the array I have already declared for cha counts
-					// printf("DEBUG: page %ld line %ld msr_num 0x%x msr_val %ld cha_counter1 %lu\n",
-					//		page_number,line_number,msr_num,msr_val,cha_counts[0][tile][1][0]);
-				}
-#endif
-
-				// 2. Access the line NFLUSHES times
-				sum = 0;
-				for (i=0; i<NFLUSHES; i++) {
-					sum += array[page_base_index+line_number*8];
-					_mm_mfence();
-					_mm_lfence();
-					_mm_clflush(&array[page_base_index+line_number*8]);
-					_mm_mfence();
-					_mm_lfence();
-				}
-				globalsum += sum;
-
-
-				// 3. read L3 counters after loads are done
-				for (tile=0; tile<CHA_per_socket; tile++) {
-                    cha_counts[socket_under_test][tile][0][1] = read_CHA_counter(CurrentCPUIDSignature, socket_under_test, tile, 0, msr_fd);
-                }
-
-
-#if 0
-				// 3. read L3 counters after loads are done
-				for (tile=0; tile<CHA_per_socket; tile++) {
-                    if (tile >= 34) {
-                        msr_base = 0x0e00 - 0x47c;       // ICX MSRs skip backwards for CHAs 34-39
-                    } else if (tile >= 18) {              // ICX MSRs skil forward for CHAs 18-33
-                        msr_base = 0x0e00 + 0x0e;
-                    } else {
-                        msr_base = 0x0e00;
-                    }
-					msr_num = msr_base + msr_stride*tile + 0x8 + 1;				// counter 1 is the LLC_LOOKUPS.READ event
-					pread(msr_fd[socket_under_test],&msr_val,sizeof(msr_val),msr_num);
-					cha_counts[socket_under_test][tile][1][1] = msr_val;					//  use the array I have already declared for cha counts
-				}
-#endif
-
-
-
-
-#ifdef VERBOSE
-				for (tile=0; tile<CHA_per_socket; tile++) {
-					printf("DEBUG: page %ld line %ld cha_counter0_after %lu cha_counter0 before %lu delta %lu\n",
-							page_number,line_number,cha_counts[socket_under_test][tile][0][1],cha_counts[socket_under_test][tile][0][0],cha_counts[socket_under_test][tile][0][1]-cha_counts[socket_under_test][tile][0][0]);
-				}
-#endif // VERBOSE
-
-				//   CHA counter 1 set to LLC_LOOKUP.READ
-				//
-				//  4. Determine which L3 slice owns the cache line and
-				//  5. Save the CHA number in the cha_by_page[page][line] array
-
-				// first do a rough quantitative checks of the "goodness" of the data
-				//		goodness1 = max/NFLUSHES (pass if >95%)
-				// 		goodness2 = min/NFLUSHES (pass if <20%)
-				//		goodness3 = avg/NFLUSHES (pass if <40%)
-				max_count = 0;
-				min_count = 1<<30;
-				sum_count = 0;
-				for (tile=0; tile<CHA_per_socket; tile++) {
-					delta = corrected_pmc_delta(cha_counts[socket_under_test][tile][0][1],cha_counts[socket_under_test][tile][0][0],48);
-					max_count = MAX(max_count, delta);
-					min_count = MIN(min_count, delta);
-					sum_count += delta;
-				}
-				avg_count = (double)(sum_count - max_count) / (double)(CHA_per_socket);
-				goodness1 = (double) max_count / (double) NFLUSHES;
-				goodness2 = (double) min_count / (double) NFLUSHES;
-				goodness3 =          avg_count / (double) NFLUSHES;
-				// compare the goodness parameters with manually chosen limits & combine into a single pass (good=1) or fail (good=0)
-				pass1 = 0;
-				pass2 = 0;
-				pass3 = 0;
-				if ( goodness1 > 0.95 ) pass1 = 1;
-				if ( goodness2 < 0.20 ) pass2 = 1;
-				if ( goodness3 < 0.40 ) pass3 = 1;
-				good_new = pass1 * pass2 * pass3;
-#ifdef VERBOSE
-				printf("GOODNESS: line_number %ld max_count %d min_count %d sum_count %d avg_count %f goodness1 %f goodness2 %f goodness3 %f pass123 %d %d %d\n",
-								  line_number, max_count, min_count, sum_count, avg_count, goodness1, goodness2, goodness3, pass1, pass2, pass3);
-				if (good_new == 0) printf("DEBUG: one or more of the sanity checks failed for line=%ld: %d %d %d goodness values %f %f %f\n",
-					line_number,pass1,pass2,pass3,goodness1,goodness2,goodness3);
-#endif // VERBOSE
-
-				// test to see if more than one CHA reports > 0.95*NFLUSHES events
-				found = 0;
-				old_cha = -1;
-				int min_counts = (NFLUSHES*19)/20;
-				for (tile=0; tile<CHA_per_socket; tile++) {
-					delta = corrected_pmc_delta(cha_counts[socket_under_test][tile][0][1],cha_counts[socket_under_test][tile][0][0],48);
-					if (delta >= min_counts) {
-						old_cha = cha_by_page[page_number][line_number];
-						cha_by_page[page_number][line_number] = tile;
-						found++;
-#ifdef VERBOSE
-						if (found > 1) {
-							printf("WARNING: Multiple (%d) CHAs found using counter 1 for cache line %ld, index %ld: old_cha %d new_cha %d\n",found,line_number,page_base_index+line_number*8,old_cha,cha_by_page[page_number][line_number]);
-						}
-#endif // VERBOSE
-					}
-				}
-				if (found == 0) {
-					good_old = 0;
-#ifdef VERBOSE
-					printf("WARNING: no CHA entry has been found for line %ld!\n",line_number);
-					printf("DEBUG dump for no CHA found\n");
-					for (tile=0; tile<CHA_per_socket; tile++) {
-                        delta = corrected_pmc_delta(cha_counts[socket_under_test][tile][0][1],cha_counts[socket_under_test][tile][0][0],48);
-						printf("CHA %d LLC_LOOKUP.READ          delta %ld\n",tile,delta);
-					}
-#endif // VERBOSE
-				} else if (found == 1) {
-					good_old = 1;
-				} else {
-					good_old = 0;
-#ifdef VERBOSE
-					printf("DEBUG dump for multiple CHAs found\n");
-					for (tile=0; tile<CHA_per_socket; tile++) {
-                        delta = corrected_pmc_delta(cha_counts[socket_under_test][tile][0][1],cha_counts[socket_under_test][tile][0][0],48);
-						printf("CHA %d LLC_LOOKUP.READ          delta %ld\n",tile,delta);
-					}
-#endif // VERBOSE
-				}
-				good = good_new * good_old;         // trigger a repeat if either the old or new tests failed
-				}
-				while (good == 0);
-#if 0
-				// 6. save the cache line number in the appropriate the cbo_indices[cbo][#lines] array
-				// 7. increment the corresponding cbo_num_lines[cbo] array entry
-				this_cbo = cha_by_page[page_number][line_number];
-				if (this_cbo == -1) {
-					printf("ERROR: cha_by_page[%ld][%ld] has not been set!\n",page_number,line_number);
-					exit(80);
-				}
-				cbo_indices[this_cbo][cbo_num_lines[this_cbo]] = line_number;
-				cbo_num_lines[this_cbo]++;
-#endif // 0
+			map_page(&line_mapper, &array[page_base_index], paddr_by_page[page_number], cha);
+#ifdef MAPPER_BENCH
+			mapper_bench.pages++;
+			if (BENCH_LINES < 32768) {		// partial pages are only timed -- no map file, no LINES_BY_CHA counts
+				if (mapper_bench.pages >= PAGES_MAPPED) break;
+				continue;
 			}
-			// I have not overwritten the filename, but I will rebuild it here just in case I add something stupid in between....
-			sprintf(filename,"PADDR_0x%.12lx.map",paddr_by_page[page_number]);
-			ptr_mapping_file = fopen(filename,"w");
-			if (!ptr_mapping_file) {
-				printf("ERROR: Failed to open Mapping File %s for writing -- aborting\n",filename);
-				exit(4);
-			}
-			// first try -- write one record of 32768 bytes
-			rc64 = fwrite(&cha_by_page[page_number][0],(size_t) 32768, (size_t) 1, ptr_mapping_file);
-			if (rc64 != 1) {
-				printf("ERROR: failed to write one 32768 Byte record to  %s -- return code %ld\n",filename,rc64);
-				exit(5);
-			} else {
-				printf("SUCCESS: wrote mapping file %d %s\n",new_pages_mapped,filename);
+#endif // MAPPER_BENCH
+#ifdef SIM_UNCORE
+			sim_uncore_check_page(&sim_uncore, paddr_by_page[page_number], cha);
+#endif // SIM_UNCORE
+			BENCH_PHASE(BENCH_FILE_IO);
+#ifdef MAPPER_BENCH
+			if (!map_file_exists)		// the benchmark never replaces a map file that is already in the data set
+#endif // MAPPER_BENCH
+			write_map_file(paddr_by_page[page_number], cha, new_pages_mapped);
+			BENCH_PHASE(BENCH_OTHER);
+			for (line_number=0; line_number<32768; line_number++) {
+				lines_by_cha[cha[line_number]]++;
 			}
-        page_numbers_mapped[new_pages_mapped] = page_number;
+#ifdef SELECT_PAGES
+			page_selector_add(&page_selector, paddr_by_page[page_number]);
+#endif // SELECT_PAGES
         new_pages_mapped += 1;
         if (new_pages_mapped >= PAGES_MAPPED) break;
 		}
 	}
+	free(visit_order);
     printf("INFO: %d new 2MiB pages have been mapped\n",new_pages_mapped);
-	printf("DUMMY: globalsum %d\n",globalsum);
-	printf("VERBOSE: L3 Mapping Complete in %ld tries for %d cache lines ratio %f\n",totaltries,32768*PAGES_MAPPED,(double)totaltries/(double)(32768*PAGES_MAPPED));
-
-    // Accumulate the number of lines mapped to each CHA slice in each of the new pages mapped
-	for (i=0; i<new_pages_mapped; i++) {
-        page_number = page_numbers_mapped[i];
-		for (line_number=0; line_number<32768; line_number++) {
-			lines_by_cha[cha_by_page[page_number][line_number]]++;
-		}
-	}
+	printf("DUMMY: globalsum %d\n",line_mapper.globalsum);
+	printf("VERBOSE: L3 Mapping Complete in %ld tries for %d cache lines ratio %f\n",line_mapper.totaltries,32768*PAGES_MAPPED,(double)line_mapper.totaltries/(double)(32768*PAGES_MAPPED));
+	line_mapper_report_all(&line_mapper);
+#ifdef SIM_UNCORE
+	sim_uncore_report(&sim_uncore);
+#endif // SIM_UNCORE
+#ifdef MAPPER_BENCH
+	mapper_bench_report(&mapper_bench, &cha_pmon, msr_batch_backend_name(cha_batch.backend));
+#endif // MAPPER_BENCH
+
+	free(cha);
     // Report the lines mapped to each CHA and the total number of lines mapped
 	long lines_accounted = 0;
 	printf("------------\n");
@@ -0,0 +1,163 @@
+// bench_slice_hash.c -- throughput benchmark for the batch address-to-slice kernels
+//
+// Usage: bench_slice_hash.exe CONFIG [MiB_of_addresses] [max_threads] [results_dir]
+//     e.g., bench_slice_hash.exe SPR_60 512 56 Results
+//
+// Two address patterns are tested, both below the validated address limit of the hash:
+//   lines_of_random_2MiB_pages -- all the cache lines of randomly-chosen 2MiB physical pages,
+//                                 modelling the lines of a large working set
+//   random_lines               -- randomly-chosen cache lines (no two neighbors share a page)
+// Each supported kernel is checked against slice_hash_slice_of() and timed on one thread,
+// then the fastest kernel is timed with 1, 2, 4, ... max_threads threads working on
+// disjoint parts of the array.  Rates are reported in addresses per second, and also
+// as the equivalent physical memory bandwidth (64 Bytes per address).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "slice_hash.h"
+
+#define NTRIALS 5
+
+static const char *pattern_names[] = { "lines_of_random_2MiB_pages", "random_lines" };
+
+typedef struct {
+    const slice_hash_t *h;
+    const uint64_t *paddr;
+    int8_t *slices;
+    size_t n;
+} bench_work_t;
+
+static double mysecond()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((double) ts.tv_sec + 1.0e-9 * (double) ts.tv_nsec);
+}
+
+static void *bench_worker(void *arg)
+{
+    bench_work_t *w = (bench_work_t *) arg;
+    slice_hash_slices_of(w->h, w->paddr, w->slices, w->n);
+    return(NULL);
+}
+
+// best-of-NTRIALS time for nthreads threads to compute the slices of all n addresses
+static double time_threads(const slice_hash_t *h, const uint64_t *paddr, int8_t *slices, size_t n, int nthreads)
+{
+    pthread_t threads[nthreads];
+    bench_work_t work[nthreads];
+    size_t chunk, start;
+    double t0, t, best = 1.0e30;
+    int trial, k;
+
+    chunk = (n + nthreads - 1) / nthreads;
+    for (trial=0; trial<NTRIALS; trial++) {
+        t0 = mysecond();
+        for (k=0; k<nthreads; k++) {
+            start = (size_t) k * chunk;
+            work[k].h = h;
+            work[k].paddr = &paddr[start < n ? start : n];
+            work[k].slices = &slices[start < n ? start : n];
+            work[k].n = (start < n) ? ((n - start < chunk) ? n - start : chunk) : 0;
+            pthread_create(&threads[k], NULL, bench_worker, &work[k]);
+        }
+        for (k=0; k<nthreads; k++) pthread_join(threads[k], NULL);
+        t = mysecond() - t0;
+        if (t < best) best = t;
+    }
+    return(best);
+}
+
+int main(int argc, char *argv[])
+{
+    slice_hash_t h;
+    const char *config, *results_dir;
+    size_t n, i, j, num_pages, mismatches;
+    long mib;
+    int max_threads, nthreads, kernel, best_kernel, pattern;
+    int errors = 0;
+    uint64_t *paddr, page_base, max_page;
+    int8_t *slices, *reference;
+    double t, rate, best_rate;
+
+    if (argc < 2) {
+        fprintf(stderr,"Usage: %s CONFIG [MiB_of_addresses] [max_threads] [results_dir]\n",argv[0]);
+        exit(1);
+    }
+    config = argv[1];
+    mib = (argc > 2) ? atol(argv[2]) : 256;
+    max_threads = (argc > 3) ? atoi(argv[3]) : 1;
+    results_dir = (argc > 4) ? argv[4] : "Results";
+    if (slice_hash_load(&h, results_dir, config) != 0) exit(1);
+
+    // 32768 lines per 2MiB page, 8 Bytes of address per line
+    num_pages = (mib * 1048576L) / (32768 * sizeof(uint64_t));
+    if (num_pages == 0) num_pages = 1;
+    n = num_pages * 32768;
+    paddr = (uint64_t *) malloc(n * sizeof(uint64_t));
+    slices = (int8_t *) malloc(n);
+    reference = (int8_t *) malloc(n);
+    if (paddr == NULL || slices == NULL || reference == NULL) {
+        fprintf(stderr,"ERROR: unable to allocate arrays for %ld addresses\n",n);
+        exit(2);
+    }
+    srand48(12345);
+    max_page = 1UL << (h.high_bit + 1 - 21);
+    printf("CONFIG %s slices %d base_len %ld masks_used %d addresses %ld\n",h.config,h.num_slices,h.base_len,h.num_masks_used,n);
+
+    for (pattern=0; pattern<2; pattern++) {
+        if (pattern == 0) {
+            for (i=0; i<num_pages; i++) {
+                page_base = ((uint64_t) (drand48() * (double) max_page)) << 21;
+                for (j=0; j<32768; j++) paddr[i*32768+j] = page_base + 64*j;
+            }
+        } else {
+            for (i=0; i<n; i++) paddr[i] = ((uint64_t) (drand48() * (double) (max_page << 15))) << 6;
+        }
+        for (i=0; i<n; i++) reference[i] = (int8_t) slice_hash_slice_of(&h, paddr[i]);
+
+        printf("PATTERN %s\n",pattern_names[pattern]);
+        printf("KERNEL      threads    Maddr/s   GB/s_equiv  mismatches\n");
+        best_kernel = SLICE_HASH_KERNEL_SCALAR;
+        best_rate = 0.0;
+        for (kernel=SLICE_HASH_KERNEL_SCALAR; kernel<=SLICE_HASH_KERNEL_GFNI; kernel++) {
+            if (!slice_hash_kernel_supported(kernel)) {
+                printf("%-10s  not supported on this processor\n",slice_hash_kernel_name(kernel));
+                continue;
+            }
+            slice_hash_select_kernel(kernel);
+            memset(slices, -1, n);
+            t = time_threads(&h, paddr, slices, n, 1);
+            mismatches = 0;
+            for (i=0; i<n; i++) if (slices[i] != reference[i]) mismatches++;
+            rate = (double) n / t;
+            printf("%-10s  %7d  %9.1f  %11.2f  %10ld\n",slice_hash_kernel_name(kernel),1,rate*1.0e-6,rate*64.0e-9,mismatches);
+            if (mismatches != 0) {
+                printf("ERROR: kernel %s disagrees with slice_hash_slice_of() for %ld addresses\n",slice_hash_kernel_name(kernel),mismatches);
+                errors++;
+            } else if (rate > best_rate) {
+                best_rate = rate;
+                best_kernel = kernel;
+            }
+        }
+
+        slice_hash_select_kernel(best_kernel);
+        printf("SCALING with kernel %s\n",slice_hash_kernel_name(best_kernel));
+        for (nthreads=1; nthreads<=max_threads; nthreads=(nthreads<max_threads && 2*nthreads>max_threads) ? max_threads : 2*nthreads) {
+            t = time_threads(&h, paddr, slices, n, nthreads);
+            rate = (double) n / t;
+            printf("%-10s  %7d  %9.1f  %11.2f  per_thread %9.1f\n",slice_hash_kernel_name(best_kernel),nthreads,
+                    rate*1.0e-6,rate*64.0e-9,rate*1.0e-6/nthreads);
+        }
+    }
+
+    free(paddr);
+    free(slices);
+    free(reference);
+    slice_hash_free(&h);
+    return(errors != 0);
+}
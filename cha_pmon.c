@@ -0,0 +1,126 @@
+// cha_pmon.c -- descriptor table of the CHA performance monitoring MSRs of each supported processor
+//
+// Each entry of cha_pmon_table[] describes one platform: the number of CHAs, the unit control
+// register of CHA 0 and the stride between CHAs (with any discontinuities in the MSR numbering),
+// the offsets of the PerfEvtSel, counter, and filter registers within a unit, and the default
+// event with its enable-bit semantics.  cha_pmon_resolve() looks up the entry for the CPUID
+// signature once at startup and expands it into flat arrays of MSR addresses (cha_pmon_t), so
+// that programming and reading the counters is an indexed load with no model-specific branches.
+// A new platform is a new table entry.
+
+#define CHA_PMON_MAX_FILTERS 2
+#define CHA_PMON_MAX_SKIPS 3
+
+// CHAs first_cha and up have their unit control register at unit_base + offset + unit_stride*cha
+typedef struct {
+    int first_cha;
+    int32_t offset;
+} cha_pmon_skip_t;
+
+typedef struct {
+    uint32_t signature;                 // CPUID signature (cpuid_check_inline.c)
+    const char *name;
+    const char *hash_prefix;            // prefix of the Results/ table names, e.g., "SKX" for SKX_28
+    int num_chas;                       // 0: the CHA counters are not supported yet
+    uint32_t unit_base;                 // unit control register of CHA 0
+    uint32_t unit_stride;
+    cha_pmon_skip_t skip[CHA_PMON_MAX_SKIPS];       // in increasing order of first_cha, first_cha 0 unused
+    int ctl_offset;                     // PerfEvtSel 0, relative to the unit control register
+    int ctr_offset;                     // counter 0
+    int num_filters;
+    int filter_offset[CHA_PMON_MAX_FILTERS];
+    uint64_t filter_value[CHA_PMON_MAX_FILTERS];
+    int unit_reset;                     // write 0x2 (reset counters) to the unit control register when programming
+    uint64_t event;                     // default event and umask for all counters
+    int enable_bit;                     // PerfEvtSel enable bit, or -1 if the part has none
+    uint64_t reserved_bits;             // PerfEvtSel bits that must never be written
+} cha_pmon_desc_t;
+
+static const cha_pmon_desc_t cha_pmon_table[] = {
+    // ------------ Haswell EP -- Xeon E5-2xxx v3 --------------
+    { CPUID_SIGNATURE_HASWELL, "Haswell EP", "HSX", 0 },
+    // ------------ Skylake Xeon and Cascade Lake Xeon -- 1st and 2nd generation Xeon Scalable Processors ------------
+    // LLC_LOOKUP.DATA_READ requires PMON_BOX_FILTER0 (offset 0x5) bits 26:17 -- 0x01e20000 is FMESI, all LLC lookups, not SF lookups.
+    // PMON_BOX_FILTER1 (offset 0x6) 0x03b: near and non-near memory, local and remote, all opcodes.
+    { CPUID_SIGNATURE_SKX, "Skylake Xeon/Cascade Lake Xeon", "SKX", 28, 0x0e00, 0x10, {{0,0}},
+      1, 8, 2, {5, 6}, {0x01e20000, 0x03b}, 0,
+      0x0334, 22, 0 },                  // LLC_LOOKUP.DATA_READ
+    // ------------- Ice Lake Xeon -- 3rd generation Xeon Scalable Processors ------------
+    // The MSRs skip forward by 0x0e for CHAs 18-33 and backwards by 0x47c for CHAs 34-39.
+    { CPUID_SIGNATURE_ICX, "Ice Lake Xeon", "ICX", 40, 0x0e00, 0x0e, {{0,0}, {18,0x0e}, {34,-0x47c}},
+      1, 8, 0, {0}, {0}, 1,
+      0x0350, 22, 0 },                  // REQUESTS.READS -- local read requests that miss the SF & LLC and are sent to the HA
+    // ------------------ Sapphire Rapids -- 4th generation Xeon Scalable Processors and Xeon CPU Max Processors ------------
+    // SPR does not use the "enable" bit (bit 22), and reserves it -- do not write!
+    { CPUID_SIGNATURE_SPR, "Sapphire Rapids Xeon", "SPR", 60, 0x2000, 0x10, {{0,0}},
+      2, 8, 0, {0}, {0}, 0,
+      0x0350, -1, 1UL<<22 },            // REQUESTS.READS -- local read requests that miss the SF & LLC and are sent to the HA
+};
+
+typedef struct {
+    const cha_pmon_desc_t *desc;
+    int num_chas;
+    uint32_t unit_ctl[NUM_CHA_BOXES];
+    uint32_t ctl[NUM_CHA_BOXES][NUM_CHA_COUNTERS];
+    uint32_t ctr[NUM_CHA_BOXES][NUM_CHA_COUNTERS];
+    uint32_t filter[NUM_CHA_BOXES][CHA_PMON_MAX_FILTERS];
+} cha_pmon_t;
+
+cha_pmon_t cha_pmon;                    // resolved once in main() for the processor running the mapper
+
+// Returns the table entry for a CPUID signature, or NULL if there is none
+const cha_pmon_desc_t *cha_pmon_find(uint32_t CurrentCPUIDSignature)
+{
+    int i;
+
+    for (i=0; i<(int)(sizeof(cha_pmon_table)/sizeof(cha_pmon_table[0])); i++) {
+        if (cha_pmon_table[i].signature == CurrentCPUIDSignature) return(&cha_pmon_table[i]);
+    }
+    return(NULL);
+}
+
+// The PerfEvtSel value for the default event, with the enable bit set where the part has one
+uint64_t cha_pmon_perfevtsel(const cha_pmon_desc_t *d)
+{
+    uint64_t val = d->event;
+
+    if (d->enable_bit >= 0) val |= 1UL << d->enable_bit;
+    return(val & ~d->reserved_bits);
+}
+
+// Fill in the MSR addresses of every CHA -- returns 0, or 1 if the CHA counters are not supported
+int cha_pmon_resolve(cha_pmon_t *p, uint32_t CurrentCPUIDSignature)
+{
+    const cha_pmon_desc_t *d;
+    uint32_t unit;
+    int cha, k, counter;
+
+    memset(p, 0, sizeof(*p));
+    d = cha_pmon_find(CurrentCPUIDSignature);
+    if (d == NULL || d->num_chas == 0) {
+        printf("ERROR: CHA counters not yet supported for CPUID Signature 0x%x\n",CurrentCPUIDSignature);
+        return(1);
+    }
+    if (d->num_chas > NUM_CHA_BOXES) {
+        printf("ERROR: %s has %d CHAs, more than NUM_CHA_BOXES (%d)\n",d->name,d->num_chas,NUM_CHA_BOXES);
+        return(1);
+    }
+    p->desc = d;
+    p->num_chas = d->num_chas;
+    for (cha=0; cha<d->num_chas; cha++) {
+        unit = d->unit_base + d->unit_stride*cha;
+        for (k=CHA_PMON_MAX_SKIPS-1; k>0; k--) {
+            if (d->skip[k].first_cha > 0 && cha >= d->skip[k].first_cha) {
+                unit += d->skip[k].offset;
+                break;
+            }
+        }
+        p->unit_ctl[cha] = unit;
+        for (counter=0; counter<NUM_CHA_COUNTERS; counter++) {
+            p->ctl[cha][counter] = unit + d->ctl_offset + counter;
+            p->ctr[cha][counter] = unit + d->ctr_offset + counter;
+        }
+        for (k=0; k<d->num_filters; k++) p->filter[cha][k] = unit + d->filter_offset[k];
+    }
+    return(0);
+}
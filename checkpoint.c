@@ -0,0 +1,198 @@
+// checkpoint.c -- crash-safe file writes, and checkpoint/resume of the page being mapped (with -DCHECKPOINT)
+//
+// write_file_atomic() writes a file under a temporary name, syncs it, and renames it into place, so
+// a map file is either complete or absent -- an interrupted run can no longer leave a truncated
+// PADDR_*.map file that makes the next run abort.  It is used for every map file.
+//
+// With -DCHECKPOINT, map_page() also saves the page in progress to CHECKPOINT_0x<paddr>.bin (a
+// header with the number of lines completed, followed by the 32768 slice numbers) every
+// CHECKPOINT_INTERVAL lines, and a later run that maps the same physical page resumes at the first
+// line not completed.  checkpoint_first() moves the pages of a buffer that have a checkpoint file to
+// the front of the order in which they are visited, so a page is resumed whenever a later run
+// gets its frame back (in the main loop, the per-socket workers and the rolling buffer).
+// The checkpoint is also written when the run exits in the middle of a page (e.g., exit(101) after
+// too many back-offs, through atexit()) and on SIGINT or SIGTERM, which are caught and acted on at
+// the next line boundary.  The checkpoint file is removed when the map file has been written.
+
+#ifndef CHECKPOINT_INTERVAL
+#define CHECKPOINT_INTERVAL 1024        // lines between checkpoints of the page in progress
+#endif
+#define CHECKPOINT_MAGIC 0x31544b43334cUL     // "L3CKT1"
+#ifndef MAP_FILE_PREFIX
+#define MAP_FILE_PREFIX "PADDR"         // map files are MAP_FILE_PREFIX_0x<paddr>.map
+#endif
+#ifndef CHECKPOINT_FILE_PREFIX
+#define CHECKPOINT_FILE_PREFIX "CHECKPOINT"     // checkpoint files are CHECKPOINT_0x<paddr>.bin
+#endif
+#ifndef FLUSHES_FILE_PREFIX
+#define FLUSHES_FILE_PREFIX "FLUSHES"   // per-line flush counts of -DADAPTIVE_FLUSHES, FLUSHES_0x<paddr>.bin
+#endif
+
+// Write hdr[0..hdr_len) followed by data[0..len) to filename via tmp.filename and rename()
+// -- returns 0 on success, 1 on failure (the original file, if any, is unchanged)
+int write_file_atomic(const char *filename, const void *hdr, size_t hdr_len, const void *data, size_t len)
+{
+    char tmpname[128];
+    FILE *fp;
+    int ok;
+
+    snprintf(tmpname, sizeof(tmpname), "tmp.%s", filename);     // not matched by PADDR_0x*.map scans
+    fp = fopen(tmpname, "w");
+    if (!fp) return(1);
+    ok = (hdr_len == 0 || fwrite(hdr, hdr_len, 1, fp) == 1) && fwrite(data, len, 1, fp) == 1;
+    ok = ok && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok || rename(tmpname, filename) != 0) {
+        unlink(tmpname);
+        return(1);
+    }
+    return(0);
+}
+
+#ifdef CHECKPOINT
+typedef struct {
+    uint64_t magic;
+    uint64_t paddr;
+    int64_t lines_done;                 // lines 0..lines_done-1 of cha[] are valid
+} checkpoint_header_t;
+
+typedef struct {
+    int8_t *cha;                        // NULL if no page is in progress
+    uint64_t paddr;
+    long lines_done;
+    long lines_saved;
+} checkpoint_t;
+
+static checkpoint_t checkpoints[NUM_SOCKETS];     // the page in progress on each socket
+static volatile sig_atomic_t checkpoint_signal = 0;
+
+static void checkpoint_filename(char *filename, uint64_t paddr)
+{
+    sprintf(filename,CHECKPOINT_FILE_PREFIX "_0x%.12lx.bin",paddr);
+}
+
+static int checkpoint_save(checkpoint_t *c)
+{
+    char filename[100];
+    checkpoint_header_t hdr;
+
+    hdr.magic = CHECKPOINT_MAGIC;
+    hdr.paddr = c->paddr;
+    hdr.lines_done = c->lines_done;
+    checkpoint_filename(filename, c->paddr);
+    if (write_file_atomic(filename, &hdr, sizeof(hdr), c->cha, 32768) != 0) {
+        printf("WARNING: failed to write checkpoint %s\n",filename);
+        return(1);
+    }
+    c->lines_saved = c->lines_done;
+    return(0);
+}
+
+// atexit() handler: save every page in progress
+static void checkpoint_save_all(void)
+{
+    int s;
+
+    for (s=0; s<NUM_SOCKETS; s++) {
+        if (checkpoints[s].cha != NULL && checkpoints[s].lines_done > checkpoints[s].lines_saved) {
+            if (checkpoint_save(&checkpoints[s]) == 0) {
+                printf("CHECKPOINT: saved paddr 0x%.12lx at line %ld on exit\n",checkpoints[s].paddr,checkpoints[s].lines_done);
+            }
+        }
+    }
+}
+
+static void checkpoint_signal_handler(int sig)
+{
+    checkpoint_signal = sig;
+}
+
+// Install the SIGINT/SIGTERM handlers and the atexit() handler -- call once, before any mapping thread starts
+void checkpoint_install(void)
+{
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = checkpoint_signal_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    atexit(checkpoint_save_all);
+    printf("INFO: checkpointing the page in progress every %d lines\n",CHECKPOINT_INTERVAL);
+}
+
+// Start (or resume) mapping the page at paddr into cha[] -- returns the first line to map
+long checkpoint_begin(line_mapper_t *m, uint64_t paddr, int8_t *cha)
+{
+    checkpoint_t *c = &checkpoints[m->socket];
+    char filename[100];
+    checkpoint_header_t hdr;
+    FILE *fp;
+
+    c->cha = cha;
+    c->paddr = paddr;
+    c->lines_done = 0;
+    c->lines_saved = 0;
+    checkpoint_filename(filename, paddr);
+    fp = fopen(filename, "r");
+    if (fp == NULL) return(0);
+    if (fread(&hdr, sizeof(hdr), 1, fp) == 1 && hdr.magic == CHECKPOINT_MAGIC && hdr.paddr == paddr
+            && hdr.lines_done > 0 && hdr.lines_done <= 32768 && fread(cha, 32768, 1, fp) == 1) {
+        c->lines_done = hdr.lines_done;
+        c->lines_saved = hdr.lines_done;
+        printf("CHECKPOINT: resuming paddr 0x%.12lx at line %ld\n",paddr,c->lines_done);
+    } else {
+        printf("WARNING: ignoring invalid checkpoint %s\n",filename);
+    }
+    fclose(fp);
+    return(c->lines_done);
+}
+
+// Lines 0..lines_done-1 are complete: save every CHECKPOINT_INTERVAL lines, and stop if a signal arrived
+void checkpoint_progress(line_mapper_t *m, long lines_done)
+{
+    checkpoint_t *c = &checkpoints[m->socket];
+
+    c->lines_done = lines_done;
+    if (checkpoint_signal != 0) {
+        printf("CHECKPOINT: signal %d received during paddr 0x%.12lx line %ld -- saving and exiting\n",
+                (int) checkpoint_signal,c->paddr,lines_done);
+        exit(128 + checkpoint_signal);  // the atexit() handler saves the page
+    }
+    if (lines_done - c->lines_saved >= CHECKPOINT_INTERVAL) checkpoint_save(c);
+}
+
+// The map file for paddr has been written: forget the page and remove its checkpoint
+void checkpoint_end(uint64_t paddr)
+{
+    char filename[100];
+    int s;
+
+    for (s=0; s<NUM_SOCKETS; s++) {
+        if (checkpoints[s].cha != NULL && checkpoints[s].paddr == paddr) checkpoints[s].cha = NULL;
+    }
+    checkpoint_filename(filename, paddr);
+    unlink(filename);
+}
+#endif // CHECKPOINT
+
+// Move the entries of pages[0..n) whose page (physical address paddr_by_page[page]) has a checkpoint
+// file to the front, keeping the order otherwise -- returns the number of such pages (0 without
+// -DCHECKPOINT)
+long checkpoint_first(const uint64_t *paddr_by_page, long *pages, long n)
+{
+    long num_resume = 0;
+#ifdef CHECKPOINT
+    char filename[100];
+    long i, k, page;
+
+    for (i=0; i<n; i++) {
+        checkpoint_filename(filename, paddr_by_page[pages[i]]);
+        if (access(filename, F_OK) != 0) continue;
+        page = pages[i];
+        for (k=i; k>num_resume; k--) pages[k] = pages[k-1];
+        pages[num_resume++] = page;
+    }
+#endif // CHECKPOINT
+    return(num_resume);
+}
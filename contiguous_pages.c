@@ -0,0 +1,68 @@
+// contiguous_pages.c -- 1GiB huge page allocation (compiled with -DMYHUGEPAGE_1GB) and detection of
+// physically contiguous runs of 2MiB pages
+//
+// Permutation select mask bits 21-29 are only exercised by 2MiB pages that differ in those address
+// bits, which a random set of THPs covers slowly.  A 1GiB page provides 512 consecutive 2MiB
+// physical blocks at once, needs one pagemap lookup instead of 512, and one TLB entry for the flush
+// loop.  The same benefit is available from THPs that the kernel happens to place contiguously, so
+// report_contiguous_runs() is called for every buffer to show how much of it is contiguous.
+
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << 26)                 // MAP_HUGE_SHIFT is 26
+#endif
+#define ONE_GIB (1UL << 30)
+
+// Allocate len Bytes (rounded up to a multiple of 1GiB) on 1GiB pages -- aborts on failure
+void *alloc_1gb_pages(size_t len)
+{
+    void *p;
+
+    len = (len + ONE_GIB - 1) & ~(ONE_GIB - 1);
+    p = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB|MAP_HUGE_1GB, -1, 0);
+    if (p == MAP_FAILED) {
+        printf("ERROR: mmap of %ld 1GiB pages failed: %s\n",(long)(len/ONE_GIB),strerror(errno));
+        printf("ERROR: reserve them with e.g. echo %ld > /sys/kernel/mm/hugepages/hugepages-1048576kB/nr_hugepages\n",(long)(len/ONE_GIB));
+        exit(3);
+    }
+    printf("INFO: allocated %ld 1GiB pages at %p\n",(long)(len/ONE_GIB),p);
+    return(p);
+}
+
+// Print the runs of 2MiB pages j, j+1, ... with consecutive physical addresses -- returns the longest run
+long report_contiguous_runs(const uint64_t *paddr, long num_pages)
+{
+    long j, start, len, longest = 0, num_runs = 0, pages_in_runs = 0, full_blocks = 0;
+    long histogram[11] = {0};               // bin k: runs of 2^k to 2^(k+1)-1 pages, k=10 for 1024 and up
+    int k;
+
+    for (start=0; start<num_pages; start+=len) {
+        for (len=1; start+len<num_pages; len++) {
+            if (paddr[start] == 0 || paddr[start+len] != paddr[start+len-1] + MYPAGESIZE) break;
+        }
+        if (paddr[start] == 0) continue;
+        // 1GiB-aligned blocks of 512 pages entirely inside this run
+        for (j=start; j+512<=start+len; j++) {
+            if ((paddr[j] & (ONE_GIB - 1)) == 0) {
+                full_blocks++;
+                j += 511;
+            }
+        }
+        if (len < 2) continue;
+        num_runs++;
+        pages_in_runs += len;
+        if (len > longest) longest = len;
+        k = 63 - __builtin_clzl(len);
+        histogram[MIN(k, 10)]++;
+    }
+    printf("CONTIGUOUS: %ld runs of 2 or more physically consecutive 2MiB pages hold %ld of %ld pages, longest %ld pages, %ld complete 1GiB blocks\n",
+            num_runs,pages_in_runs,num_pages,longest,full_blocks);
+    for (k=1; k<=10; k++) {
+        if (histogram[k] == 0) continue;
+        if (k < 10) {
+            printf("CONTIGUOUS: %ld runs of %ld-%ld pages\n",histogram[k],1L<<k,(2L<<k)-1);
+        } else {
+            printf("CONTIGUOUS: %ld runs of %ld or more pages\n",histogram[k],1L<<k);
+        }
+    }
+    return(longest);
+}
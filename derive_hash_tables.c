@@ -0,0 +1,461 @@
+// derive_hash_tables.c -- derive the base sequence and permutation select masks from PADDR_*.map files
+//
+// Usage: derive_hash_tables.exe MAP_DIR NAME [OUTPUT_DIR] [NTHREADS]
+//     e.g., derive_hash_tables.exe . SPR_60 /tmp 16
+//
+// Reads every PADDR_0x<paddr>.map file in MAP_DIR (32768 slice numbers for the 2MiB page at
+// <paddr>, as written by Map_Addresses_to_L3_Slices.c) and writes
+//     OUTPUT_DIR/BaseSequence_NAME-slice.tbl
+//     OUTPUT_DIR/PermSelectMasks_NAME-slice.tbl
+// in the format described in Results/README.md.
+//
+// Method:
+//   1. Period detection.  For n = 0, 1, ... 14, split the lowest-addressed map into blocks
+//      of L = 2^n lines and take the first block as the reference sequence R.  The period
+//      is the smallest L for which every block of that map is R under an XOR permutation
+//      (block[i] == R[i ^ q] for some q) and the permutations are consistent with a
+//      linear function of the address (checked with the GF(2) solver below).  If no L
+//      passes (e.g., a measurement error in that map), the next map is tried as the reference.
+//   2. Permutation identification.  Every block of every map is matched against R.  The
+//      candidate q values are the positions of block[0] in R, so each block costs about
+//      L/num_slices candidate checks.  Blocks that match no q (measurement errors) are
+//      counted, and if there are any no tables are written (the maps need to be remeasured).
+//      Some base sequences are symmetric: R[i ^ g] == R[i] for every g in a subspace G
+//      (e.g., dimension 3 for SKX_14), so q is only determined modulo G.  q is reduced to a
+//      canonical coset representative by clearing the pivot bits of an echelon basis of G.
+//      That reduction is linear, so the masks for the G pivot bits come out as zero, which
+//      is the convention used in the Results/ tables (e.g., masks 7, 10 and 12 of SKX_14).
+//   3. Mask solution.  Bit j of q is the parity of (mask_j AND (block_address XOR R_address)),
+//      so each block contributes one linear equation over GF(2) in the unknown mask bits,
+//      with one right-hand side per permutation bit.  The equations are reduced into a
+//      bit-packed row-echelon basis (one 64-bit row per pivot address bit, all 14 right-hand
+//      sides packed in a uint16_t), so each equation costs at most 64 XORs.  Each thread
+//      builds its own basis for its share of the maps, and the bases are merged at the end.
+//      Inconsistent equations are counted and reported.
+//   4. The highest validated address bit is the top of the contiguous run of address bits
+//      (starting at 6+n) that are pivots of the basis -- i.e., bits whose mask values are
+//      determined by the maps.  Undetermined mask bits are reported and written as zero.
+//      The base sequence is R re-indexed to physical address zero: BaseSequence[i] = R[i ^ p0],
+//      where p0 is the permutation of R's own address.  p0 is only known if the masks are
+//      determined at that address (it is in the span of the equations); otherwise no tables are
+//      written.
+//
+// The tool is meant to be rerun while mapping is in progress: it only reads the map files,
+// and the work is dominated by reading 32 KiB per map.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+
+#define LINES_PER_PAGE 32768
+#define MAX_PERM_BITS 14            // the Results format has 14 permutation select masks
+#define MAX_SLICES 128
+
+typedef struct {
+    uint64_t paddr;                 // 2MiB-aligned base address from the file name
+    char name[64];
+} map_file_t;
+
+// bit-packed GF(2) row-echelon basis: row[b] has its highest set bit at b
+typedef struct {
+    uint64_t row[64];
+    uint16_t rhs[64];
+    long equations;
+    long inconsistent;
+} gf2_basis_t;
+
+typedef struct {
+    int n;                          // log2 of the base sequence length
+    long len;
+    int8_t R[LINES_PER_PAGE];       // reference block
+    uint64_t R_paddr;               // physical address of the reference block
+    long *positions[MAX_SLICES];    // positions of each slice number in R
+    long num_positions[MAX_SLICES];
+    uint32_t symmetry[MAX_PERM_BITS+1]; // echelon basis of {g : R[i^g] == R[i]}, indexed by highest bit
+    int symmetry_dim;
+} reference_t;
+
+typedef struct {
+    const char *dir;
+    const map_file_t *maps;
+    long first, last;               // range of maps for this thread
+    const reference_t *ref;
+    gf2_basis_t basis;
+    long blocks, unmatched, unreadable;
+} worker_t;
+
+// -----------------------------------------------------------------------------------------
+static void gf2_insert(gf2_basis_t *B, uint64_t row, uint16_t rhs)
+{
+    int b;
+
+    B->equations++;
+    while (row != 0) {
+        b = 63 - __builtin_clzl(row);
+        if (B->row[b] == 0) {
+            B->row[b] = row;
+            B->rhs[b] = rhs;
+            return;
+        }
+        row ^= B->row[b];
+        rhs ^= B->rhs[b];
+    }
+    if (rhs != 0) B->inconsistent++;
+}
+
+// Solve for the masks, with undetermined (free) mask bits set to zero.
+// Pivots are processed from the lowest bit up, so the lower bits of each row are already known.
+static void gf2_solve(const gf2_basis_t *B, uint64_t *masks, int nbits)
+{
+    uint16_t x[64];
+    uint64_t rest;
+    int b, c, j;
+
+    for (b=0; b<64; b++) {
+        x[b] = 0;
+        if (B->row[b] == 0) continue;
+        x[b] = B->rhs[b];
+        rest = B->row[b] & ~(1UL << b);
+        while (rest != 0) {
+            c = __builtin_ctzl(rest);
+            x[b] ^= x[c];
+            rest &= rest - 1;
+        }
+    }
+    for (j=0; j<MAX_PERM_BITS; j++) {
+        masks[j] = 0;
+        if (j >= nbits) continue;
+        for (b=0; b<64; b++) masks[j] |= (uint64_t) ((x[b] >> j) & 1) << b;
+    }
+}
+
+// Non-zero if v is in the span of the basis, i.e., the masks are determined at v
+static int gf2_in_span(const gf2_basis_t *B, uint64_t v)
+{
+    int b;
+
+    while (v != 0) {
+        b = 63 - __builtin_clzl(v);
+        if (B->row[b] == 0) return(0);
+        v ^= B->row[b];
+    }
+    return(1);
+}
+
+static uint32_t perm_of(const uint64_t *masks, int nbits, uint64_t paddr)
+{
+    uint32_t p = 0;
+    int j;
+
+    for (j=0; j<nbits; j++) p |= (uint32_t) __builtin_parityl(paddr & masks[j]) << j;
+    return(p);
+}
+
+// -----------------------------------------------------------------------------------------
+static int read_map(const char *dir, const map_file_t *m, int8_t *buf)
+{
+    char filename[4096];
+    FILE *fp;
+    size_t k;
+
+    snprintf(filename, sizeof(filename), "%s/%s", dir, m->name);
+    fp = fopen(filename, "r");
+    if (!fp) return(1);
+    k = fread(buf, (size_t) LINES_PER_PAGE, (size_t) 1, fp);
+    fclose(fp);
+    return(k != 1);
+}
+
+// Canonical representative of the coset q + G
+static uint32_t reduce_by_symmetry(const reference_t *ref, uint32_t q)
+{
+    int b;
+
+    for (b=ref->n-1; b>=0; b--) {
+        if (((q >> b) & 1) && ref->symmetry[b] != 0) q ^= ref->symmetry[b];
+    }
+    return(q);
+}
+
+// Find an XOR permutation q with block[i] == R[i ^ q] for all i.
+// Returns 1 (with the canonical q) if one exists, 0 if the block does not match R.
+static int match_block(const reference_t *ref, const int8_t *block, uint32_t *q)
+{
+    int s = block[0];
+    long c, i;
+    uint32_t cand;
+
+    if (s < 0 || s >= MAX_SLICES) return(0);
+    for (c=0; c<ref->num_positions[s]; c++) {
+        cand = (uint32_t) ref->positions[s][c];
+        for (i=1; i<ref->len; i++) {
+            if (block[i] != ref->R[i ^ cand]) break;
+        }
+        if (i == ref->len) {
+            *q = reduce_by_symmetry(ref, cand);
+            return(1);
+        }
+    }
+    return(0);
+}
+
+static void add_page_equations(const reference_t *ref, uint64_t paddr, const int8_t *page, gf2_basis_t *B,
+                               long *blocks, long *unmatched)
+{
+    long blk;
+    uint32_t q;
+
+    for (blk=0; blk<LINES_PER_PAGE/ref->len; blk++) {
+        (*blocks)++;
+        if (match_block(ref, &page[blk*ref->len], &q) == 0) {
+            (*unmatched)++;
+        } else {
+            gf2_insert(B, (paddr + 64UL*blk*ref->len) ^ ref->R_paddr, (uint16_t) q);
+        }
+    }
+}
+
+static void build_reference(reference_t *ref, int n, const int8_t *page, uint64_t paddr)
+{
+    long i, c;
+    int s, b;
+    uint32_t g;
+
+    ref->n = n;
+    ref->len = 1L << n;
+    ref->R_paddr = paddr;
+    memcpy(ref->R, page, ref->len);
+    for (s=0; s<MAX_SLICES; s++) ref->num_positions[s] = 0;
+    for (i=0; i<ref->len; i++) {
+        s = page[i];
+        if (s >= 0 && s < MAX_SLICES) ref->positions[s][ref->num_positions[s]++] = i;
+    }
+    // symmetries of R: any g with R[i ^ g] == R[i] must have R[g] == R[0]
+    for (b=0; b<=MAX_PERM_BITS; b++) ref->symmetry[b] = 0;
+    ref->symmetry_dim = 0;
+    s = page[0];
+    for (c=0; s >= 0 && s < MAX_SLICES && c<ref->num_positions[s]; c++) {
+        g = (uint32_t) ref->positions[s][c];
+        if (g == 0) continue;
+        for (i=1; i<ref->len; i++) {
+            if (page[i] != page[i ^ g]) break;
+        }
+        if (i < ref->len) continue;
+        while (g != 0) {
+            b = 31 - __builtin_clz(g);
+            if (ref->symmetry[b] == 0) {
+                ref->symmetry[b] = g;
+                ref->symmetry_dim++;
+                break;
+            }
+            g ^= ref->symmetry[b];
+        }
+    }
+}
+
+static void *worker(void *arg)
+{
+    worker_t *w = (worker_t *) arg;
+    int8_t page[LINES_PER_PAGE];
+    long m, unmatched_before;
+
+    for (m=w->first; m<w->last; m++) {
+        if (read_map(w->dir, &w->maps[m], page) != 0) {
+            w->unreadable++;
+            continue;
+        }
+        unmatched_before = w->unmatched;
+        add_page_equations(w->ref, w->maps[m].paddr, page, &w->basis, &w->blocks, &w->unmatched);
+        if (w->unmatched != unmatched_before) {
+            fprintf(stderr,"WARNING: %s: %ld blocks are not a permutation of the base sequence\n",w->maps[m].name,w->unmatched - unmatched_before);
+        }
+    }
+    return(NULL);
+}
+
+static int compare_maps(const void *a, const void *b)
+{
+    uint64_t x = ((const map_file_t *) a)->paddr;
+    uint64_t y = ((const map_file_t *) b)->paddr;
+    return( (x > y) - (x < y) );
+}
+
+// -----------------------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+    const char *dir, *name, *outdir;
+    int nthreads, n, s, j, b, low_bit, high_bit, undetermined, name_len;
+    DIR *dp;
+    struct dirent *de;
+    map_file_t *maps = NULL;
+    long num_maps = 0, capacity = 0, k, i, r;
+    unsigned long long paddr;
+    int8_t page0[LINES_PER_PAGE];
+    reference_t *ref;
+    gf2_basis_t basis;
+    worker_t *workers;
+    pthread_t *threads;
+    long blocks, unmatched, unreadable;
+    uint64_t masks[MAX_PERM_BITS];
+    uint32_t p0;
+    char filename[4096];
+    FILE *fp;
+
+    if (argc < 3) {
+        fprintf(stderr,"Usage: %s MAP_DIR NAME [OUTPUT_DIR] [NTHREADS]\n",argv[0]);
+        exit(1);
+    }
+    dir = argv[1];
+    name = argv[2];
+    outdir = (argc > 3) ? argv[3] : ".";
+    nthreads = (argc > 4) ? atoi(argv[4]) : 1;
+    if (nthreads < 1) nthreads = 1;
+
+    // collect the map files
+    dp = opendir(dir);
+    if (dp == NULL) {
+        fprintf(stderr,"ERROR: unable to open directory %s: %s\n",dir,strerror(errno));
+        exit(1);
+    }
+    while ((de = readdir(dp)) != NULL) {
+        name_len = 0;               // only PADDR_0x<hex>.map exactly -- not .lat or other files
+        if (sscanf(de->d_name, "PADDR_0x%llx%n", &paddr, &name_len) != 1 || strcmp(de->d_name + name_len, ".map") != 0) continue;
+        if (strlen(de->d_name) >= sizeof(maps[0].name)) continue;
+        if (num_maps == capacity) {
+            capacity = (capacity == 0) ? 1024 : 2*capacity;
+            maps = (map_file_t *) realloc(maps, capacity * sizeof(map_file_t));
+            if (maps == NULL) {
+                fprintf(stderr,"ERROR: out of memory listing %s\n",dir);
+                exit(2);
+            }
+        }
+        maps[num_maps].paddr = (uint64_t) paddr;
+        strcpy(maps[num_maps].name, de->d_name);
+        num_maps++;
+    }
+    closedir(dp);
+    if (num_maps == 0) {
+        fprintf(stderr,"ERROR: no PADDR_0x*.map files found in %s\n",dir);
+        exit(1);
+    }
+    qsort(maps, num_maps, sizeof(map_file_t), compare_maps);
+    printf("INFO: %ld map files, lowest 0x%.12lx highest 0x%.12lx\n",num_maps,maps[0].paddr,maps[num_maps-1].paddr);
+
+    ref = (reference_t *) malloc(sizeof(reference_t));
+    for (s=0; s<MAX_SLICES; s++) ref->positions[s] = (long *) malloc(LINES_PER_PAGE * sizeof(long));
+
+    // 1. period detection on the lowest-addressed map that passes it
+    n = MAX_PERM_BITS + 1;
+    for (r=0; r<num_maps && n > MAX_PERM_BITS; r++) {
+        if (read_map(dir, &maps[r], page0) != 0) {
+            fprintf(stderr,"WARNING: unable to read %s/%s -- trying the next map as the reference\n",dir,maps[r].name);
+            continue;
+        }
+        for (n=0; n<=MAX_PERM_BITS; n++) {
+            build_reference(ref, n, page0, maps[r].paddr);
+            memset(&basis, 0, sizeof(basis));
+            blocks = unmatched = 0;
+            add_page_equations(ref, maps[r].paddr, page0, &basis, &blocks, &unmatched);
+            if (unmatched == 0 && basis.inconsistent == 0) break;
+        }
+        if (n > MAX_PERM_BITS) {
+            fprintf(stderr,"WARNING: %s is not an XOR-permuted repetition of any base sequence of up to %d lines -- trying the next map as the reference\n",
+                    maps[r].name,1<<MAX_PERM_BITS);
+        }
+    }
+    if (n > MAX_PERM_BITS) {
+        fprintf(stderr,"ERROR: none of the %ld maps is an XOR-permuted repetition of a base sequence of up to %d lines\n",
+                num_maps,1<<MAX_PERM_BITS);
+        exit(3);
+    }
+    if (r > 1) printf("INFO: reference sequence taken from %s\n",maps[r-1].name);
+    low_bit = 6 + n;
+    printf("INFO: base sequence period %ld lines -- permutation select masks start at address bit %d\n",ref->len,low_bit);
+    if (ref->symmetry_dim > 0) {
+        printf("INFO: base sequence has a %d-dimensional XOR symmetry -- masks for permutation bits",ref->symmetry_dim);
+        for (b=0; b<n; b++) if (ref->symmetry[b] != 0) printf(" %d",b);
+        printf(" are set to zero\n");
+    }
+
+    // 2+3. match every block of every map and reduce the equations, in parallel
+    workers = (worker_t *) calloc(nthreads, sizeof(worker_t));
+    threads = (pthread_t *) malloc(nthreads * sizeof(pthread_t));
+    for (k=0; k<nthreads; k++) {
+        workers[k].dir = dir;
+        workers[k].maps = maps;
+        workers[k].first = (num_maps * k) / nthreads;
+        workers[k].last = (num_maps * (k+1)) / nthreads;
+        workers[k].ref = ref;
+        pthread_create(&threads[k], NULL, worker, &workers[k]);
+    }
+    memset(&basis, 0, sizeof(basis));
+    blocks = unmatched = unreadable = 0;
+    for (k=0; k<nthreads; k++) {
+        pthread_join(threads[k], NULL);
+        blocks += workers[k].blocks;
+        unmatched += workers[k].unmatched;
+        unreadable += workers[k].unreadable;
+        basis.inconsistent += workers[k].basis.inconsistent;
+        for (b=0; b<64; b++) {
+            if (workers[k].basis.row[b] != 0) gf2_insert(&basis, workers[k].basis.row[b], workers[k].basis.rhs[b]);
+        }
+    }
+    printf("INFO: %ld blocks, %ld unmatched, %ld unreadable map files\n",blocks,unmatched,unreadable);
+    if (unmatched != 0) {
+        fprintf(stderr,"ERROR: %ld blocks are not a permutation of the base sequence (measurement errors, or files that are not maps) -- no tables written\n",
+                unmatched);
+        exit(6);
+    }
+    if (basis.inconsistent != 0) {
+        printf("WARNING: %ld block permutations are inconsistent with any set of permutation select masks\n",basis.inconsistent);
+    }
+
+    // 4. solve, then find the validated address range
+    gf2_solve(&basis, masks, n);
+    high_bit = low_bit - 1;
+    while (high_bit < 63 && basis.row[high_bit+1] != 0) high_bit++;
+    undetermined = 0;
+    for (b=high_bit+1; b<64; b++) if (basis.row[b] != 0) undetermined++;
+    if (high_bit < low_bit) {
+        fprintf(stderr,"ERROR: the maps do not determine any permutation select mask bits\n");
+        exit(4);
+    }
+    printf("INFO: masks validated for address bits %d..%d",low_bit,high_bit);
+    if (undetermined) printf(" (%d higher bits are determined, but bit %d is not)",undetermined,high_bit+1);
+    printf("\n");
+
+    // write the tables
+    if (!gf2_in_span(&basis, ref->R_paddr)) {
+        fprintf(stderr,"ERROR: the maps do not determine the permutation of the reference address 0x%.12lx -- cannot align the base sequence\n",
+                ref->R_paddr);
+        exit(4);
+    }
+    p0 = perm_of(masks, n, ref->R_paddr);
+    snprintf(filename, sizeof(filename), "%s/BaseSequence_%s-slice.tbl", outdir, name);
+    fp = fopen(filename, "w");
+    if (!fp) {
+        fprintf(stderr,"ERROR: unable to open %s for writing: %s\n",filename,strerror(errno));
+        exit(5);
+    }
+    for (i=0; i<ref->len; i++) fprintf(fp, "%d\n", ref->R[i ^ p0]);
+    fclose(fp);
+    printf("SUCCESS: wrote %s\n",filename);
+
+    snprintf(filename, sizeof(filename), "%s/PermSelectMasks_%s-slice.tbl", outdir, name);
+    fp = fopen(filename, "w");
+    if (!fp) {
+        fprintf(stderr,"ERROR: unable to open %s for writing: %s\n",filename,strerror(errno));
+        exit(5);
+    }
+    fprintf(fp, "%d %d\n", low_bit, high_bit);
+    for (j=0; j<MAX_PERM_BITS; j++) fprintf(fp, "0x%lx ", masks[j] & ((high_bit == 63) ? ~0UL : ((1UL << (high_bit+1)) - 1)));
+    fprintf(fp, "\n");
+    fclose(fp);
+    printf("SUCCESS: wrote %s\n",filename);
+
+    return(basis.inconsistent != 0);
+}
@@ -0,0 +1,88 @@
+// gen_slice_hash_tables.c -- generate a specialized, header-only hash evaluator for one configuration
+//
+// Usage: gen_slice_hash_tables.exe CONFIG [results_dir] > slice_hash_CONFIG.h
+//     e.g., gen_slice_hash_tables.exe SKX_28 Results > slice_hash_SKX_28.h
+//
+// The generated header contains the base sequence as a constant table and a static inline
+// function
+//      int slice_hash_CONFIG(uint64_t paddr)
+// with the permutation select masks as literal constants.  Only the non-zero masks are
+// emitted (one parity per mask, which the compiler schedules in parallel), the index mask
+// is a literal, and the table is stored in the smallest form that holds the slice numbers:
+// two 4-bit entries per byte for configurations with at most 16 slices, one int8 otherwise.
+// Compared with slice_hash_slice_of() there are no loops, no loads of the masks or of the
+// table pointer, and no memo, so the lookup latency is a few cycles plus one table load.
+//
+// The header also defines SLICE_HASH_CONFIG_NUM_SLICES, _BASE_BITS, _NUM_MASKS, _LOW_BIT,
+// _HIGH_BIT and _PACKING (4 or 8 bits per entry) for use in compile-time checks.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "slice_hash.h"
+
+int main(int argc, char *argv[])
+{
+    slice_hash_t h;
+    const char *config, *results_dir;
+    long i, num_bytes;
+    int j, packing, value;
+
+    if (argc < 2) {
+        fprintf(stderr,"Usage: %s CONFIG [results_dir] > slice_hash_CONFIG.h\n",argv[0]);
+        exit(1);
+    }
+    config = argv[1];
+    results_dir = (argc > 2) ? argv[2] : "Results";
+    if (slice_hash_load(&h, results_dir, config) != 0) exit(1);
+
+    packing = (h.num_slices <= 16) ? 4 : 8;
+    num_bytes = (packing == 4) ? (h.base_len + 1) / 2 : h.base_len;
+
+    printf("// slice_hash_%s.h -- generated by gen_slice_hash_tables.exe from %s/BaseSequence_%s-slice.tbl\n",config,results_dir,config);
+    printf("//                     and %s/PermSelectMasks_%s-slice.tbl -- do not edit\n",results_dir,config);
+    printf("// slice = BaseSequence[((paddr >> 6) & 0x%lx) ^ perm(paddr)], valid for addresses below 2^%d\n\n",h.base_len-1,h.high_bit+1);
+    printf("#ifndef SLICE_HASH_%s_H\n",config);
+    printf("#define SLICE_HASH_%s_H\n\n",config);
+    printf("#include <stdint.h>\n\n");
+    printf("#define SLICE_HASH_%s_NUM_SLICES %d\n",config,h.num_slices);
+    printf("#define SLICE_HASH_%s_BASE_BITS %d\n",config,h.base_bits);
+    printf("#define SLICE_HASH_%s_NUM_MASKS %d\n",config,h.num_masks_used);
+    printf("#define SLICE_HASH_%s_LOW_BIT %d\n",config,h.low_bit);
+    printf("#define SLICE_HASH_%s_HIGH_BIT %d\n",config,h.high_bit);
+    printf("#define SLICE_HASH_%s_PACKING %d\n\n",config,packing);
+
+    if (packing == 4) {
+        printf("// two base sequence entries per byte, even index in the low nibble\n");
+        printf("static const uint8_t slice_hash_%s_base[%ld] = {",config,num_bytes);
+        for (i=0; i<num_bytes; i++) {
+            value = h.base_sequence[2*i] & 0xf;
+            if (2*i+1 < h.base_len) value |= (h.base_sequence[2*i+1] & 0xf) << 4;
+            printf("%s0x%02x%s", (i%16 == 0) ? "\n    " : "", value, (i < num_bytes-1) ? "," : "");
+        }
+    } else {
+        printf("static const int8_t slice_hash_%s_base[%ld] = {",config,num_bytes);
+        for (i=0; i<num_bytes; i++) {
+            printf("%s%d%s", (i%16 == 0) ? "\n    " : "", h.base_sequence[i], (i < num_bytes-1) ? "," : "");
+        }
+    }
+    printf("\n};\n\n");
+
+    printf("static inline __attribute__((always_inline)) int slice_hash_%s(uint64_t paddr)\n",config);
+    printf("{\n");
+    printf("    uint32_t index = (uint32_t) (paddr >> 6) & 0x%lxU;\n",h.base_len-1);
+    for (j=0; j<h.num_masks_used; j++) {
+        if (h.masks[j] != 0) {
+            printf("    index ^= (uint32_t) __builtin_parityl(paddr & 0x%lxUL) << %d;\n",h.masks[j],j);
+        }
+    }
+    if (packing == 4) {
+        printf("    return( (slice_hash_%s_base[index >> 1] >> ((index & 1) << 2)) & 0xf );\n",config);
+    } else {
+        printf("    return( slice_hash_%s_base[index] );\n",config);
+    }
+    printf("}\n\n");
+    printf("#endif // SLICE_HASH_%s_H\n",config);
+
+    slice_hash_free(&h);
+    return(0);
+}
@@ -0,0 +1,66 @@
+// goodness.c -- the "goodness" tests that accept or reject one try of the full measurement of a cache line
+//
+// Shared by map_cache_line_full() and the trace replay tool (trace_replay.c), so that recorded
+// tries are replayed through the same classifier that produced them.  For the CHA counter deltas
+// of one try of nflushes load/flush iterations:
+//     goodness1 = max/nflushes                 pass if > goodness1_min (0.95)
+//     goodness2 = min/nflushes                 pass if < goodness2_max (0.20)
+//     goodness3 = avg/nflushes                 pass if < goodness3_max (0.40), avg = (sum - max)/num_chas
+// and exactly one CHA must count at least owner_permille/1000 of the nflushes loads (950).
+// The try is good when all four tests pass, and that CHA owns the line.
+
+#define GOODNESS_PASS1 0x1
+#define GOODNESS_PASS2 0x2
+#define GOODNESS_PASS3 0x4
+#define GOODNESS_ONE_OWNER 0x8          // exactly one CHA at or above the owner threshold
+#define GOODNESS_ALL 0xf
+
+typedef struct {
+    double goodness1_min;
+    double goodness2_max;
+    double goodness3_max;
+    int owner_permille;
+} goodness_limits_t;
+
+static const goodness_limits_t goodness_default_limits = { 0.95, 0.20, 0.40, 950 };
+
+typedef struct {
+    int max_count, min_count, sum_count;
+    double avg_count;
+    double goodness1, goodness2, goodness3;
+    int found;                          // number of CHAs at or above the owner threshold
+    int cha;                            // the last of those CHAs, -1 if none
+    int pass;                           // GOODNESS_* bits
+} goodness_t;
+
+// Classify one try -- returns 1 if it is good (g->cha owns the line), 0 if it must be repeated
+int goodness_classify(const goodness_limits_t *lim, const long *delta, int num_chas, int nflushes, goodness_t *g)
+{
+    int tile;
+    int min_counts = (nflushes*lim->owner_permille)/1000;
+
+    g->max_count = 0;
+    g->min_count = 1<<30;
+    g->sum_count = 0;
+    g->found = 0;
+    g->cha = -1;
+    for (tile=0; tile<num_chas; tile++) {
+        g->max_count = MAX(g->max_count, delta[tile]);
+        g->min_count = MIN(g->min_count, delta[tile]);
+        g->sum_count += delta[tile];
+        if (delta[tile] >= min_counts) {
+            g->cha = tile;
+            g->found++;
+        }
+    }
+    g->avg_count = (double)(g->sum_count - g->max_count) / (double)(num_chas);
+    g->goodness1 = (double) g->max_count / (double) nflushes;
+    g->goodness2 = (double) g->min_count / (double) nflushes;
+    g->goodness3 =          g->avg_count / (double) nflushes;
+    g->pass = 0;
+    if (g->goodness1 > lim->goodness1_min) g->pass |= GOODNESS_PASS1;
+    if (g->goodness2 < lim->goodness2_max) g->pass |= GOODNESS_PASS2;
+    if (g->goodness3 < lim->goodness3_max) g->pass |= GOODNESS_PASS3;
+    if (g->found == 1) g->pass |= GOODNESS_ONE_OWNER;
+    return(g->pass == GOODNESS_ALL);
+}
@@ -0,0 +1,181 @@
+// infer_page.c -- map a 2MiB page from a few dozen measured lines, given the base sequence (compiled with -DINFER_PERMUTATION)
+//
+// Within each block of L = base_len cache lines the slice of line i is BaseSequence[i ^ p] for one
+// permutation p of the block.  p is identified by measuring lines one at a time: starting from all
+// L candidates, each measurement keeps only the candidates p with BaseSequence[i ^ p] equal to the
+// measured slice, and the next line is the one (of a sample of INFER_PROBE_SAMPLE lines, or of the
+// whole block if no sampled line helps) whose slice splits the remaining candidates most evenly.
+// Identification stops when all remaining candidates give the same slices for the whole block --
+// they then differ only by an XOR symmetry of the base sequence -- which typically takes
+// log(L)/log(num_slices) + 1 or 2 measurements.
+//
+// Because each permutation bit is the parity of (address & mask), p is an affine function of the
+// block number within the page, so only block 0 and the blocks 1, 2, 4, ... are identified, and
+// the permutation of block x is p_0 ^ XOR over the bits k of x of (p_{2^k} ^ p_0).  The synthesized
+// 32768-entry map is then spot-checked by measuring INFER_SPOT_CHECKS lines spread over the page.
+// If a block cannot be identified or a spot check disagrees, infer_page() returns 1 and the caller
+// measures every line of the page.
+//
+// The base sequence is read with the permutation select masks from RESULTS_DIR (e.g., the output
+// directory of derive_hash_tables.exe from an earlier run), but the masks themselves are not used.
+
+#ifndef INFER_PROBE_SAMPLE
+#define INFER_PROBE_SAMPLE 64
+#endif
+#ifndef INFER_SPOT_CHECKS
+#define INFER_SPOT_CHECKS 32
+#endif
+
+void line_mapper_load_base(line_mapper_t *m)
+{
+    slice_hash_t *h = (slice_hash_t *) malloc(sizeof(slice_hash_t));
+
+    m->base = NULL;
+    m->pages_inferred = 0;
+    m->pages_not_inferred = 0;
+    m->infer_lines_measured = 0;
+    if (h == NULL || line_mapper_open_tables(m, h) != 0) {
+        free(h);
+        return;
+    }
+    printf("INFO: permutation inference using the %s/%s base sequence (%ld lines per block), %d spot checks per page\n",
+            RESULTS_DIR,h->config,h->base_len,INFER_SPOT_CHECKS);
+    m->base = h;
+}
+
+// 1 if every candidate permutation gives the same slices as cand[0] for the whole block
+static int candidates_equivalent(const slice_hash_t *h, const uint32_t *cand, long num_cand)
+{
+    long c, i;
+
+    for (c=1; c<num_cand; c++) {
+        for (i=0; i<h->base_len; i++) {
+            if (h->base_sequence[i ^ cand[c]] != h->base_sequence[i ^ cand[0]]) return(0);
+        }
+    }
+    return(1);
+}
+
+// Identify the permutation of the block of lines starting at line first_line of the page.
+// Returns 0 and the permutation in *perm, or 1 if the measurements are inconsistent with the base sequence.
+static int identify_block(line_mapper_t *m, double *page, uint64_t paddr, long first_line, uint32_t *cand, uint32_t *perm, uint64_t *seed)
+{
+    const slice_hash_t *h = m->base;
+    long num_cand, c, k, n, i, best_i, best_max, group_max;
+    long counts[NUM_CHA_BOXES];
+    int slice, s;
+
+    num_cand = h->base_len;
+    for (c=0; c<num_cand; c++) cand[c] = (uint32_t) c;
+    best_i = 0;                         // every line splits the full candidate set the same way
+    while (1) {
+        slice = map_cache_line(m, &page[(first_line+best_i)*8], paddr + 64*(first_line+best_i), first_line+best_i);
+        m->infer_lines_measured++;
+        n = 0;
+        for (c=0; c<num_cand; c++) {
+            if (h->base_sequence[best_i ^ cand[c]] == slice) cand[n++] = cand[c];
+        }
+        num_cand = n;
+        if (num_cand == 0) {
+            printf("WARNING: paddr 0x%.12lx line %ld measured on CHA %d -- no permutation of the base sequence matches\n",
+                    paddr,first_line+best_i,slice);
+            return(1);
+        }
+        if (num_cand == 1 || (num_cand <= INFER_PROBE_SAMPLE && candidates_equivalent(h, cand, num_cand))) break;
+
+        // next line: the one of a sample that minimizes the largest group of remaining candidates,
+        // or of all lines of the block if none of the sampled lines separates the candidates
+        best_max = num_cand + 1;
+        for (k=0; k<INFER_PROBE_SAMPLE + h->base_len; k++) {
+            if (k < INFER_PROBE_SAMPLE) {
+                *seed = *seed * 6364136223846793005UL + 1442695040888963407UL;
+                i = (long) ((*seed >> 33) & (uint64_t)(h->base_len - 1));
+            } else if (best_max < num_cand) {
+                break;
+            } else {
+                i = k - INFER_PROBE_SAMPLE;
+            }
+            for (s=0; s<h->num_slices; s++) counts[s] = 0;
+            group_max = 0;
+            for (c=0; c<num_cand; c++) {
+                s = h->base_sequence[i ^ cand[c]];
+                counts[s]++;
+                if (counts[s] > group_max) group_max = counts[s];
+            }
+            if (group_max < best_max) {
+                best_max = group_max;
+                best_i = i;
+            }
+        }
+        if (best_max == num_cand) {
+            if (candidates_equivalent(h, cand, num_cand)) break;
+            printf("WARNING: paddr 0x%.12lx block at line %ld -- %ld candidate permutations cannot be separated\n",
+                    paddr,first_line,num_cand);
+            return(1);
+        }
+    }
+    *perm = cand[0];
+    return(0);
+}
+
+// Returns 0 if cha[0..32767] has been synthesized and spot-checked, 1 if the page must be measured
+int infer_page(line_mapper_t *m, double *page, uint64_t paddr, int8_t *cha)
+{
+    const slice_hash_t *h = m->base;
+    long L = h->base_len;
+    long num_blocks = 32768 / L;
+    long x, i, line_number, measured_start = m->infer_lines_measured;
+    uint32_t *cand, perm0, basis[16], perm;
+    int k, num_basis, slice;
+    uint64_t seed = paddr ^ 0x9e3779b97f4a7c15UL;
+
+    if (L > 32768) return(1);
+    cand = (uint32_t *) malloc(L * sizeof(uint32_t));
+    if (cand == NULL) return(1);
+
+    // block 0 and blocks 1, 2, 4, ... of the page
+    if (identify_block(m, page, paddr, 0, cand, &perm0, &seed) != 0) goto fail;
+    num_basis = 0;
+    for (x=1; x<num_blocks; x*=2) {
+        if (identify_block(m, page, paddr, x*L, cand, &perm, &seed) != 0) goto fail;
+        basis[num_basis++] = perm ^ perm0;
+    }
+
+    for (x=0; x<num_blocks; x++) {
+        perm = perm0;
+        for (k=0; k<num_basis; k++) {
+            if (x & (1L << k)) perm ^= basis[k];
+        }
+        for (i=0; i<L; i++) cha[x*L + i] = h->base_sequence[i ^ perm];
+    }
+
+    // spot checks at pseudo-random lines, one in each of INFER_SPOT_CHECKS equal parts of the page
+    for (k=0; k<INFER_SPOT_CHECKS; k++) {
+        seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+        line_number = k * (32768 / INFER_SPOT_CHECKS) + (long) ((seed >> 33) % (32768 / INFER_SPOT_CHECKS));
+        slice = map_cache_line(m, &page[line_number*8], paddr + 64*line_number, line_number);
+        m->infer_lines_measured++;
+        if (slice != cha[line_number]) {
+            printf("WARNING: paddr 0x%.12lx spot check of line %ld measured CHA %d, inferred CHA %d -- measuring all lines\n",
+                    paddr,line_number,slice,cha[line_number]);
+            goto fail;
+        }
+    }
+    free(cand);
+    m->pages_inferred++;
+    printf("INFER: paddr 0x%.12lx inferred from %ld measured lines\n",paddr,m->infer_lines_measured-measured_start);
+    return(0);
+
+fail:
+    free(cand);
+    m->pages_not_inferred++;
+    return(1);
+}
+
+void line_mapper_report_infer(line_mapper_t *m)
+{
+    if (m->base == NULL) return;
+    printf("INFER: %ld pages inferred, %ld pages measured in full, %ld lines measured for inference (%f per inferred page)\n",
+            m->pages_inferred, m->pages_not_inferred, m->infer_lines_measured,
+            (double)m->infer_lines_measured/(double)MAX(m->pages_inferred,1));
+}
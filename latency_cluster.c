@@ -0,0 +1,254 @@
+// latency_cluster.c -- cluster per-core load latency signatures into L3 slices
+//
+// Shared by the latency engine of the mapper (latency_engine.c, -DLATENCY_ENGINE) and the offline
+// replay tool (latency_replay.c).  The input for each cache line is a vector of num_cores
+// latencies (cycles, median of several load-after-flush samples) measured from num_cores
+// different cores.  The features of a line are its latencies minus the mean over the cores (which
+// removes the DRAM latency common to all cores) minus a per-core reference (the median of that
+// difference over the calibration lines, which removes each core's fixed offset), so what remains
+// is how much closer or farther than average the line's CHA is from each core.
+//
+// latency_calibrate() computes the per-core reference and runs k-means (k = num_clusters,
+// k-means++ seeding with a fixed seed, so runs are reproducible) on up to LATENCY_CALIBRATION_LINES
+// lines.  latency_classify() assigns a line to the nearest centroid, with a confidence of
+// (d2 - d1) / (d2 + d1), where d1 and d2 are the distances to the nearest and second-nearest
+// centroids: 0 when the line is halfway between two slices, near 1 when it is unambiguous.
+// Cluster numbers are arbitrary; latency_label_clusters() names each cluster with the CHA number
+// that most of its lines have in existing map files, when there are any.
+//
+// Recorded latency vectors are stored in LATENCY_0x<paddr>.vec files: a latency_vec_header_t
+// followed by 32768 * num_cores uint16_t latencies, line-major.
+
+#ifndef LATENCY_MAX_CORES
+#define LATENCY_MAX_CORES 16
+#endif
+#define LATENCY_MAX_CLUSTERS 64
+#ifndef LATENCY_CALIBRATION_LINES
+#define LATENCY_CALIBRATION_LINES 8192
+#endif
+#ifndef LATENCY_KMEANS_ITERATIONS
+#define LATENCY_KMEANS_ITERATIONS 50
+#endif
+#define LATENCY_VEC_MAGIC 0x3143455654414cUL   // "LATVEC1"
+
+typedef struct {
+    int num_cores;
+    int num_clusters;
+    int cores[LATENCY_MAX_CORES];                   // logical processor numbers of the measuring cores
+    double reference[LATENCY_MAX_CORES];            // per-core offset relative to the mean over cores
+    double centroid[LATENCY_MAX_CLUSTERS][LATENCY_MAX_CORES];
+    int label[LATENCY_MAX_CLUSTERS];                // CHA number of each cluster, -1 if unknown
+    int calibrated;
+} latency_model_t;
+
+typedef struct {
+    uint64_t magic;
+    uint64_t paddr;                                 // 0 if the physical address was not available
+    int32_t num_cores;
+    int32_t cores[LATENCY_MAX_CORES];
+} latency_vec_header_t;
+
+// Features of one line: latency minus the mean over cores minus the per-core reference
+static void latency_features(const latency_model_t *lm, const uint16_t *lat, double *f)
+{
+    double mean = 0.0;
+    int c;
+
+    for (c=0; c<lm->num_cores; c++) mean += lat[c];
+    mean /= lm->num_cores;
+    for (c=0; c<lm->num_cores; c++) f[c] = (double) lat[c] - mean - lm->reference[c];
+}
+
+static double latency_distance2(const double *a, const double *b, int n)
+{
+    double d = 0.0;
+    int c;
+
+    for (c=0; c<n; c++) d += (a[c] - b[c]) * (a[c] - b[c]);
+    return(d);
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return((x > y) - (x < y));
+}
+
+// Returns the nearest cluster to f, and the squared distances to the nearest and second-nearest
+static int latency_nearest(const latency_model_t *lm, const double *f, double *d1, double *d2)
+{
+    int k, best = 0;
+    double d;
+
+    *d1 = *d2 = 1.0e300;
+    for (k=0; k<lm->num_clusters; k++) {
+        d = latency_distance2(f, lm->centroid[k], lm->num_cores);
+        if (d < *d1) {
+            *d2 = *d1;
+            *d1 = d;
+            best = k;
+        } else if (d < *d2) {
+            *d2 = d;
+        }
+    }
+    return(best);
+}
+
+// Compute the per-core reference and the cluster centroids from lat[0..num_lines*num_cores)
+// -- returns 0, or 1 if there are too few lines or no memory
+int latency_calibrate(latency_model_t *lm, const uint16_t *lat, long num_lines)
+{
+    long n, i, stride, *count;
+    double *f, *diff, *dmin, *sum, d, d1, d2, total, r;
+    int c, k, iter, changed, *assign;
+    uint64_t seed = 0x9e3779b97f4a7c15UL;
+    int K = lm->num_cores;
+
+    n = MIN(num_lines, LATENCY_CALIBRATION_LINES);
+    if (n < lm->num_clusters || lm->num_clusters > LATENCY_MAX_CLUSTERS || K > LATENCY_MAX_CORES) return(1);
+    stride = num_lines / n;
+    f = (double *) malloc(n * K * sizeof(double));
+    diff = (double *) malloc(n * sizeof(double));
+    dmin = (double *) malloc(n * sizeof(double));
+    assign = (int *) malloc(n * sizeof(int));
+    sum = (double *) malloc(LATENCY_MAX_CLUSTERS * K * sizeof(double));
+    count = (long *) malloc(LATENCY_MAX_CLUSTERS * sizeof(long));
+    if (f == NULL || diff == NULL || dmin == NULL || assign == NULL || sum == NULL || count == NULL) {
+        free(f); free(diff); free(dmin); free(assign); free(sum); free(count);
+        return(1);
+    }
+
+    // per-core reference: the median over the calibration lines of (latency - mean over cores)
+    for (c=0; c<K; c++) lm->reference[c] = 0.0;
+    for (i=0; i<n; i++) latency_features(lm, &lat[i*stride*K], &f[i*K]);
+    for (c=0; c<K; c++) {
+        for (i=0; i<n; i++) diff[i] = f[i*K + c];
+        qsort(diff, n, sizeof(double), compare_doubles);
+        lm->reference[c] = diff[n/2];
+    }
+    for (i=0; i<n; i++) {
+        for (c=0; c<K; c++) f[i*K + c] -= lm->reference[c];
+    }
+
+    // k-means++ seeding
+    for (c=0; c<K; c++) lm->centroid[0][c] = f[c];
+    for (i=0; i<n; i++) dmin[i] = latency_distance2(&f[i*K], lm->centroid[0], K);
+    for (k=1; k<lm->num_clusters; k++) {
+        total = 0.0;
+        for (i=0; i<n; i++) total += dmin[i];
+        seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+        r = total * (double)(seed >> 11) / 9007199254740992.0;
+        for (i=0; i<n-1 && r > dmin[i]; i++) r -= dmin[i];
+        for (c=0; c<K; c++) lm->centroid[k][c] = f[i*K + c];
+        for (i=0; i<n; i++) {
+            d = latency_distance2(&f[i*K], lm->centroid[k], K);
+            if (d < dmin[i]) dmin[i] = d;
+        }
+    }
+
+    // Lloyd iterations -- an empty cluster is moved to the line farthest from its centroid
+    for (i=0; i<n; i++) assign[i] = -1;
+    for (iter=0; iter<LATENCY_KMEANS_ITERATIONS; iter++) {
+        changed = 0;
+        for (k=0; k<lm->num_clusters; k++) {
+            count[k] = 0;
+            for (c=0; c<K; c++) sum[k*K + c] = 0.0;
+        }
+        for (i=0; i<n; i++) {
+            k = latency_nearest(lm, &f[i*K], &d1, &d2);
+            dmin[i] = d1;
+            if (k != assign[i]) changed++;
+            assign[i] = k;
+            count[k]++;
+            for (c=0; c<K; c++) sum[k*K + c] += f[i*K + c];
+        }
+        for (k=0; k<lm->num_clusters; k++) {
+            if (count[k] == 0) {
+                long far = 0;
+                for (i=1; i<n; i++) if (dmin[i] > dmin[far]) far = i;
+                for (c=0; c<K; c++) lm->centroid[k][c] = f[far*K + c];
+                dmin[far] = 0.0;
+                changed++;
+            } else {
+                for (c=0; c<K; c++) lm->centroid[k][c] = sum[k*K + c] / count[k];
+            }
+        }
+        if (changed == 0) break;
+    }
+    for (k=0; k<lm->num_clusters; k++) lm->label[k] = -1;
+    lm->calibrated = 1;
+    printf("INFO: latency model calibrated from %ld lines, %d cores, %d clusters, %d iterations\n",n,K,lm->num_clusters,iter);
+    free(f); free(diff); free(dmin); free(assign); free(sum); free(count);
+    return(0);
+}
+
+// Returns the cluster of one line (lat[0..num_cores)), and its confidence in [0,1]
+int latency_classify(const latency_model_t *lm, const uint16_t *lat, double *confidence)
+{
+    double f[LATENCY_MAX_CORES], d1, d2;
+    int k;
+
+    latency_features(lm, lat, f);
+    k = latency_nearest(lm, f, &d1, &d2);
+    d1 = sqrt(d1);
+    d2 = sqrt(d2);
+    *confidence = (d1 + d2 > 0.0) ? (d2 - d1) / (d2 + d1) : 0.0;
+    return(k);
+}
+
+// votes[k][cha]: number of lines of cluster k that existing map files assign to cha.
+// Each cluster is labeled with its most common CHA -- returns the number of labeled clusters.
+int latency_label_clusters(latency_model_t *lm, long votes[LATENCY_MAX_CLUSTERS][LATENCY_MAX_CLUSTERS])
+{
+    int k, cha, best, labeled = 0;
+
+    for (k=0; k<lm->num_clusters; k++) {
+        best = 0;
+        for (cha=1; cha<LATENCY_MAX_CLUSTERS; cha++) if (votes[k][cha] > votes[k][best]) best = cha;
+        lm->label[k] = (votes[k][best] > 0) ? best : -1;
+        labeled += (votes[k][best] > 0);
+    }
+    return(labeled);
+}
+
+// Write the latency vectors of one page -- returns 0 on success
+int write_latency_vectors(const char *filename, uint64_t paddr, const latency_model_t *lm, const uint16_t *lat)
+{
+    latency_vec_header_t hdr;
+    FILE *fp;
+    int c, ok;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = LATENCY_VEC_MAGIC;
+    hdr.paddr = paddr;
+    hdr.num_cores = lm->num_cores;
+    for (c=0; c<lm->num_cores; c++) hdr.cores[c] = lm->cores[c];
+    fp = fopen(filename, "w");
+    if (fp == NULL) return(1);
+    ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 && fwrite(lat, 32768 * lm->num_cores * sizeof(uint16_t), 1, fp) == 1;
+    ok = (fclose(fp) == 0) && ok;
+    return(!ok);
+}
+
+// Read the latency vectors of one page into *lat (malloc'd) -- returns 0 on success
+int read_latency_vectors(const char *filename, latency_vec_header_t *hdr, uint16_t **lat)
+{
+    FILE *fp;
+    int ok;
+
+    *lat = NULL;
+    fp = fopen(filename, "r");
+    if (fp == NULL) return(1);
+    ok = fread(hdr, sizeof(*hdr), 1, fp) == 1 && hdr->magic == LATENCY_VEC_MAGIC
+        && hdr->num_cores > 0 && hdr->num_cores <= LATENCY_MAX_CORES;
+    if (ok) {
+        *lat = (uint16_t *) malloc(32768 * hdr->num_cores * sizeof(uint16_t));
+        ok = *lat != NULL && fread(*lat, 32768 * hdr->num_cores * sizeof(uint16_t), 1, fp) == 1;
+    }
+    fclose(fp);
+    if (!ok) {
+        free(*lat);
+        *lat = NULL;
+    }
+    return(!ok);
+}
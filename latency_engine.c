@@ -0,0 +1,249 @@
+// latency_engine.c -- identify the L3 slice of each cache line from load latencies, without MSR access (compiled with -DLATENCY_ENGINE)
+//
+// For each cache line the engine measures the load-after-flush latency (rdtscp; lfence; load; rdtscp; lfence -- one load
+// of a line that has just been flushed, median of LATENCY_SAMPLES) from each of up to
+// LATENCY_MAX_CORES cores, spread evenly over the processors in the affinity mask of the run
+// (restrict it with taskset or numactl to the cores of one socket).  Every load goes through the
+// CHA that owns the line, so the latency differences between cores reflect the mesh distance from
+// each core to that CHA.  The latency vectors are clustered into one cluster per slice
+// (latency_cluster.c), and each line is assigned to the nearest cluster with a confidence.
+//
+// No MSRs, CHA counters, or root privileges are needed for the measurement.  The physical
+// addresses come from /proc/self/pagemap, which only shows frame numbers to processes with
+// CAP_SYS_ADMIN; unprivileged runs name their output files by page index instead.
+//
+// Output for each page:
+//     LATENCY_0x<paddr>.vec   the recorded latency vectors, for offline replay (latency_replay.exe)
+//     PADDR_0x<paddr>.lat     32768 slice numbers (int8_t) followed by 32768 confidences (uint8_t, 0-255)
+// The slice numbers are CHA numbers when the clusters can be labeled from the existing PADDR_*.map
+// files of some of the pages measured (clusters without a label are written as -1), and the
+// agreement with those map files is reported.  Otherwise they are cluster numbers, consistent
+// across the pages of a run.
+
+#ifndef LATENCY_SAMPLES
+#define LATENCY_SAMPLES 15
+#endif
+#ifndef LATENCY_CORES
+#define LATENCY_CORES 8                 // cores measuring each line (at most LATENCY_MAX_CORES)
+#endif
+#ifndef LATENCY_MIN_CONFIDENCE
+#define LATENCY_MIN_CONFIDENCE 0.2      // lines below this confidence are counted as uncertain
+#endif
+
+#include "latency_cluster.c"
+
+static int latency_pin(int cpu)
+{
+    uint64_t mask[16];
+
+    memset(mask, 0, sizeof(mask));
+    mask[cpu/64] = 1UL << (cpu%64);
+    return((int) syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask));
+}
+
+// Pick up to max_cores processors spread evenly over the affinity mask -- returns the number picked
+static int latency_select_cores(int *cores, int max_cores, uint64_t *saved_mask, size_t mask_len)
+{
+    int allowed[1024], num_allowed = 0, cpu, i, n;
+
+    if (syscall(SYS_sched_getaffinity, 0, mask_len, saved_mask) <= 0) return(0);
+    for (cpu=0; cpu<(int)(mask_len*8) && num_allowed<1024; cpu++) {
+        if (saved_mask[cpu/64] & (1UL << (cpu%64))) allowed[num_allowed++] = cpu;
+    }
+    n = MIN(max_cores, num_allowed);
+    for (i=0; i<n; i++) cores[i] = allowed[(long) i * num_allowed / n];
+    return(n);
+}
+
+static int compare_uint32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+    return((x > y) - (x < y));
+}
+
+// Median load-after-flush latency of one line, in TSC cycles
+static uint16_t latency_measure_line(volatile double *line, double *sink)
+{
+    uint32_t samples[LATENCY_SAMPLES];
+    unsigned long t0, t1;
+    double x;
+    int s;
+
+    for (s=0; s<LATENCY_SAMPLES; s++) {
+        _mm_clflush((void *) line);
+        _mm_mfence();
+        t0 = rdtscp();
+        _mm_lfence();                   // the load must not issue before t0 is taken
+        x = *line;
+        t1 = rdtscp();
+        _mm_lfence();
+        *sink += x;
+        samples[s] = (uint32_t) (t1 - t0);
+    }
+    qsort(samples, LATENCY_SAMPLES, sizeof(uint32_t), compare_uint32);
+    return((uint16_t) MIN(samples[LATENCY_SAMPLES/2], 65535));
+}
+
+// Measure all lines of one page from each core: lat[line*num_cores + c]
+static void latency_measure_page(const latency_model_t *lm, double *page, uint16_t *lat, double *sink)
+{
+    long line_number;
+    int c;
+
+    for (c=0; c<lm->num_cores; c++) {
+        if (latency_pin(lm->cores[c]) != 0) {
+            printf("WARNING: failed to bind to cpu %d: %s\n",lm->cores[c],strerror(errno));
+        }
+        for (line_number=0; line_number<32768; line_number++) {
+            lat[line_number*lm->num_cores + c] = latency_measure_line(&page[line_number*8], sink);
+        }
+    }
+}
+
+// Number of clusters (enabled slices) from the command line: the name of a hash configuration in
+// RESULTS_DIR (e.g., SKX_24, whose tables give the number of slices) or the number itself.  Without
+// an argument, the compile-time LATENCY_CLUSTERS is used.  The CHA PMON table is not consulted, so
+// processors without an entry and parts with fewer slices enabled are handled the same way.
+// Returns the number of clusters, or 0 (with a message) if it cannot be determined.
+int latency_num_clusters(int argc, char *argv[])
+{
+    slice_hash_t h;
+    char *end;
+    long n;
+
+    if (argc < 2) {
+#ifdef LATENCY_CLUSTERS
+        return(LATENCY_CLUSTERS);
+#else
+        printf("Usage: %s NUM_SLICES | HASH_CONFIG (e.g., 24 or SKX_24 with the tables in %s)\n",argv[0],RESULTS_DIR);
+        return(0);
+#endif // LATENCY_CLUSTERS
+    }
+    n = strtol(argv[1], &end, 10);
+    if (*end != '\0') {
+        if (slice_hash_load(&h, RESULTS_DIR, argv[1]) != 0) {
+            printf("ERROR: no hash tables for %s in %s\n",argv[1],RESULTS_DIR);
+            return(0);
+        }
+        n = h.num_slices;
+        slice_hash_free(&h);
+    }
+    if (n < 2 || n > LATENCY_MAX_CLUSTERS) {
+        printf("ERROR: the number of slices must be between 2 and %d\n",LATENCY_MAX_CLUSTERS);
+        return(0);
+    }
+    return((int) n);
+}
+
+// Map up to PAGES_MAPPED pages of the buffer by latency -- returns the number of pages measured
+long run_latency_engine(double *array, const uint64_t *paddr_by_page, long num_pages, int num_clusters)
+{
+    static latency_model_t lm;
+    static long votes[LATENCY_MAX_CLUSTERS][LATENCY_MAX_CLUSTERS];
+    uint64_t saved_mask[16];
+    uint16_t *lat;
+    int8_t *cha, **clusters;
+    uint8_t **confidence;
+    long *pages, num_measured = 0, iii, page, line_number, agree = 0, compared = 0, uncertain = 0;
+    long histogram[10] = {0};
+    char filename[100];
+    double conf, sink = 0.0;
+    int k, labeled, primestride = 797;
+
+    memset(&lm, 0, sizeof(lm));
+    lm.num_clusters = MIN(num_clusters, LATENCY_MAX_CLUSTERS);
+    lm.num_cores = latency_select_cores(lm.cores, MIN(LATENCY_CORES, LATENCY_MAX_CORES), saved_mask, sizeof(saved_mask));
+    if (lm.num_cores < 2) {
+        printf("ERROR: the latency engine needs at least 2 processors in the affinity mask\n");
+        exit(9);
+    }
+    printf("INFO: latency engine: %d clusters, %d samples per line from cores",lm.num_clusters,LATENCY_SAMPLES);
+    for (k=0; k<lm.num_cores; k++) printf(" %d",lm.cores[k]);
+    printf("\n");
+    lat = (uint16_t *) malloc(32768 * lm.num_cores * sizeof(uint16_t));
+    cha = (int8_t *) malloc(32768);
+    pages = (long *) malloc(PAGES_MAPPED * sizeof(long));
+    clusters = (int8_t **) calloc(PAGES_MAPPED, sizeof(int8_t *));
+    confidence = (uint8_t **) calloc(PAGES_MAPPED, sizeof(uint8_t *));
+    if (lat == NULL || cha == NULL || pages == NULL || clusters == NULL || confidence == NULL) {
+        printf("ERROR: run_latency_engine() out of memory\n");
+        exit(8);
+    }
+
+    for (iii=0; iii<num_pages && num_measured<PAGES_MAPPED; iii++) {
+        page = (primestride * iii) % num_pages;
+        latency_measure_page(&lm, &array[page*262144], lat, &sink);
+        if (paddr_by_page[page] != 0) {
+            sprintf(filename,"LATENCY_0x%.12lx.vec",paddr_by_page[page]);
+        } else {
+            sprintf(filename,"LATENCY_page%.5ld.vec",page);
+        }
+        if (write_latency_vectors(filename, paddr_by_page[page], &lm, lat) != 0) {
+            printf("WARNING: failed to write %s\n",filename);
+        }
+        if (!lm.calibrated && latency_calibrate(&lm, lat, 32768) != 0) {
+            printf("ERROR: latency model calibration failed\n");
+            exit(9);
+        }
+        clusters[num_measured] = (int8_t *) malloc(32768);
+        confidence[num_measured] = (uint8_t *) malloc(32768);
+        if (clusters[num_measured] == NULL || confidence[num_measured] == NULL) {
+            printf("ERROR: run_latency_engine() out of memory\n");
+            exit(8);
+        }
+        for (line_number=0; line_number<32768; line_number++) {
+            clusters[num_measured][line_number] = (int8_t) latency_classify(&lm, &lat[line_number*lm.num_cores], &conf);
+            confidence[num_measured][line_number] = (uint8_t) (255.0 * conf);
+            histogram[MIN((int)(10.0*conf), 9)]++;
+            if (conf < LATENCY_MIN_CONFIDENCE) uncertain++;
+        }
+        // pages that already have a map file label the clusters
+        if (paddr_by_page[page] != 0 && read_map_file(paddr_by_page[page], cha) == 1) {
+            for (line_number=0; line_number<32768; line_number++) {
+                if (cha[line_number] >= 0 && cha[line_number] < LATENCY_MAX_CLUSTERS) votes[clusters[num_measured][line_number]][cha[line_number]]++;
+            }
+        }
+        printf("LATENCY: page %ld paddr 0x%.12lx measured\n",page,paddr_by_page[page]);
+        pages[num_measured++] = page;
+    }
+    syscall(SYS_sched_setaffinity, 0, sizeof(saved_mask), saved_mask);      // restore the original affinity
+
+    labeled = latency_label_clusters(&lm, votes);
+    if (labeled > 0) {
+        for (k=0; k<lm.num_clusters; k++) {
+            for (line_number=0; line_number<LATENCY_MAX_CLUSTERS; line_number++) {
+                compared += votes[k][line_number];
+                if (line_number == lm.label[k]) agree += votes[k][line_number];
+            }
+        }
+        printf("LATENCY: %d of %d clusters labeled from existing map files, %ld of %ld lines agree (%f%%)\n",
+                labeled,lm.num_clusters,agree,compared,100.0*(double)agree/(double)MAX(compared,1));
+    } else {
+        printf("LATENCY: no existing map files among the pages measured -- slice numbers are cluster numbers\n");
+    }
+    for (iii=0; iii<num_measured; iii++) {
+        page = pages[iii];
+        for (line_number=0; line_number<32768; line_number++) {
+            k = clusters[iii][line_number];
+            cha[line_number] = (labeled > 0) ? lm.label[k] : k;
+        }
+        if (paddr_by_page[page] != 0) {
+            sprintf(filename,"PADDR_0x%.12lx.lat",paddr_by_page[page]);
+        } else {
+            sprintf(filename,"PAGE_%.5ld.lat",page);
+        }
+        if (write_file_atomic(filename, cha, 32768, confidence[iii], 32768) != 0) {
+            printf("ERROR: failed to write %s\n",filename);
+            exit(5);
+        }
+        free(clusters[iii]);
+        free(confidence[iii]);
+    }
+    printf("LATENCY: %ld pages measured, %ld of %ld lines below confidence %f\n",
+            num_measured,uncertain,32768*num_measured,LATENCY_MIN_CONFIDENCE);
+    printf("LATENCY_CONFIDENCE\n");
+    for (k=0; k<10; k++) printf("%.1f-%.1f %ld\n",0.1*k,0.1*(k+1),histogram[k]);
+    printf("DUMMY: latency sink %f\n",sink);
+    free(lat); free(cha); free(pages); free(clusters); free(confidence);
+    return(num_measured);
+}
@@ -0,0 +1,110 @@
+// latency_replay.c -- classify recorded latency vectors offline
+//
+// Usage: latency_replay.exe NUM_SLICES LATENCY_0x<paddr>.vec [...]
+//
+// Replays the LATENCY_*.vec files written by the latency engine of the mapper (-DLATENCY_ENGINE)
+// through the same calibration and classification (latency_cluster.c): the model is calibrated
+// from the first file, and every line of every file is classified.  When the current directory
+// has the PADDR_0x<paddr>.map file of a recorded page (from the CHA counter mapper), the clusters
+// are labeled from those maps and the agreement is reported, so changes to the clustering can be
+// evaluated without access to the machine.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#ifndef MIN
+#define MIN(x,y) ((x)<(y)?(x):(y))
+#endif
+#ifndef MAX
+#define MAX(x,y) ((x)>(y)?(x):(y))
+#endif
+
+#include "latency_cluster.c"
+
+static long votes[LATENCY_MAX_CLUSTERS][LATENCY_MAX_CLUSTERS];
+
+int main(int argc, char **argv)
+{
+    latency_model_t lm;
+    latency_vec_header_t hdr;
+    uint16_t *lat;
+    int8_t *clusters, cha[32768];
+    char filename[100];
+    double conf;
+    long line_number, histogram[10] = {0}, lines = 0, agree = 0, compared = 0;
+    int i, k, c, num_files, labeled;
+    FILE *fp;
+
+    if (argc < 3) {
+        fprintf(stderr,"Usage: %s NUM_SLICES LATENCY_0x<paddr>.vec [...]\n",argv[0]);
+        return(1);
+    }
+    num_files = argc - 2;
+    memset(&lm, 0, sizeof(lm));
+    lm.num_clusters = atoi(argv[1]);
+    clusters = (int8_t *) malloc((size_t) num_files * 32768);
+    if (lm.num_clusters < 2 || lm.num_clusters > LATENCY_MAX_CLUSTERS || clusters == NULL) {
+        fprintf(stderr,"ERROR: NUM_SLICES must be between 2 and %d\n",LATENCY_MAX_CLUSTERS);
+        return(1);
+    }
+
+    for (i=0; i<num_files; i++) {
+        if (read_latency_vectors(argv[i+2], &hdr, &lat) != 0) {
+            fprintf(stderr,"ERROR: cannot read latency vectors from %s\n",argv[i+2]);
+            return(2);
+        }
+        if (i == 0) {
+            lm.num_cores = hdr.num_cores;
+            for (c=0; c<lm.num_cores; c++) lm.cores[c] = hdr.cores[c];
+            if (latency_calibrate(&lm, lat, 32768) != 0) {
+                fprintf(stderr,"ERROR: calibration from %s failed\n",argv[2]);
+                return(3);
+            }
+        } else if (hdr.num_cores != lm.num_cores) {
+            fprintf(stderr,"ERROR: %s was recorded from %d cores, expected %d\n",argv[i+2],hdr.num_cores,lm.num_cores);
+            return(2);
+        }
+        for (line_number=0; line_number<32768; line_number++) {
+            k = latency_classify(&lm, &lat[line_number*lm.num_cores], &conf);
+            clusters[(long) i*32768 + line_number] = (int8_t) k;
+            histogram[MIN((int)(10.0*conf), 9)]++;
+            lines++;
+        }
+        free(lat);
+
+        snprintf(filename, sizeof(filename), "PADDR_0x%.12lx.map", (unsigned long) hdr.paddr);
+        fp = (hdr.paddr != 0) ? fopen(filename, "r") : NULL;
+        if (fp != NULL) {
+            if (fread(cha, 32768, 1, fp) == 1) {
+                for (line_number=0; line_number<32768; line_number++) {
+                    if (cha[line_number] >= 0 && cha[line_number] < LATENCY_MAX_CLUSTERS) {
+                        votes[clusters[(long) i*32768 + line_number]][cha[line_number]]++;
+                    }
+                }
+            }
+            fclose(fp);
+        }
+    }
+
+    labeled = latency_label_clusters(&lm, votes);
+    if (labeled > 0) {
+        for (k=0; k<lm.num_clusters; k++) {
+            for (c=0; c<LATENCY_MAX_CLUSTERS; c++) {
+                compared += votes[k][c];
+                if (c == lm.label[k]) agree += votes[k][c];
+            }
+        }
+        printf("REPLAY: %d of %d clusters labeled from map files, %ld of %ld lines agree (%f%%)\n",
+                labeled,lm.num_clusters,agree,compared,100.0*(double)agree/(double)MAX(compared,1));
+    } else {
+        printf("REPLAY: no map files for the recorded pages -- agreement not computed\n");
+    }
+    printf("REPLAY: %d files, %ld lines classified\n",num_files,lines);
+    printf("LATENCY_CONFIDENCE\n");
+    for (k=0; k<10; k++) printf("%.1f-%.1f %ld\n",0.1*k,0.1*(k+1),histogram[k]);
+    free(clusters);
+    return(0);
+}
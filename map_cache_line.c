@@ -0,0 +1,555 @@
+// map_cache_line_full() performs the full measurement of the L3 slice (CHA) that owns one cache line:
+// read the CHA counters, load+flush the line NFLUSHES times, read the CHA counters again, and
+// repeat until the counter deltas pass the "goodness" tests.
+// Returns the CHA number.  Aborts (exit code 101) if no good result is obtained after 10 back-offs.
+// The tests are in goodness.c, and each try is recorded in the binary trace when L3_TRACE is set
+// (mapper_trace.c).
+//
+// The line_mapper_t holds everything that the measurement needs that does not change from
+// line to line, plus the running totals that are reported at the end of the run.
+//
+// map_cache_line() is the interface used by the mapper.  Compiled with -DPREDICT_VERIFY, it first
+// tries to confirm the slice predicted by the hash tables in Results/ (see slice_hash.h): it reads
+// only the predicted CHA counter plus NUM_GUARD_CHAS other CHA counters, around VERIFY_FLUSHES
+// (instead of NFLUSHES) load/flush iterations.  The line is accepted if the predicted CHA sees at least 95% of the loads and each
+// guard CHA sees less than 20% of them (the same thresholds as goodness1/goodness2 below).
+// Otherwise the full measurement is performed, and a disagreement with the hash is reported.
+// The guard CHAs rotate from line to line, so every CHA is checked for stray counts regularly.
+
+// Compiled with -DADAPTIVE_FLUSHES, the measurement reads the CHA counters after every chunk of
+// SPRT_CHUNK_FLUSHES load/flush iterations and stops as soon as a sequential probability ratio
+// test (SPRT) says that one CHA owns the line, so that clean lines need only a few chunks and the
+// full NFLUSHES are used only for noisy lines.  The model: in each load/flush iteration the owning
+// CHA counts an event with probability SPRT_P_HIT and any other CHA with probability SPRT_P_NOISE.
+// For a leading CHA c with n_c events and the runner-up d with n_d events (both clipped to the
+// number of iterations), the log-likelihood ratio of "c owns the line" against "d owns the line" is
+//      LLR = (n_c - n_d) * [ log(P_HIT/P_NOISE) + log((1-P_NOISE)/(1-P_HIT)) ]
+// and the line is assigned to c once LLR >= log(1/SPRT_ALPHA), at least SPRT_MIN_FLUSHES iterations
+// have been made, and the goodness1/goodness2 tests hold for the counts so far.  Each event of
+// lead is worth about 5.9 with the default probabilities, so the LLR alone would decide after a
+// lead of 4 events; uncore noise comes in bursts rather than independent events, so the minimum
+// number of iterations is what protects against a burst in the first chunks, and the LLR is not
+// an error bound.  Lines still undecided after NFLUSHES iterations are handed to the full
+// measurement (with its repeats and back-offs).
+// The error rate is measured instead: every SPRT_AUDIT_INTERVAL-th line decided by the
+// sequential test is measured again with the full test, and the disagreements are counted (the
+// full result is kept for those lines).  The load/flush iterations used for each line (sequential
+// test, audit and full measurement) are written to FLUSHES_0x<paddr>.bin (uint16_t per line).
+
+#ifndef FULL_NFLUSHES
+#define FULL_NFLUSHES 1000              // NFLUSHES -- load/flush iterations per try of the full measurement
+#endif
+
+#ifdef ADAPTIVE_FLUSHES
+#ifndef SPRT_CHUNK_FLUSHES
+#define SPRT_CHUNK_FLUSHES 25
+#endif
+#ifndef SPRT_MIN_FLUSHES
+#define SPRT_MIN_FLUSHES 100            // no decision before this many iterations
+#endif
+#ifndef SPRT_ALPHA
+#define SPRT_ALPHA 1.0e-9
+#endif
+#ifndef SPRT_P_HIT
+#define SPRT_P_HIT 0.95
+#endif
+#ifndef SPRT_P_NOISE
+#define SPRT_P_NOISE 0.05
+#endif
+#ifndef SPRT_AUDIT_INTERVAL
+#define SPRT_AUDIT_INTERVAL 64                  // 0: no audit of the sequential decisions
+#endif
+#define SPRT_HISTOGRAM_BINS 64                  // bin k counts the lines decided after k+1 chunks
+#endif // ADAPTIVE_FLUSHES
+
+// With -DSIM_UNCORE each load/flush loop reports the line and its iteration count to the simulated
+// CHA counters (sim_uncore.c).
+#ifdef SIM_UNCORE
+#define SIM_UNCORE_PROBE(line, iterations) sim_uncore_probe(&sim_uncore, (line), (iterations))
+#else
+#define SIM_UNCORE_PROBE(line, iterations)
+#endif // SIM_UNCORE
+
+#if defined(PREDICT_VERIFY) || defined(INFER_PERMUTATION) || defined(SELECT_PAGES) || defined(LATENCY_ENGINE)
+#include "slice_hash.h"
+#ifndef RESULTS_DIR
+#define RESULTS_DIR "Results"
+#endif
+#endif // PREDICT_VERIFY || INFER_PERMUTATION || SELECT_PAGES || LATENCY_ENGINE
+
+#ifdef PREDICT_VERIFY
+#ifndef VERIFY_FLUSHES
+#define VERIFY_FLUSHES 100
+#endif
+#ifndef NUM_GUARD_CHAS
+#define NUM_GUARD_CHAS 3
+#endif
+#endif // PREDICT_VERIFY
+
+typedef struct {
+    const cha_pmon_t *pmon;             // CHA MSR addresses resolved for this processor (cha_pmon.c)
+    int socket;                         // socket whose CHA counters are read (socket_under_test)
+    int *msr_fd;                        // one /dev/cpu/N/msr file descriptor per socket
+    msr_batch_t *cha_batch;             // counter 0 of every CHA in the socket (msr_batch.c) -- NULL: read_CHA_counter()
+    int num_chas;                       // CHA_per_socket
+    int nflushes;                       // NFLUSHES -- load/flush iterations per try
+    long totaltries;                    // tries accumulated over all lines mapped
+    int globalsum;                      // sum of loaded values -- keeps the loads from being optimized away
+    trace_ring_t *trace;                // ring buffer of this socket in the binary trace (mapper_trace.c) -- NULL: not tracing
+#ifdef ADAPTIVE_FLUSHES
+    long lines_adaptive;                // lines decided by the sequential test
+    long lines_escalated;               // lines handed to the full measurement
+    long adaptive_flushes;              // load/flush iterations used by the sequential test (all lines)
+    long flush_histogram[SPRT_HISTOGRAM_BINS];
+    int sprt_runner_up;                 // runner-up CHA of the last line decided by the sequential test
+    long audit_lines;                   // decided lines measured again with the full test
+    long audit_disagree;                // of which the full test found another CHA
+    uint16_t *line_flushes;             // load/flush iterations of each line of the page being mapped
+#endif
+#ifdef MUX_LINES
+    long mux_windows;                   // counter windows used by map_cache_line_group()
+    long mux_lines_decoded;             // lines decoded from a multiplexed window
+    long mux_lines_retried;             // ambiguous lines mapped individually
+#endif
+#ifdef INFER_PERMUTATION
+    slice_hash_t *base;                 // base sequence for infer_page() -- NULL if no table
+    long pages_inferred;                // pages synthesized from the inferred permutations
+    long pages_not_inferred;            // inference or spot check failed -- all lines measured
+    long infer_lines_measured;          // lines measured by infer_page(), including spot checks
+#endif
+#ifdef PREDICT_VERIFY
+    slice_hash_t *hash;                 // NULL if no table is available for this processor
+    long lines_verified;                // prediction confirmed with VERIFY_FLUSHES loads
+    long lines_fallback;                // prediction not confirmed -- full measurement performed
+    long lines_unpredicted;             // address outside of the validated range of the table
+    long lines_disagree;                // full measurement disagrees with the prediction
+#endif
+} line_mapper_t;
+
+// Read counter 0 of all CHAs of the socket into cha_counts[socket][tile][0][when] (0=before, 1=after)
+void line_mapper_snapshot(line_mapper_t *m, int when)
+{
+    int tile;
+
+    BENCH_PHASE(BENCH_COUNTERS);
+    if (m->cha_batch != NULL) {
+        msr_batch_read(m->cha_batch);
+        BENCH_MSR_READ(m->cha_batch->backend, m->num_chas);
+        for (tile=0; tile<m->num_chas; tile++) {
+            cha_counts[m->socket][tile][0][when] = m->cha_batch->values[tile];
+        }
+    } else {
+        for (tile=0; tile<m->num_chas; tile++) {
+            cha_counts[m->socket][tile][0][when] = read_CHA_counter(m->pmon, m->socket, tile, 0, m->msr_fd);
+        }
+        BENCH_MSR_READ(MSR_BATCH_PREAD, m->num_chas);
+    }
+    BENCH_PHASE(BENCH_CLASSIFY);
+}
+
+#if defined(PREDICT_VERIFY) || defined(INFER_PERMUTATION) || defined(SELECT_PAGES)
+#include <dirent.h>
+
+// Number of CHAs enabled in each socket, from the uncore_cha_<n> PMUs that the kernel creates for
+// the enabled CHAs only (it reads CAPID6 on SKX/CLX and ICX, the discovery tables on SPR).
+// Returns 0 if there are none (no uncore PMU driver, e.g., in a virtual machine).
+int count_enabled_chas(void)
+{
+    DIR *dp;
+    struct dirent *de;
+    int id, name_len, count = 0;
+
+    dp = opendir("/sys/bus/event_source/devices");
+    if (dp == NULL) return(0);
+    while ((de = readdir(dp)) != NULL) {
+        name_len = 0;
+        if (sscanf(de->d_name, "uncore_cha_%d%n", &id, &name_len) == 1 && de->d_name[name_len] == '\0') count++;
+    }
+    closedir(dp);
+    return(count);
+}
+
+// Load the hash tables for this processor, e.g., Results/*_SKX_24-slice.tbl for a Skylake Xeon
+// with 24 CHAs enabled (of the 28 whose counters are read).  The configuration name can be given
+// with -DSLICE_HASH_CONFIG=\"SKX_24\", and is that of the simulated hash with -DSIM_UNCORE.
+// Aborts if the number of enabled CHAs cannot be determined or there are no tables for it, rather
+// than using tables for another number of slices.
+// Returns 0 if the tables are loaded, 1 if they do not fit the CHAs read (every line then gets the
+// full measurement).
+int line_mapper_open_tables(line_mapper_t *m, slice_hash_t *h)
+{
+    char config[32];
+
+#if defined(SLICE_HASH_CONFIG)
+    snprintf(config,sizeof(config),"%s",SLICE_HASH_CONFIG);
+#elif defined(SIM_UNCORE)
+    snprintf(config,sizeof(config),"%s",SIM_UNCORE_CONFIG);
+#else
+    int num_enabled = count_enabled_chas();
+
+    if (num_enabled == 0) {
+        printf("ERROR: cannot count the enabled CHAs (no uncore_cha PMUs in /sys/bus/event_source/devices) -- rebuild with -DSLICE_HASH_CONFIG=\\\"%s_<CHAs>\\\"\n",
+                m->pmon->desc->hash_prefix);
+        exit(1);
+    }
+    snprintf(config,sizeof(config),"%s_%d",m->pmon->desc->hash_prefix,num_enabled);
+#endif // SLICE_HASH_CONFIG
+    if (slice_hash_load(h, RESULTS_DIR, config) != 0) {
+        printf("ERROR: no hash tables for %s in %s\n",config,RESULTS_DIR);
+        exit(1);
+    }
+    if (h->num_slices > m->num_chas) {
+        printf("WARNING: hash tables for %s use %d slices but only %d CHAs are read -- using full measurements\n",config,h->num_slices,m->num_chas);
+        slice_hash_free(h);
+        return(1);
+    }
+    return(0);
+}
+#endif // PREDICT_VERIFY || INFER_PERMUTATION || SELECT_PAGES
+
+#ifdef PREDICT_VERIFY
+int line_mapper_load_hash(line_mapper_t *m, slice_hash_t *h)
+{
+    m->hash = NULL;
+    m->lines_verified = 0;
+    m->lines_fallback = 0;
+    m->lines_unpredicted = 0;
+    m->lines_disagree = 0;
+    if (line_mapper_open_tables(m, h) != 0) return(1);
+    printf("INFO: predict-and-verify using %s/%s tables, %d verify flushes, %d guard CHAs\n",RESULTS_DIR,h->config,VERIFY_FLUSHES,NUM_GUARD_CHAS);
+    m->hash = h;
+    return(0);
+}
+
+// Single short test of the predicted CHA -- returns 1 if the prediction is confirmed
+int verify_cache_line(line_mapper_t *m, double *line, long line_number, int predicted)
+{
+    int i, k, num_chas_read, ok;
+    int chas[1+NUM_GUARD_CHAS];
+    uint32_t msrs[1+NUM_GUARD_CHAS];
+    uint64_t before[1+NUM_GUARD_CHAS], after[1+NUM_GUARD_CHAS];
+    long delta;
+    double sum;
+
+    // predicted CHA first, then guards chosen so that successive lines cover all of the other CHAs
+    chas[0] = predicted;
+    num_chas_read = 1;
+    for (k=0; k<NUM_GUARD_CHAS && k<m->num_chas-1; k++) {
+        chas[num_chas_read++] = (predicted + 1 + (int)((line_number*NUM_GUARD_CHAS + k) % (m->num_chas-1))) % m->num_chas;
+    }
+    m->totaltries++;
+
+    BENCH_PHASE(BENCH_COUNTERS);
+    if (m->cha_batch != NULL) {
+        for (k=0; k<num_chas_read; k++) msrs[k] = m->cha_batch->msrs[chas[k]];
+        msr_batch_read_list(m->cha_batch, msrs, before, num_chas_read);
+        BENCH_MSR_READ(m->cha_batch->backend, num_chas_read);
+    } else {
+        for (k=0; k<num_chas_read; k++) {
+            before[k] = read_CHA_counter(m->pmon, m->socket, chas[k], 0, m->msr_fd);
+        }
+        BENCH_MSR_READ(MSR_BATCH_PREAD, num_chas_read);
+    }
+    BENCH_PHASE(BENCH_FLUSH);
+    sum = 0;
+    for (i=0; i<VERIFY_FLUSHES; i++) {
+        sum += *line;
+        _mm_mfence();
+        _mm_lfence();
+        _mm_clflush(line);
+        _mm_mfence();
+        _mm_lfence();
+    }
+    SIM_UNCORE_PROBE(line, VERIFY_FLUSHES);
+    m->globalsum += sum;
+    BENCH_PHASE(BENCH_COUNTERS);
+    if (m->cha_batch != NULL) {
+        msr_batch_read_list(m->cha_batch, msrs, after, num_chas_read);
+        BENCH_MSR_READ(m->cha_batch->backend, num_chas_read);
+    } else {
+        for (k=0; k<num_chas_read; k++) {
+            after[k] = read_CHA_counter(m->pmon, m->socket, chas[k], 0, m->msr_fd);
+        }
+        BENCH_MSR_READ(MSR_BATCH_PREAD, num_chas_read);
+    }
+    BENCH_PHASE(BENCH_CLASSIFY);
+
+    ok = 1;
+    for (k=0; k<num_chas_read; k++) {
+        delta = corrected_pmc_delta(after[k],before[k],48);
+        if (k == 0 && delta < (VERIFY_FLUSHES*19)/20) ok = 0;
+        if (k > 0 && delta >= VERIFY_FLUSHES/5) ok = 0;
+#ifdef VERBOSE
+        printf("VERIFY: line %ld %s CHA %d delta %ld\n",line_number,(k==0)?"predicted":"guard",chas[k],delta);
+#endif // VERBOSE
+    }
+    return(ok);
+}
+
+void line_mapper_report(line_mapper_t *m)
+{
+    if (m->hash == NULL) return;
+    printf("PREDICT_VERIFY: %ld lines verified, %ld fallbacks to full measurement, %ld not predicted, %ld disagree with %s hash\n",
+            m->lines_verified, m->lines_fallback, m->lines_unpredicted, m->lines_disagree, m->hash->config);
+}
+#endif // PREDICT_VERIFY
+
+int map_cache_line_full(line_mapper_t *m, double *line, uint64_t paddr, long line_number)
+{
+    int i, tile;
+    long delta[NUM_CHA_BOXES];
+    double sum;
+    int good, numtries;
+    int backoffs;
+    goodness_t g;
+    int socket_under_test = m->socket;
+    int CHA_per_socket = m->num_chas;
+    int NFLUSHES = m->nflushes;
+
+    good = 0;
+    numtries = 0;
+    backoffs = 0;
+    do  {               // -------------- Inner Repeat Loop until results pass "goodness" tests --------------
+        numtries++;
+        if (numtries > 100) {
+            backoffs += 1;
+            BENCH_PHASE(BENCH_BACKOFF);
+            sleep(1);
+            BENCH_PHASE(BENCH_CLASSIFY);
+            if ( backoffs > 10 ) {
+                printf("ERROR: No good results for line %ld after %d tries and %d backoffs\n",line_number,numtries,backoffs);
+                exit(101);
+            }
+        }
+        m->totaltries++;
+
+        // 1. read L3 counters before starting test
+        line_mapper_snapshot(m, 0);
+
+        // 2. Access the line NFLUSHES times
+        BENCH_PHASE(BENCH_FLUSH);
+        sum = 0;
+        for (i=0; i<NFLUSHES; i++) {
+            sum += *line;
+            _mm_mfence();
+            _mm_lfence();
+            _mm_clflush(line);
+            _mm_mfence();
+            _mm_lfence();
+        }
+        SIM_UNCORE_PROBE(line, NFLUSHES);
+        m->globalsum += sum;
+
+        // 3. read L3 counters after loads are done
+        line_mapper_snapshot(m, 1);
+
+#ifdef VERBOSE
+        for (tile=0; tile<CHA_per_socket; tile++) {
+            printf("DEBUG: line %ld cha_counter0_after %lu cha_counter0 before %lu delta %lu\n",
+                    line_number,cha_counts[socket_under_test][tile][0][1],cha_counts[socket_under_test][tile][0][0],cha_counts[socket_under_test][tile][0][1]-cha_counts[socket_under_test][tile][0][0]);
+        }
+#endif // VERBOSE
+
+        //   CHA counter 0 set to LLC_LOOKUP.READ (SKX) or REQUESTS.READS (ICX, SPR)
+        //
+        //  4. Determine which L3 slice owns the cache line
+        //     the "goodness" tests (goodness.c) on the counter deltas, and
+        //     the test that exactly one CHA reports >= 0.95*NFLUSHES events
+        for (tile=0; tile<CHA_per_socket; tile++) {
+            delta[tile] = corrected_pmc_delta(cha_counts[socket_under_test][tile][0][1],cha_counts[socket_under_test][tile][0][0],48);
+        }
+        good = goodness_classify(&goodness_default_limits, delta, CHA_per_socket, NFLUSHES, &g);
+        if (m->trace != NULL) mapper_trace_try(m->trace, socket_under_test, paddr, line_number, numtries, delta, CHA_per_socket, &g);
+#ifdef VERBOSE
+        printf("GOODNESS: line_number %ld max_count %d min_count %d sum_count %d avg_count %f goodness1 %f goodness2 %f goodness3 %f pass123 %d %d %d\n",
+                          line_number, g.max_count, g.min_count, g.sum_count, g.avg_count, g.goodness1, g.goodness2, g.goodness3,
+                          (g.pass & GOODNESS_PASS1) != 0, (g.pass & GOODNESS_PASS2) != 0, (g.pass & GOODNESS_PASS3) != 0);
+        if ((g.pass & (GOODNESS_PASS1|GOODNESS_PASS2|GOODNESS_PASS3)) != (GOODNESS_PASS1|GOODNESS_PASS2|GOODNESS_PASS3)) {
+            printf("DEBUG: one or more of the sanity checks failed for line=%ld: %d %d %d goodness values %f %f %f\n",
+                    line_number,(g.pass & GOODNESS_PASS1) != 0,(g.pass & GOODNESS_PASS2) != 0,(g.pass & GOODNESS_PASS3) != 0,g.goodness1,g.goodness2,g.goodness3);
+        }
+        if (g.found > 1) {
+            printf("WARNING: Multiple (%d) CHAs found using counter 0 for cache line %ld: last_cha %d\n",g.found,line_number,g.cha);
+            printf("DEBUG dump for multiple CHAs found\n");
+        } else if (g.found == 0) {
+            printf("WARNING: no CHA entry has been found for line %ld!\n",line_number);
+            printf("DEBUG dump for no CHA found\n");
+        }
+        if (g.found != 1) {
+            for (tile=0; tile<CHA_per_socket; tile++) {
+                printf("CHA %d LLC_LOOKUP.READ          delta %ld\n",tile,delta[tile]);
+            }
+        }
+#endif // VERBOSE
+    }
+    while (good == 0);           // trigger a repeat if any of the tests failed
+    return(g.cha);
+}
+
+#ifdef ADAPTIVE_FLUSHES
+void line_mapper_init_adaptive(line_mapper_t *m)
+{
+    int i;
+
+    m->lines_adaptive = 0;
+    m->lines_escalated = 0;
+    m->adaptive_flushes = 0;
+    for (i=0; i<SPRT_HISTOGRAM_BINS; i++) m->flush_histogram[i] = 0;
+    m->audit_lines = 0;
+    m->audit_disagree = 0;
+    m->line_flushes = (uint16_t *) calloc(32768, sizeof(uint16_t));
+    printf("INFO: adaptive flushes: chunks of %d, at least %d, at most %d, alpha %g, p_hit %g, p_noise %g, audit 1 line in %d\n",
+            SPRT_CHUNK_FLUSHES,SPRT_MIN_FLUSHES,m->nflushes,SPRT_ALPHA,SPRT_P_HIT,SPRT_P_NOISE,SPRT_AUDIT_INTERVAL);
+}
+
+// Sequential test -- returns the CHA number, or -1 if no decision was reached within NFLUSHES iterations
+int map_cache_line_sprt(line_mapper_t *m, double *line, long line_number)
+{
+    int i, tile, chunk, leader, runner_up;
+    int socket_under_test = m->socket;
+    int CHA_per_socket = m->num_chas;
+    long n, delta, n_leader, n_runner_up;
+    double sum, weight, threshold, llr;
+
+    weight = log(SPRT_P_HIT/SPRT_P_NOISE) + log((1.0-SPRT_P_NOISE)/(1.0-SPRT_P_HIT));
+    threshold = log(1.0/SPRT_ALPHA);
+    m->totaltries++;
+
+    line_mapper_snapshot(m, 0);
+    n = 0;
+    sum = 0;
+    for (chunk=0; n<m->nflushes; chunk++) {
+        BENCH_PHASE(BENCH_FLUSH);
+        for (i=0; i<SPRT_CHUNK_FLUSHES && n<m->nflushes; i++, n++) {
+            sum += *line;
+            _mm_mfence();
+            _mm_lfence();
+            _mm_clflush(line);
+            _mm_mfence();
+            _mm_lfence();
+        }
+        SIM_UNCORE_PROBE(line, i);
+        line_mapper_snapshot(m, 1);
+
+        // leader and runner-up of the counts accumulated since the start of the test, clipped to n
+        leader = -1;
+        runner_up = -1;
+        n_leader = -1;
+        n_runner_up = -1;
+        for (tile=0; tile<CHA_per_socket; tile++) {
+            delta = corrected_pmc_delta(cha_counts[socket_under_test][tile][0][1],cha_counts[socket_under_test][tile][0][0],48);
+            delta = MIN(delta, n);
+            if (delta > n_leader) {
+                runner_up = leader;
+                n_runner_up = n_leader;
+                leader = tile;
+                n_leader = delta;
+            } else if (delta > n_runner_up) {
+                runner_up = tile;
+                n_runner_up = delta;
+            }
+        }
+        llr = weight * (double)(n_leader - n_runner_up);
+#ifdef VERBOSE
+        printf("SPRT: line %ld flushes %ld leader %d count %ld runner_up %d count %ld llr %f\n",
+                line_number,n,leader,n_leader,runner_up,n_runner_up,llr);
+#endif // VERBOSE
+        if (n >= SPRT_MIN_FLUSHES && llr >= threshold && n_leader >= (n*19)/20 && n_runner_up < n/5) {
+            m->globalsum += sum;
+            m->lines_adaptive++;
+            m->adaptive_flushes += n;
+            m->flush_histogram[MIN(chunk, SPRT_HISTOGRAM_BINS-1)]++;
+            m->sprt_runner_up = runner_up;
+#ifdef VERBOSE
+            printf("FLUSHES: line %ld cha %d flushes %ld llr %f\n",line_number,leader,n,llr);
+#endif // VERBOSE
+            return(leader);
+        }
+    }
+    m->globalsum += sum;
+    m->lines_escalated++;
+    m->adaptive_flushes += n;
+#ifdef VERBOSE
+    printf("FLUSHES: line %ld undecided after %ld flushes -- escalating to the full measurement\n",line_number,n);
+#endif // VERBOSE
+    return(-1);
+}
+
+void line_mapper_report_adaptive(line_mapper_t *m)
+{
+    int i;
+    long lines = m->lines_adaptive + m->lines_escalated;
+
+    if (lines == 0) return;
+    printf("ADAPTIVE: %ld lines decided by the sequential test, %ld escalated, %f flushes per line\n",
+            m->lines_adaptive, m->lines_escalated, (double)m->adaptive_flushes/(double)lines);
+    printf("FLUSH_HISTOGRAM (flushes lines)\n");
+    for (i=0; i<SPRT_HISTOGRAM_BINS; i++) {
+        if (m->flush_histogram[i] != 0) printf("%d%s %ld\n",(i+1)*SPRT_CHUNK_FLUSHES,(i==SPRT_HISTOGRAM_BINS-1)?"+":"",m->flush_histogram[i]);
+    }
+    if (m->lines_escalated != 0) printf("escalated %ld\n",m->lines_escalated);
+    if (m->audit_lines > 0) {
+        printf("ADAPTIVE: audit: %ld of %ld decided lines measured again disagree with the full measurement, achieved error rate %g",
+                m->audit_disagree, m->audit_lines, (double)m->audit_disagree/(double)m->audit_lines);
+        if (m->audit_disagree == 0) printf(" (below %g with 95%% confidence)",3.0/(double)m->audit_lines);
+        printf("\n");
+    }
+}
+#endif // ADAPTIVE_FLUSHES
+
+// Measure the CHA that owns the line with the sequential test if enabled, else the full measurement
+int map_cache_line_measure(line_mapper_t *m, double *line, uint64_t paddr, long line_number)
+{
+#ifdef ADAPTIVE_FLUSHES
+    long flushes_before = m->adaptive_flushes, tries_before;
+    int this_cha = map_cache_line_sprt(m, line, line_number), full_cha;
+
+    tries_before = m->totaltries;
+    if (this_cha < 0 || (SPRT_AUDIT_INTERVAL > 0 && m->lines_adaptive % MAX(SPRT_AUDIT_INTERVAL, 1) == 0)) {
+        full_cha = map_cache_line_full(m, line, paddr, line_number);
+        if (this_cha >= 0) {            // audit of a sequential decision
+            m->audit_lines++;
+            if (full_cha != this_cha) {
+                m->audit_disagree++;
+                printf("ADAPTIVE: audit paddr 0x%.12lx: sequential test CHA %d (runner-up %d), full measurement CHA %d\n",
+                        paddr,this_cha,m->sprt_runner_up,full_cha);
+            }
+        }
+        this_cha = full_cha;
+    }
+    if (m->line_flushes != NULL) {
+        m->line_flushes[line_number & 32767] = (uint16_t) MIN((m->adaptive_flushes - flushes_before) + (m->totaltries - tries_before)*m->nflushes, 65535);
+    }
+    return(this_cha);
+#else
+    return(map_cache_line_full(m, line, paddr, line_number));
+#endif // ADAPTIVE_FLUSHES
+}
+
+int map_cache_line(line_mapper_t *m, double *line, uint64_t paddr, long line_number)
+{
+#ifdef PREDICT_VERIFY
+    int predicted, this_cha;
+
+    if (m->hash != NULL) {
+        if (!slice_hash_address_validated(m->hash, paddr)) {
+            m->lines_unpredicted++;
+        } else {
+            predicted = slice_hash_slice_of(m->hash, paddr);
+            if (verify_cache_line(m, line, line_number, predicted)) {
+                m->lines_verified++;
+                return(predicted);
+            }
+            m->lines_fallback++;
+            this_cha = map_cache_line_measure(m, line, paddr, line_number);
+            if (this_cha != predicted) {
+                m->lines_disagree++;
+                printf("WARNING: line %ld paddr 0x%.12lx measured on CHA %d but hash %s predicts CHA %d\n",
+                        line_number, paddr, this_cha, m->hash->config, predicted);
+            }
+            return(this_cha);
+        }
+    }
+#endif // PREDICT_VERIFY
+    return(map_cache_line_measure(m, line, paddr, line_number));
+}
@@ -0,0 +1,119 @@
+// map_cache_line_group() maps up to MUX_LINES cache lines with a single counter window (compiled with -DMUX_LINES=k).
+//
+// Line j of the group is loaded and flushed r_j = MUX_BASE_FLUSHES * 2^j times between one pair of
+// CHA counter snapshots, so the count at each CHA is (close to) MUX_BASE_FLUSHES times a k-bit
+// number whose set bits are the lines of the group owned by that CHA.  The decode works from the
+// largest repetition count down: line j is assigned to a CHA if the remaining count is at least
+// r_j - MUX_BASE_FLUSHES/2 (the lines below j add at most r_j - MUX_BASE_FLUSHES), and r_j is then
+// subtracted.  A CHA decodes cleanly if the remainder is within MUX_TOLERANCE*MUX_BASE_FLUSHES
+// of zero.  A line is accepted only if exactly one CHA claims it
+// and that CHA decodes cleanly; the other lines of the group (contention, lost counts, or stray
+// traffic) are mapped individually with map_cache_line().
+//
+// Compared with one window per line, a group of k lines needs one pair of snapshots instead of k
+// pairs, and MUX_BASE_FLUSHES*(2^k-1) load/flush iterations instead of k*NFLUSHES.
+
+#ifndef MUX_BASE_FLUSHES
+#define MUX_BASE_FLUSHES 100
+#endif
+#ifndef MUX_TOLERANCE
+#define MUX_TOLERANCE 0.25
+#endif
+#if MUX_LINES < 1 || MUX_LINES > 8
+#error "MUX_LINES must be between 1 and 8"
+#endif
+
+void line_mapper_init_group(line_mapper_t *m)
+{
+    m->mux_windows = 0;
+    m->mux_lines_decoded = 0;
+    m->mux_lines_retried = 0;
+    printf("INFO: multiplexed mapping: %d lines per window, %d to %d load/flush iterations per line\n",
+            MUX_LINES,MUX_BASE_FLUSHES,MUX_BASE_FLUSHES<<(MUX_LINES-1));
+}
+
+// lines[j] points to line j of the group and paddr[j] is its physical address, for j < num_lines.
+// The CHA numbers are stored in cha[0..num_lines-1].
+void map_cache_line_group(line_mapper_t *m, double **lines, const uint64_t *paddr, long first_line_number, int num_lines, int8_t *cha)
+{
+    int i, j, tile;
+    int claims[MUX_LINES];
+    int owner[MUX_LINES];
+    int clean, claimed_bits;
+    long delta, remaining, reps;
+    double sum;
+    int socket_under_test = m->socket;
+
+    m->mux_windows++;
+    m->totaltries++;
+    line_mapper_snapshot(m, 0);
+    BENCH_PHASE(BENCH_FLUSH);
+    sum = 0;
+    for (j=0; j<num_lines; j++) {
+        reps = (long) MUX_BASE_FLUSHES << j;
+        for (i=0; i<reps; i++) {
+            sum += *lines[j];
+            _mm_mfence();
+            _mm_lfence();
+            _mm_clflush(lines[j]);
+            _mm_mfence();
+            _mm_lfence();
+        }
+        SIM_UNCORE_PROBE(lines[j], reps);
+    }
+    m->globalsum += sum;
+    line_mapper_snapshot(m, 1);
+
+    for (j=0; j<num_lines; j++) {
+        claims[j] = 0;
+        owner[j] = -1;
+    }
+    for (tile=0; tile<m->num_chas; tile++) {
+        delta = corrected_pmc_delta(cha_counts[socket_under_test][tile][0][1],cha_counts[socket_under_test][tile][0][0],48);
+        remaining = delta;
+        clean = 1;
+        claimed_bits = 0;
+        for (j=num_lines-1; j>=0; j--) {
+            reps = (long) MUX_BASE_FLUSHES << j;
+            if (remaining >= reps - MUX_BASE_FLUSHES/2) {
+                claims[j]++;
+                claimed_bits |= 1 << j;
+                owner[j] = (owner[j] == -1) ? tile : -2;        // -2: claimed by more than one CHA
+                remaining -= reps;
+            }
+        }
+        if (fabs((double)remaining) > MUX_TOLERANCE*MUX_BASE_FLUSHES) clean = 0;
+        if (!clean) {
+            // every line this CHA might hold is suspect
+            for (j=0; j<num_lines; j++) {
+                if (claimed_bits & (1 << j)) owner[j] = -2;
+            }
+#ifdef VERBOSE
+            printf("MUX: lines %ld-%ld CHA %d delta %ld does not decode cleanly (remainder %ld)\n",
+                    first_line_number,first_line_number+num_lines-1,tile,delta,remaining);
+#endif // VERBOSE
+        }
+    }
+
+    for (j=0; j<num_lines; j++) {
+        if (claims[j] == 1 && owner[j] >= 0) {
+            cha[j] = owner[j];
+            m->mux_lines_decoded++;
+        } else {
+#ifdef VERBOSE
+            printf("MUX: line %ld ambiguous (%d claims) -- mapping individually\n",first_line_number+j,claims[j]);
+#endif // VERBOSE
+            cha[j] = map_cache_line(m, lines[j], paddr[j], first_line_number+j);
+            m->mux_lines_retried++;
+        }
+    }
+}
+
+void line_mapper_report_group(line_mapper_t *m)
+{
+    long lines = m->mux_lines_decoded + m->mux_lines_retried;
+
+    if (lines == 0) return;
+    printf("MUX: %ld windows of %d lines, %ld lines decoded, %ld ambiguous lines mapped individually (%f%%)\n",
+            m->mux_windows, MUX_LINES, m->mux_lines_decoded, m->mux_lines_retried, 100.0*(double)m->mux_lines_retried/(double)lines);
+}
@@ -0,0 +1,201 @@
+// map_page.c -- map all 32768 cache lines of one 2MiB page, and read/write the PADDR_*.map files
+//
+// line_mapper_setup() fills in a line_mapper_t for one socket (batched CHA counter reads through
+// the given core, plus the optional modes selected at compile time), map_page() runs the
+// per-line (or per-group) measurement over one page, and read_map_file()/write_map_file() handle
+// the 32768-Byte map files.  These are shared by the single-threaded mapper in main() and by the
+// per-socket workers.
+
+#ifdef MAPPER_BENCH
+#define MAP_PAGE_LINES BENCH_LINES      // mapper_bench.c: only the first BENCH_LINES lines of each page are measured
+#else
+#define MAP_PAGE_LINES 32768
+#endif // MAPPER_BENCH
+
+int line_mapper_setup(line_mapper_t *m, msr_batch_t *cha_batch, const cha_pmon_t *pmon, int socket, int cpu, int *msr_fd, int CHA_per_socket)
+{
+    uint32_t cha_msrs[NUM_CHA_BOXES];
+    int tile;
+
+    memset(m, 0, sizeof(*m));
+    m->pmon = pmon;
+    m->socket = socket;
+    m->msr_fd = msr_fd;
+    m->num_chas = CHA_per_socket;
+    m->nflushes = FULL_NFLUSHES;
+    m->totaltries = 0;
+    m->globalsum = 0;
+
+    // the addresses of CHA counter 0 in each CHA, so that each snapshot is a single batch
+    for (tile=0; tile<CHA_per_socket; tile++) {
+        cha_msrs[tile] = pmon->ctr[tile][0];
+    }
+#ifdef SIM_UNCORE
+    if (msr_batch_init_stub(cha_batch, cpu, cha_msrs, CHA_per_socket, sim_uncore_read, &sim_uncore) != 0) {
+#else
+    if (msr_batch_init(cha_batch, cpu, msr_fd[socket], cha_msrs, CHA_per_socket) != 0) {
+#endif // SIM_UNCORE
+        printf("ERROR: failed to set up batched CHA counter reads for socket %d\n",socket);
+        return(1);
+    }
+    printf("INFO: socket %d CHA counters read on cpu %d with %s\n",socket,cpu,msr_batch_backend_name(cha_batch->backend));
+    m->cha_batch = cha_batch;
+    m->trace = mapper_trace_ring(socket);
+#ifdef MUX_LINES
+    line_mapper_init_group(m);
+#endif // MUX_LINES
+#ifdef ADAPTIVE_FLUSHES
+    line_mapper_init_adaptive(m);
+#endif // ADAPTIVE_FLUSHES
+#ifdef INFER_PERMUTATION
+    line_mapper_load_base(m);
+#endif // INFER_PERMUTATION
+#ifdef PREDICT_VERIFY
+    slice_hash_t *slice_hash = (slice_hash_t *) malloc(sizeof(slice_hash_t));
+    if (slice_hash == NULL || line_mapper_load_hash(m, slice_hash) != 0) free(slice_hash);
+#endif // PREDICT_VERIFY
+    return(0);
+}
+
+// Reports for the optional modes, and the batch skew statistics
+void line_mapper_report_all(line_mapper_t *m)
+{
+    msr_batch_report(m->cha_batch, "CHA counters");
+#ifdef MUX_LINES
+    line_mapper_report_group(m);
+#endif // MUX_LINES
+#ifdef ADAPTIVE_FLUSHES
+    line_mapper_report_adaptive(m);
+#endif // ADAPTIVE_FLUSHES
+#ifdef INFER_PERMUTATION
+    line_mapper_report_infer(m);
+#endif // INFER_PERMUTATION
+#ifdef PREDICT_VERIFY
+    line_mapper_report(m);
+#endif // PREDICT_VERIFY
+}
+
+// Map the 32768 cache lines of the 2MiB page at virtual address page and physical address paddr into cha[].
+// With -DINFER_PERMUTATION the page is first synthesized from the base sequence (infer_page.c).
+// With -DCHECKPOINT the page resumes from its checkpoint file, if any (checkpoint.c).
+void map_page(line_mapper_t *m, double *page, uint64_t paddr, int8_t *cha)
+{
+    long line_number, first_line = 0;
+#ifdef MUX_LINES
+    double *group_lines[MUX_LINES];
+    uint64_t group_paddr[MUX_LINES];
+    int i, group_size;
+#endif // MUX_LINES
+#ifdef ADAPTIVE_FLUSHES
+    long page_flushes_start = m->adaptive_flushes;
+#endif // ADAPTIVE_FLUSHES
+#ifdef VERBOSE
+    unsigned long pagemapentry;
+#endif // VERBOSE
+#ifdef MAPPER_BENCH
+    long tries_before;
+#endif // MAPPER_BENCH
+
+#ifdef CHECKPOINT
+    first_line = checkpoint_begin(m, paddr, cha);
+#endif // CHECKPOINT
+#ifdef INFER_PERMUTATION
+    if (first_line == 0 && m->base != NULL && infer_page(m, page, paddr, cha) == 0) return;
+#endif // INFER_PERMUTATION
+
+#ifdef MUX_LINES
+    for (line_number=first_line; line_number<MAP_PAGE_LINES; line_number+=MUX_LINES) {
+#else
+    for (line_number=first_line; line_number<MAP_PAGE_LINES; line_number++) {
+#endif // MUX_LINES
+#ifdef MAPPER_BENCH
+        tries_before = m->totaltries;
+#endif // MAPPER_BENCH
+#ifdef VERBOSE
+        if (line_number%64 == 0) {
+            pagemapentry = get_pagemap_entry(&page[line_number*8]);
+            printf("DEBUG: paddr 0x%.12lx line_number %ld pagemapentry 0x%lx\n",paddr,line_number,pagemapentry);
+        }
+#endif // VERBOSE
+        // 4. Determine which L3 slice owns the cache line and
+        // 5. Save the CHA number in the cha[line] array
+#ifdef MUX_LINES
+        group_size = MIN(MUX_LINES, MAP_PAGE_LINES-line_number);
+        for (i=0; i<group_size; i++) {
+            group_lines[i] = &page[(line_number+i)*8];
+            group_paddr[i] = paddr + 64*(line_number+i);
+        }
+        map_cache_line_group(m, group_lines, group_paddr, line_number, group_size, &cha[line_number]);
+        BENCH_UNIT(m->totaltries - tries_before, group_size);
+#ifdef CHECKPOINT
+        checkpoint_progress(m, line_number + group_size);
+#endif // CHECKPOINT
+#else
+        cha[line_number] = map_cache_line(m, &page[line_number*8], paddr + 64*line_number, line_number);
+        BENCH_UNIT(m->totaltries - tries_before, 1);
+#ifdef CHECKPOINT
+        checkpoint_progress(m, line_number + 1);
+#endif // CHECKPOINT
+#endif // MUX_LINES
+    }
+#ifdef ADAPTIVE_FLUSHES
+    printf("ADAPTIVE: paddr 0x%.12lx %f flushes per line\n",paddr,(double)(m->adaptive_flushes-page_flushes_start)/(double)MAP_PAGE_LINES);
+    if (m->line_flushes != NULL) {      // per-line iteration counts (0 for lines not measured in this run)
+        char filename[100];
+        sprintf(filename,FLUSHES_FILE_PREFIX "_0x%.12lx.bin",paddr);
+        if (write_file_atomic(filename, NULL, 0, m->line_flushes, 32768 * sizeof(uint16_t)) != 0) {
+            printf("WARNING: failed to write the flush counts to %s: %s\n",filename,strerror(errno));
+        }
+        memset(m->line_flushes, 0, 32768 * sizeof(uint16_t));
+    }
+#endif // ADAPTIVE_FLUSHES
+}
+
+// Returns 1 if the map file for paddr exists and has been read into cha[], 0 if it does not exist.
+// Aborts if the file exists but cannot be read correctly.
+int read_map_file(uint64_t paddr, int8_t *cha)
+{
+    char filename[100];
+    FILE *ptr_mapping_file;
+    long k;
+
+    sprintf(filename,MAP_FILE_PREFIX "_0x%.12lx.map",paddr);
+    if (access(filename, F_OK) == -1) {                     // file does not exist
+        printf("DEBUG: Mapping file %s does not exist -- will create file after mapping cache lines\n",filename);
+        return(0);
+    }
+    if (access(filename, R_OK) == -1) {                     // file exists without read permissions
+        printf("ERROR: Mapping file %s exists, but without read permission\n",filename);
+        exit(1);
+    }
+    ptr_mapping_file = fopen(filename,"r");
+    if (!ptr_mapping_file) {
+        printf("ERROR: Failed to open Mapping File %s, should not happen\n",filename);
+        exit(2);
+    }
+    k = fread(cha,(size_t) 32768,(size_t) 1,ptr_mapping_file);
+    fclose(ptr_mapping_file);
+    if (k != 1) {                                           // incorrect read length
+        printf("ERROR: Read from Mapping File %s, returned the wrong record count %ld expected 1\n",filename,k);
+        exit(3);
+    }
+    printf("DEBUG: Mapping File read for %s succeeded -- skipping mapping for this page\n",filename);
+    return(1);
+}
+
+// Write the map file for paddr -- aborts on failure.  count is only used in the log message.
+// The file is written under a temporary name and renamed, so it is never left truncated.
+void write_map_file(uint64_t paddr, int8_t *cha, int count)
+{
+    char filename[100];
+
+    sprintf(filename,MAP_FILE_PREFIX "_0x%.12lx.map",paddr);
+    if (write_file_atomic(filename, NULL, 0, cha, (size_t) 32768) != 0) {
+        printf("ERROR: failed to write one 32768 Byte record to %s: %s -- aborting\n",filename,strerror(errno));
+        exit(5);
+    }
+#ifdef CHECKPOINT
+    checkpoint_end(paddr);
+#endif // CHECKPOINT
+    printf("SUCCESS: wrote mapping file %d %s\n",count,filename);
+}
@@ -0,0 +1,173 @@
+// mapper_bench.c -- per-phase timing of the mapper, and a machine-readable throughput report (compiled with -DMAPPER_BENCH)
+//
+// The time of the mapping run is divided into phases with the rdtscp() helpers in
+// low_overhead_timers.c.  Each BENCH_PHASE(p) marker charges the TSC cycles since the previous
+// marker to the phase that was running and makes p the current phase, so the phases add up to the
+// whole run:
+//     flush      load/flush loops of the lines being measured
+//     counters   CHA counter snapshots (msr_batch.c reads, or read_CHA_counter())
+//     classify   goodness tests and decisions on the counter deltas, and per-line bookkeeping
+//     backoff    sleep(1) back-offs after 100 failed tries
+//     pagemap    virtual-to-physical address lookups of the buffer at startup
+//     file_io    reading and writing the PADDR_*.map files
+//     other      everything else (setup, page selection, reporting)
+// The MSR system calls of the counter reads are counted per back-end (one pread() per MSR, one
+// ioctl per batch, none for the stub), and the number of tries of each measured line (one try is
+// one counter window) is collected in a histogram.
+//
+// In this mode every page selected is measured even if its map file exists (the file is still
+// read, so its cost is included), up to PAGES_MAPPED pages of BENCH_LINES lines each.  Map files are
+// only written for complete pages (BENCH_LINES = 32768) that had no map file, so the benchmark never
+// replaces a map in the data set.  At the end of the run a summary is printed ("BENCH:" lines) and
+// the report is written to BENCH_REPORT as JSON.  Combine with -DSIM_UNCORE to benchmark the
+// software overhead without the hardware.  Only the default mapper loop is timed
+// (the phase clock is global, and the per-socket workers, rolling buffer and latency engine have
+// loops of their own).
+
+#if defined(PER_SOCKET_WORKERS) || defined(ROLLING_BUFFER) || defined(LATENCY_ENGINE)
+#error "MAPPER_BENCH times the default mapper loop -- it cannot be combined with PER_SOCKET_WORKERS, ROLLING_BUFFER or LATENCY_ENGINE"
+#endif
+
+#ifndef BENCH_LINES
+#define BENCH_LINES 32768               // lines measured per page
+#endif
+#ifndef BENCH_REPORT
+#define BENCH_REPORT "mapper_bench.json"
+#endif
+#define BENCH_TRIES_BINS 16             // bin k: units measured with k+1 tries, the last bin is 16 or more
+
+enum { BENCH_OTHER, BENCH_FLUSH, BENCH_COUNTERS, BENCH_CLASSIFY, BENCH_BACKOFF, BENCH_PAGEMAP, BENCH_FILE_IO, BENCH_NUM_PHASES };
+static const char *bench_phase_names[BENCH_NUM_PHASES] = { "other", "flush", "counters", "classify", "backoff", "pagemap", "file_io" };
+
+typedef struct {
+    int phase;                          // phase running since tsc_last
+    uint64_t tsc_first, tsc_last;
+    uint64_t tsc_mapping;               // start of the mapping loop -- lines/second is measured from here
+    uint64_t cycles[BENCH_NUM_PHASES];
+    long entries[BENCH_NUM_PHASES];     // number of times each phase was entered
+    long msr_syscalls;
+    long msr_reads;                     // MSR values read
+    long units;                         // lines (or groups of MUX_LINES lines) measured
+    long lines;
+    long pages;
+    long tries_histogram[BENCH_TRIES_BINS];
+} mapper_bench_t;
+
+mapper_bench_t mapper_bench;
+
+#define BENCH_PHASE(p) mapper_bench_phase(&mapper_bench, (p))
+#define BENCH_MSR_READ(backend, num_msrs) mapper_bench_msr_read(&mapper_bench, (backend), (num_msrs))
+#define BENCH_UNIT(tries, lines) mapper_bench_unit(&mapper_bench, (tries), (lines))
+
+int write_file_atomic(const char *filename, const void *hdr, size_t hdr_len, const void *data, size_t len);    // checkpoint.c
+
+void mapper_bench_start(mapper_bench_t *b)
+{
+    memset(b, 0, sizeof(*b));
+    b->phase = BENCH_OTHER;
+    b->tsc_first = rdtscp();
+    b->tsc_last = b->tsc_first;
+}
+
+static inline void mapper_bench_phase(mapper_bench_t *b, int phase)
+{
+    uint64_t now = rdtscp();
+
+    b->cycles[b->phase] += now - b->tsc_last;
+    b->tsc_last = now;
+    b->phase = phase;
+    b->entries[phase]++;
+}
+
+// The mapping loop starts (after the buffer allocation, pagemap lookups and counter setup)
+void mapper_bench_begin_mapping(mapper_bench_t *b)
+{
+    mapper_bench_phase(b, BENCH_OTHER);
+    b->tsc_mapping = b->tsc_last;
+}
+
+// One counter read of num_msrs MSRs with the given msr_batch.c back-end
+static inline void mapper_bench_msr_read(mapper_bench_t *b, int backend, int num_msrs)
+{
+    b->msr_reads += num_msrs;
+    if (backend == MSR_BATCH_IOCTL) b->msr_syscalls++;
+    if (backend == MSR_BATCH_PREAD) b->msr_syscalls += num_msrs;
+}
+
+// One measurement unit (a line, or a group of lines with MUX_LINES) of lines lines took tries tries
+void mapper_bench_unit(mapper_bench_t *b, long tries, int lines)
+{
+    b->units++;
+    b->lines += lines;
+    b->tries_histogram[MIN(MAX(tries, 1), BENCH_TRIES_BINS) - 1]++;
+}
+
+// TSC frequency from the processor brand string, or measured against CLOCK_MONOTONIC if it has none
+static double mapper_bench_tsc_hz(void)
+{
+    struct timespec t0, t1;
+    uint64_t c0, c1;
+    double hz = get_TSC_frequency();
+
+    if (hz > 0.0) return(hz);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    c0 = rdtscp();
+    do {
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+    } while ((t1.tv_sec - t0.tv_sec) + 1.0e-9*(t1.tv_nsec - t0.tv_nsec) < 0.1);
+    c1 = rdtscp();
+    return((double)(c1 - c0) / ((t1.tv_sec - t0.tv_sec) + 1.0e-9*(t1.tv_nsec - t0.tv_nsec)));
+}
+
+// Print the summary and write the JSON report -- returns 0 if the report was written
+int mapper_bench_report(mapper_bench_t *b, const cha_pmon_t *pmon, const char *backend)
+{
+    char json[8192];
+    double hz, seconds, mapping_seconds, tries = 0.0;
+    int len, p, k;
+
+    mapper_bench_phase(b, BENCH_OTHER);
+    hz = mapper_bench_tsc_hz();
+    seconds = (double)(b->tsc_last - b->tsc_first) / hz;
+    mapping_seconds = (double)(b->tsc_last - b->tsc_mapping) / hz;
+    for (k=0; k<BENCH_TRIES_BINS; k++) tries += (double)(k + 1) * b->tries_histogram[k];
+
+    printf("BENCH: %ld pages, %ld lines mapped in %f seconds (%f seconds with startup), %f lines/second, TSC %f GHz\n",
+            b->pages,b->lines,mapping_seconds,seconds,(double)b->lines/mapping_seconds,hz*1.0e-9);
+    printf("BENCH: %f tries per measured unit, %f MSR system calls per line (%s back-end), %ld back-offs\n",
+            tries/(double)MAX(b->units,1),(double)b->msr_syscalls/(double)MAX(b->lines,1),backend,b->entries[BENCH_BACKOFF]);
+    for (p=0; p<BENCH_NUM_PHASES; p++) {
+        printf("BENCH: phase %-8s %12.6f seconds %6.2f%% %10ld entries\n",bench_phase_names[p],
+                (double)b->cycles[p]/hz,100.0*(double)b->cycles[p]/(double)(b->tsc_last - b->tsc_first),b->entries[p]);
+    }
+
+    len = snprintf(json, sizeof(json),
+            "{\n  \"platform\": \"%s\",\n  \"num_chas\": %d,\n  \"msr_backend\": \"%s\",\n  \"tsc_hz\": %.0f,\n"
+            "  \"pages\": %ld,\n  \"lines_per_page\": %d,\n  \"lines\": %ld,\n  \"seconds\": %.6f,\n  \"mapping_seconds\": %.6f,\n  \"lines_per_second\": %.3f,\n"
+            "  \"unit_lines\": %d,\n  \"units\": %ld,\n  \"tries_per_unit\": %.6f,\n  \"tries_histogram\": [",
+            pmon->desc->name,pmon->num_chas,backend,hz,b->pages,BENCH_LINES,b->lines,seconds,mapping_seconds,(double)b->lines/mapping_seconds,
+#ifdef MUX_LINES
+            MUX_LINES,
+#else
+            1,
+#endif // MUX_LINES
+            b->units,tries/(double)MAX(b->units,1));
+    for (k=0; k<BENCH_TRIES_BINS; k++) len += snprintf(json+len, sizeof(json)-len, "%s%ld",(k==0)?"":", ",b->tries_histogram[k]);
+    len += snprintf(json+len, sizeof(json)-len,
+            "],\n  \"msr_reads\": %ld,\n  \"msr_syscalls\": %ld,\n  \"msr_syscalls_per_line\": %.6f,\n"
+            "  \"backoffs\": %ld,\n  \"backoff_seconds\": %.6f,\n  \"phases\": {",
+            b->msr_reads,b->msr_syscalls,(double)b->msr_syscalls/(double)MAX(b->lines,1),
+            b->entries[BENCH_BACKOFF],(double)b->cycles[BENCH_BACKOFF]/hz);
+    for (p=0; p<BENCH_NUM_PHASES; p++) {
+        len += snprintf(json+len, sizeof(json)-len, "%s\n    \"%s\": { \"seconds\": %.6f, \"fraction\": %.6f, \"entries\": %ld }",
+                (p==0)?"":",",bench_phase_names[p],(double)b->cycles[p]/hz,
+                (double)b->cycles[p]/(double)(b->tsc_last - b->tsc_first),b->entries[p]);
+    }
+    len += snprintf(json+len, sizeof(json)-len, "\n  }\n}\n");
+    if (write_file_atomic(BENCH_REPORT, NULL, 0, json, len) != 0) {
+        printf("WARNING: failed to write %s\n",BENCH_REPORT);
+        return(1);
+    }
+    printf("BENCH: report written to %s\n",BENCH_REPORT);
+    return(0);
+}
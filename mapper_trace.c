@@ -0,0 +1,167 @@
+// mapper_trace.c -- runtime-enabled binary trace of the tries of the full measurement
+//
+// Always compiled.  With L3_TRACE=<file> in the environment, every try of map_cache_line_full()
+// is recorded: the line, the try number, the counter delta of each CHA, goodness1/2/3, the pass
+// bits, the CHA chosen and the TSC (see trace_format.c for the file layout).  The measuring
+// thread only copies the record into the ring buffer of its socket (TRACE_RING_RECORDS records,
+// single producer, single consumer, no locks).  A writer thread drains the rings into the file
+// with buffered writes and sleeps TRACE_DRAIN_USEC microseconds whenever they are empty, so the
+// measurement loop does no system calls or formatted output for the trace.  If a ring is full, the
+// record is dropped and counted instead of stalling the measurement.  Without L3_TRACE the cost is
+// one NULL pointer test per try.
+//
+// The trace is closed at exit (including exit() after too many back-offs), and the header is
+// updated with the number of records written and dropped.  trace_replay.exe reads the trace back
+// and replays the tries through the classifier (goodness.c) with the same or different limits.
+
+#ifndef TRACE_RING_RECORDS
+#define TRACE_RING_RECORDS 4096         // per socket -- must be a power of 2
+#endif
+#ifndef TRACE_DRAIN_USEC
+#define TRACE_DRAIN_USEC 1000
+#endif
+
+typedef struct {
+    trace_record_t *slot;
+    uint64_t head;                      // next record written by the measuring thread
+    uint64_t tail;                      // next record drained by the writer thread
+    uint64_t dropped;
+} trace_ring_t;
+
+typedef struct {
+    FILE *fp;                           // NULL: tracing disabled
+    const char *filename;
+    trace_header_t hdr;
+    trace_ring_t ring[NUM_SOCKETS];
+    pthread_t writer;
+    int stop;
+} mapper_trace_t;
+
+mapper_trace_t mapper_trace;
+
+// Write the records in one ring to the file -- returns the number of records written
+static long mapper_trace_drain(mapper_trace_t *t, trace_ring_t *r)
+{
+    uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = r->tail;
+    long n = 0;
+
+    for (; tail != head; tail++, n++) {
+        fwrite(&r->slot[tail & (TRACE_RING_RECORDS-1)], t->hdr.record_size, 1, t->fp);
+    }
+    __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+    t->hdr.records += n;
+    return(n);
+}
+
+// Writer thread: drain the rings until mapper_trace_close() sets stop, then make one last pass
+static void *mapper_trace_writer(void *arg)
+{
+    mapper_trace_t *t = (mapper_trace_t *) arg;
+    int socket, stop;
+    long n;
+
+    do {
+        stop = __atomic_load_n(&t->stop, __ATOMIC_ACQUIRE);
+        n = 0;
+        for (socket=0; socket<NUM_SOCKETS; socket++) n += mapper_trace_drain(t, &t->ring[socket]);
+        if (n == 0 && !stop) usleep(TRACE_DRAIN_USEC);
+    } while (!stop);
+    return(NULL);
+}
+
+// Record one try -- called by the thread measuring on socket
+void mapper_trace_try(trace_ring_t *r, int socket, uint64_t paddr, long line_number, int try_number,
+                      const long *delta, int num_chas, const goodness_t *g)
+{
+    uint64_t head = r->head;
+    trace_record_t *rec;
+    int tile;
+
+    if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= TRACE_RING_RECORDS) {
+        r->dropped++;
+        return;
+    }
+    rec = &r->slot[head & (TRACE_RING_RECORDS-1)];
+    rec->tsc = rdtscp();
+    rec->paddr = paddr;
+    rec->line_number = (uint32_t) line_number;
+    rec->try_number = (uint16_t) MIN(try_number, 65535);
+    rec->socket = (int8_t) socket;
+    rec->cha = (int8_t) ((g->pass == GOODNESS_ALL) ? g->cha : -1);
+    rec->pass = (uint8_t) g->pass;
+    rec->goodness[0] = (float) g->goodness1;
+    rec->goodness[1] = (float) g->goodness2;
+    rec->goodness[2] = (float) g->goodness3;
+    for (tile=0; tile<num_chas; tile++) rec->delta[tile] = (uint32_t) MIN(delta[tile], 0xffffffffL);
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// The ring buffer for the mapper of socket, or NULL if tracing is disabled
+trace_ring_t *mapper_trace_ring(int socket)
+{
+    if (mapper_trace.fp == NULL || socket < 0 || socket >= NUM_SOCKETS) return(NULL);
+    return(&mapper_trace.ring[socket]);
+}
+
+// atexit() handler: stop the writer thread, and write the final counts into the header
+void mapper_trace_close(void)
+{
+    mapper_trace_t *t = &mapper_trace;
+    int socket;
+
+    if (t->fp == NULL) return;
+    __atomic_store_n(&t->stop, 1, __ATOMIC_RELEASE);
+    pthread_join(t->writer, NULL);
+    for (socket=0; socket<NUM_SOCKETS; socket++) {
+        t->hdr.dropped += t->ring[socket].dropped;
+        free(t->ring[socket].slot);
+    }
+    if (fseek(t->fp, 0, SEEK_SET) != 0 || fwrite(&t->hdr, sizeof(t->hdr), 1, t->fp) != 1 || fclose(t->fp) != 0) {
+        printf("WARNING: failed to finish the trace file %s\n",t->filename);
+    } else {
+        printf("TRACE: %lu tries written to %s, %lu dropped\n",t->hdr.records,t->filename,t->hdr.dropped);
+    }
+    t->fp = NULL;
+}
+
+// Start the trace if L3_TRACE is set -- returns 0 (also when tracing is disabled), 1 on failure
+int mapper_trace_open(const cha_pmon_t *pmon, int nflushes)
+{
+    mapper_trace_t *t = &mapper_trace;
+    const char *filename = getenv("L3_TRACE");
+    int socket;
+
+    memset(t, 0, sizeof(*t));
+    if (filename == NULL || filename[0] == '\0') return(0);
+    t->filename = filename;
+    t->hdr.magic = TRACE_MAGIC;
+    t->hdr.signature = pmon->desc->signature;
+    t->hdr.num_chas = pmon->num_chas;
+    t->hdr.nflushes = nflushes;
+    t->hdr.record_size = TRACE_RECORD_FIXED + 4*pmon->num_chas;
+    t->hdr.tsc_hz = MAX(get_TSC_frequency(), 0.0);
+    t->hdr.goodness1_min = goodness_default_limits.goodness1_min;
+    t->hdr.goodness2_max = goodness_default_limits.goodness2_max;
+    t->hdr.goodness3_max = goodness_default_limits.goodness3_max;
+    t->hdr.owner_permille = goodness_default_limits.owner_permille;
+    for (socket=0; socket<NUM_SOCKETS; socket++) {
+        t->ring[socket].slot = (trace_record_t *) malloc(TRACE_RING_RECORDS * sizeof(trace_record_t));
+        if (t->ring[socket].slot == NULL) {
+            printf("ERROR: no memory for the trace ring buffers\n");
+            return(1);
+        }
+    }
+    t->fp = fopen(filename, "w");
+    if (t->fp == NULL || fwrite(&t->hdr, sizeof(t->hdr), 1, t->fp) != 1) {
+        printf("ERROR: cannot write the trace file %s: %s\n",filename,strerror(errno));
+        return(1);
+    }
+    if (pthread_create(&t->writer, NULL, mapper_trace_writer, t) != 0) {
+        printf("ERROR: cannot start the trace writer thread\n");
+        return(1);
+    }
+    atexit(mapper_trace_close);
+    printf("INFO: tracing the tries of the full measurement to %s (%d records per socket ring)\n",filename,TRACE_RING_RECORDS);
+    return(0);
+}
@@ -0,0 +1,525 @@
+// mesh_traffic.c -- model the mesh traffic of a set of access streams from the slice hash and the tile layout
+//
+// Usage: mesh_traffic.exe [-d results_dir] [-t threads] [-n num_hot_links] [-v seed] [-m memory_GiB]
+//                         [-g imc_interleave_bytes] CONFIG TILE_FILE STREAM_FILE
+//     e.g., mesh_traffic.exe -v 1 SKX_28 skx_28_tiles.txt triad_streams.txt
+//
+// TILE_FILE gives the size of the mesh and the (column, row) of every core, CHA and (optionally)
+// memory controller, one per line ('#' starts a comment):
+//     MESH <columns> <rows>
+//     CORE <core> <column> <row>
+//     CHA <cha> <column> <row>
+//     IMC <imc> <column> <row>
+// Row 0 is the top of the die and column 0 the left.  There must be one CHA per slice of CONFIG.
+//
+// STREAM_FILE has one access stream per line:
+//     <core> <start> <bytes> <stride> <write_fraction> [<passes>]
+// i.e., core <core> touches start, start+stride, ... below start+bytes, <passes> times, and a
+// fraction <write_fraction> of the accesses are stores.  Strides below 64 Bytes touch every line
+// of the range.  The addresses are physical, unless -v is given: then they are virtual, and each
+// 2MiB virtual page is backed by a pseudo-random 2MiB physical page (from the seed) below
+// -m GiB (default 64, or the range validated for CONFIG if smaller), as with transparent huge pages.
+//
+// The traffic of each line touched is modelled at the level of messages between tiles, with
+// weights for the read/write mix (c: requesting core, h: CHA of the line, i: memory controller):
+//   - request c->h and completion response h->c,
+//   - for every other core whose streams touch the line (sharers): a store sends an invalidating
+//     snoop h->sharer and gets a snoop response sharer->h; a load snoops only the sharers that
+//     may hold the line modified (each with the probability of its write fraction), and the
+//     modified data is forwarded sharer->c,
+//   - otherwise the data comes from memory: request h->i and data i->c (from the L3, h->c,
+//     if the tile file has no memory controllers, i.e., an L3-resident working set),
+//   - every stored line is written back: data c->h, and h->i when there are memory controllers.
+// Lines are interleaved over the memory controllers in blocks of -g Bytes (default 4096).
+//
+// The streams are split into chunks of CHUNK_LINES lines that the threads take in turn.  Each
+// thread translates the lines of a chunk, computes their slices with the batch kernels of the
+// hash library and adds the messages to its own tile-to-tile traffic matrix for each message
+// class.  The matrices are summed at the end and each tile-to-tile flow is routed Y-X (along the
+// column to the destination row first, then along the row), which gives the traffic on every
+// directed link between neighbouring tiles.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "slice_hash.h"
+
+#ifndef MIN
+#define MIN(x,y) ((x)<(y)?(x):(y))
+#endif
+#ifndef MAX
+#define MAX(x,y) ((x)>(y)?(x):(y))
+#endif
+
+#define MAX_COLS 16
+#define MAX_ROWS 16
+#define MAX_TILES (MAX_COLS*MAX_ROWS)
+#define MAX_CORES 256
+#define MAX_SLICES 64
+#define MAX_IMCS 16
+#define MAX_STREAMS 4096
+#define MAX_THREADS 256
+#define CHUNK_LINES 65536
+#define MAX_SHARERS 64                  // other cores' streams considered per line
+
+#define NUM_CLASSES 4
+#define CLASS_REQUEST 0
+#define CLASS_SNOOP 1
+#define CLASS_RESPONSE 2
+#define CLASS_DATA 3
+static const char *class_names[NUM_CLASSES] = { "request", "snoop", "response", "data" };
+
+#define NUM_DIRS 4                      // links leaving a tile: up (row-1), down (row+1), right (col+1), left (col-1)
+static const char dir_names[NUM_DIRS] = { 'U', 'D', 'R', 'L' };
+static const int dir_dcol[NUM_DIRS] = { 0, 0, 1, -1 };
+static const int dir_drow[NUM_DIRS] = { -1, 1, 0, 0 };
+
+typedef struct {
+    int core;
+    uint64_t start, end;                // stream addresses, end exclusive
+    uint64_t stride;
+    double write_fraction;
+    double passes;
+    long lines;                         // lines touched per pass
+    int first_sharer, num_sharers;      // streams of other cores with overlapping ranges, in sharers[]
+} stream_t;
+
+typedef struct {
+    int stream;
+    long first, count;                  // lines of the stream
+} chunk_t;
+
+typedef struct {
+    pthread_t thread;
+    double *matrix;                     // [NUM_CLASSES][MAX_TILES][MAX_TILES] messages
+    long lines_by_slice[MAX_SLICES];
+    long lines_unvalidated;
+} worker_t;
+
+static int cols, rows;
+static int core_tile[MAX_CORES], cha_tile[MAX_SLICES], imc_tile[MAX_IMCS];
+static int num_chas, num_imcs;
+static stream_t streams[MAX_STREAMS];
+static int num_streams;
+static int *sharers;
+static chunk_t *chunks;
+static long num_chunks, next_chunk;
+static slice_hash_t h;
+static int virtual_addresses;
+static uint64_t seed, memory_pages, imc_interleave = 4096;
+
+static double mysecond()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((double) ts.tv_sec + 1.0e-9 * (double) ts.tv_nsec);
+}
+
+// -----------------------------------------------------------------------------------------
+// Input files
+
+static int read_tiles(const char *filename)
+{
+    char line[256], kind[16];
+    int id, col, row, n, lineno = 0, lines_read = 0, cha_defined[MAX_SLICES] = {0}, imc_defined[MAX_IMCS] = {0};
+    FILE *fp = fopen(filename, "r");
+
+    if (fp == NULL) {
+        fprintf(stderr,"ERROR: cannot open the tile file %s\n",filename);
+        return(1);
+    }
+    for (id=0; id<MAX_CORES; id++) core_tile[id] = -1;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        lineno = ++lines_read;
+        if (strchr(line, '#') != NULL) *strchr(line, '#') = '\0';
+        n = sscanf(line, "%15s %d %d %d", kind, &id, &col, &row);
+        if (n <= 0) {
+            lineno = 0;
+            continue;
+        }
+        if (strcmp(kind, "MESH") == 0 && n >= 3) {
+            cols = id;
+            rows = col;
+            if (cols < 1 || cols > MAX_COLS || rows < 1 || rows > MAX_ROWS) break;
+            lineno = 0;
+            continue;
+        }
+        if (n != 4 || cols == 0 || col < 0 || col >= cols || row < 0 || row >= rows) break;
+        if (strcmp(kind, "CORE") == 0 && id >= 0 && id < MAX_CORES) {
+            core_tile[id] = row*cols + col;
+        } else if (strcmp(kind, "CHA") == 0 && id >= 0 && id < MAX_SLICES) {
+            cha_tile[id] = row*cols + col;
+            cha_defined[id] = 1;
+            num_chas = MAX(num_chas, id+1);
+        } else if (strcmp(kind, "IMC") == 0 && id >= 0 && id < MAX_IMCS) {
+            imc_tile[id] = row*cols + col;
+            imc_defined[id] = 1;
+            num_imcs = MAX(num_imcs, id+1);
+        } else {
+            break;
+        }
+        lineno = 0;
+    }
+    if (lineno != 0) {                  // the loop stopped at a bad line
+        fprintf(stderr,"ERROR: %s line %d: expected MESH <columns> <rows> (at most %dx%d) first, then CORE, CHA or IMC <id> <column> <row>\n",
+                filename,lineno,MAX_COLS,MAX_ROWS);
+        fclose(fp);
+        return(1);
+    }
+    fclose(fp);
+    for (id=0; id<num_chas; id++) {
+        if (!cha_defined[id]) {
+            fprintf(stderr,"ERROR: %s has no position for CHA %d\n",filename,id);
+            return(1);
+        }
+    }
+    for (id=0; id<num_imcs; id++) {
+        if (!imc_defined[id]) {
+            fprintf(stderr,"ERROR: %s has no position for IMC %d\n",filename,id);
+            return(1);
+        }
+    }
+    return(0);
+}
+
+static int read_streams(const char *filename)
+{
+    char line[256];
+    long start, bytes, stride;           // %li takes decimal or 0x-prefixed hexadecimal
+    double write_fraction, passes;
+    int core, n, lineno = 0;
+    stream_t *s;
+    FILE *fp = fopen(filename, "r");
+
+    if (fp == NULL) {
+        fprintf(stderr,"ERROR: cannot open the stream file %s\n",filename);
+        return(1);
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        lineno++;
+        if (strchr(line, '#') != NULL) *strchr(line, '#') = '\0';
+        passes = 1.0;
+        n = sscanf(line, "%d %li %li %li %lf %lf", &core, &start, &bytes, &stride, &write_fraction, &passes);
+        if (n <= 0) continue;
+        if (n < 5 || core < 0 || core >= MAX_CORES || core_tile[core] < 0 || start < 0 || bytes <= 0 || stride <= 0
+                || write_fraction < 0.0 || write_fraction > 1.0 || passes <= 0.0 || num_streams == MAX_STREAMS) {
+            fprintf(stderr,"ERROR: %s line %d: expected <core> <start> <bytes> <stride> <write_fraction> [<passes>] for a core of the tile file (at most %d streams)\n",
+                    filename,lineno,MAX_STREAMS);
+            fclose(fp);
+            return(1);
+        }
+        s = &streams[num_streams++];
+        s->core = core;
+        s->start = start;
+        s->end = start + bytes;
+        s->stride = stride;
+        s->write_fraction = write_fraction;
+        s->passes = passes;
+        if (stride <= 64) s->lines = (long) (((s->end + 63) >> 6) - (s->start >> 6));
+        else s->lines = (long) ((bytes + stride - 1) / stride);
+    }
+    fclose(fp);
+    if (num_streams == 0) {
+        fprintf(stderr,"ERROR: no streams in %s\n",filename);
+        return(1);
+    }
+    return(0);
+}
+
+// Streams of other cores whose ranges overlap each stream -- the candidate sharers of its lines
+static void find_sharers()
+{
+    int i, j, n = 0, max = 64;
+
+    sharers = (int *) malloc(max * sizeof(int));
+    for (i=0; i<num_streams; i++) {
+        streams[i].first_sharer = n;
+        for (j=0; j<num_streams; j++) {
+            if (streams[j].core == streams[i].core || streams[j].end <= (streams[i].start & ~63UL)
+                    || streams[j].start >= ((streams[i].end + 63) & ~63UL)) continue;
+            if (n == max) {
+                max *= 2;
+                sharers = (int *) realloc(sharers, max * sizeof(int));
+            }
+            sharers[n++] = j;
+        }
+        streams[i].num_sharers = n - streams[i].first_sharer;
+    }
+}
+
+// -----------------------------------------------------------------------------------------
+// The model
+
+// Address of the line with index k of stream s
+static inline uint64_t stream_line(const stream_t *s, long k)
+{
+    if (s->stride <= 64) return((s->start & ~63UL) + 64*(uint64_t) k);
+    return((s->start + s->stride*(uint64_t) k) & ~63UL);
+}
+
+// Non-zero if stream s touches the line at address line
+static inline int stream_touches(const stream_t *s, uint64_t line)
+{
+    uint64_t k, addr;
+
+    if (line + 64 <= s->start || line >= s->end) return(0);
+    if (s->stride <= 64) return(1);
+    k = (line > s->start) ? (line - s->start + s->stride - 1) / s->stride : 0;
+    addr = s->start + k*s->stride;
+    return(addr < line + 64 && addr < s->end);
+}
+
+static inline uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 30; x *= 0xbf58476d1ce4e5b9UL;
+    x ^= x >> 27; x *= 0x94d049bb133111ebUL;
+    return(x ^ (x >> 31));
+}
+
+static inline uint64_t physical_address(uint64_t addr)
+{
+    if (!virtual_addresses) return(addr);
+    return(((mix64((addr >> 21) ^ seed) % memory_pages) << 21) | (addr & ((1UL << 21) - 1)));
+}
+
+#define MSG(w, class, src, dst, weight) ((w)->matrix[((size_t) (class)*MAX_TILES + (src))*MAX_TILES + (dst)] += (weight))
+
+static void *mesh_worker(void *arg)
+{
+    worker_t *w = (worker_t *) arg;
+    uint64_t *line = (uint64_t *) malloc(CHUNK_LINES * sizeof(uint64_t));
+    uint64_t *paddr = (uint64_t *) malloc(CHUNK_LINES * sizeof(uint64_t));
+    int8_t *slices = (int8_t *) malloc(CHUNK_LINES + SLICE_HASH_TABLE_PAD);
+    int sharer_tile[MAX_SHARERS];
+    double sharer_write[MAX_SHARERS], modified, sum_write, reads, writes, memory, weight;
+    const stream_t *s, *o;
+    long c, k;
+    int j, n, c_tile, h_tile, i_tile;
+
+    while ((c = __atomic_fetch_add(&next_chunk, 1, __ATOMIC_RELAXED)) < num_chunks) {
+        s = &streams[chunks[c].stream];
+        for (k=0; k<chunks[c].count; k++) {
+            line[k] = stream_line(s, chunks[c].first + k);
+            paddr[k] = physical_address(line[k]);
+        }
+        if (!slice_hash_address_validated(&h, paddr[chunks[c].count-1]) || !slice_hash_address_validated(&h, paddr[0])) {
+            for (k=0; k<chunks[c].count; k++) w->lines_unvalidated += !slice_hash_address_validated(&h, paddr[k]);
+        }
+        slice_hash_slices_of(&h, paddr, slices, chunks[c].count);
+
+        c_tile = core_tile[s->core];
+        reads = s->passes * (1.0 - s->write_fraction);
+        writes = s->passes * s->write_fraction;
+        for (k=0; k<chunks[c].count; k++) {
+            h_tile = cha_tile[(int) slices[k]];
+            w->lines_by_slice[(int) slices[k]]++;
+            MSG(w, CLASS_REQUEST, c_tile, h_tile, s->passes);
+            MSG(w, CLASS_RESPONSE, h_tile, c_tile, s->passes);
+
+            // sharers: stores invalidate all of them, loads snoop those that may hold the line modified
+            n = 0;
+            sum_write = 0.0;
+            for (j=0; j<s->num_sharers && n<MAX_SHARERS; j++) {
+                o = &streams[sharers[s->first_sharer + j]];
+                if (!stream_touches(o, line[k])) continue;
+                sharer_tile[n] = core_tile[o->core];
+                sharer_write[n] = o->write_fraction;
+                sum_write += o->write_fraction;
+                n++;
+            }
+            modified = MIN(sum_write, 1.0);
+            for (j=0; j<n; j++) {
+                weight = reads*sharer_write[j] + writes;
+                MSG(w, CLASS_SNOOP, h_tile, sharer_tile[j], weight);
+                MSG(w, CLASS_RESPONSE, sharer_tile[j], h_tile, weight);
+                if (sharer_write[j] > 0.0) MSG(w, CLASS_DATA, sharer_tile[j], c_tile, s->passes*modified*sharer_write[j]/sum_write);
+            }
+
+            // data from memory (or the L3) for the rest, and the write-backs of the stores
+            memory = s->passes * (1.0 - modified);
+            if (num_imcs > 0) {
+                i_tile = imc_tile[(paddr[k] / imc_interleave) % num_imcs];
+                MSG(w, CLASS_REQUEST, h_tile, i_tile, memory);
+                MSG(w, CLASS_DATA, i_tile, c_tile, memory);
+                if (writes > 0.0) MSG(w, CLASS_DATA, h_tile, i_tile, writes);
+            } else {
+                MSG(w, CLASS_DATA, h_tile, c_tile, memory);
+            }
+            if (writes > 0.0) MSG(w, CLASS_DATA, c_tile, h_tile, writes);
+        }
+    }
+    free(line);
+    free(paddr);
+    free(slices);
+    return(NULL);
+}
+
+// -----------------------------------------------------------------------------------------
+typedef struct {
+    int tile, dir;
+    double total;
+} hot_link_t;
+
+static int compare_hot_links(const void *a, const void *b)
+{
+    double x = ((const hot_link_t *) a)->total, y = ((const hot_link_t *) b)->total;
+    return((x < y) - (x > y));
+}
+
+int main(int argc, char *argv[])
+{
+    static double link[NUM_CLASSES][MAX_TILES][NUM_DIRS];
+    static worker_t workers[MAX_THREADS];
+    static hot_link_t hot[MAX_TILES*NUM_DIRS];
+    const char *results_dir = "Results", *config;
+    double *matrix, messages[NUM_CLASSES] = {0}, hops[NUM_CLASSES] = {0}, vertical = 0.0, horizontal = 0.0;
+    double weight, total, mean, t0, memory_gib = 64.0;
+    long total_lines = 0, lines_by_slice[MAX_SLICES] = {0}, lines_unvalidated = 0, k;
+    int nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN), num_hot = 20, num_links = 0;
+    int opt, i, t, cl, src, dst, col, row, dir, slice;
+
+    while ((opt = getopt(argc, argv, "d:t:n:v:m:g:")) != -1) {
+        switch (opt) {
+        case 'd':
+            results_dir = optarg;
+            break;
+        case 't':
+            nthreads = atoi(optarg);
+            break;
+        case 'n':
+            num_hot = atoi(optarg);
+            break;
+        case 'v':
+            virtual_addresses = 1;
+            seed = strtoul(optarg, NULL, 0);
+            break;
+        case 'm':
+            memory_gib = atof(optarg);
+            break;
+        case 'g':
+            imc_interleave = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            optind = argc + 1;
+        }
+    }
+    if (argc - optind != 3 || imc_interleave < 64) {
+        fprintf(stderr,"Usage: %s [-d results_dir] [-t threads] [-n num_hot_links] [-v seed] [-m memory_GiB] [-g imc_interleave_bytes] CONFIG TILE_FILE STREAM_FILE\n",argv[0]);
+        return(1);
+    }
+    nthreads = MIN(MAX(nthreads, 1), MAX_THREADS);
+    config = argv[optind];
+    if (slice_hash_load(&h, results_dir, config) != 0) return(2);
+    if (read_tiles(argv[optind+1]) != 0 || read_streams(argv[optind+2]) != 0) return(2);
+    if (num_chas != h.num_slices) {
+        fprintf(stderr,"ERROR: %s has %d CHAs, the %s hash has %d slices\n",argv[optind+1],num_chas,config,h.num_slices);
+        return(2);
+    }
+    if (virtual_addresses) {
+        memory_pages = (uint64_t) (memory_gib * 512.0);
+        memory_pages = MIN(memory_pages, 1UL << (h.high_bit + 1 - 21));
+        if (memory_pages == 0) {
+            fprintf(stderr,"ERROR: the memory size must be at least one 2MiB page\n");
+            return(1);
+        }
+    }
+    find_sharers();
+
+    // chunks of CHUNK_LINES lines, taken in turn by the threads
+    for (i=0; i<num_streams; i++) num_chunks += (streams[i].lines + CHUNK_LINES - 1) / CHUNK_LINES;
+    chunks = (chunk_t *) malloc(num_chunks * sizeof(chunk_t));
+    for (i=0, k=0; i<num_streams; i++) {
+        long first;
+        for (first=0; first<streams[i].lines; first+=CHUNK_LINES, k++) {
+            chunks[k].stream = i;
+            chunks[k].first = first;
+            chunks[k].count = MIN(CHUNK_LINES, streams[i].lines - first);
+        }
+        total_lines += streams[i].lines;
+    }
+    t0 = mysecond();
+    for (t=0; t<nthreads; t++) {
+        workers[t].matrix = (double *) calloc((size_t) NUM_CLASSES*MAX_TILES*MAX_TILES, sizeof(double));
+        if (workers[t].matrix == NULL || pthread_create(&workers[t].thread, NULL, mesh_worker, &workers[t]) != 0) {
+            fprintf(stderr,"ERROR: cannot start worker thread %d\n",t);
+            return(3);
+        }
+    }
+    matrix = workers[0].matrix;
+    for (t=0; t<nthreads; t++) {
+        pthread_join(workers[t].thread, NULL);
+        if (t > 0) {
+            for (k=0; k<(long) NUM_CLASSES*MAX_TILES*MAX_TILES; k++) matrix[k] += workers[t].matrix[k];
+            free(workers[t].matrix);
+        }
+        for (slice=0; slice<h.num_slices; slice++) lines_by_slice[slice] += workers[t].lines_by_slice[slice];
+        lines_unvalidated += workers[t].lines_unvalidated;
+    }
+
+    // route every tile-to-tile flow Y-X: along the column to the destination row, then along the row
+    for (cl=0; cl<NUM_CLASSES; cl++) {
+        for (src=0; src<cols*rows; src++) {
+            for (dst=0; dst<cols*rows; dst++) {
+                weight = matrix[((size_t) cl*MAX_TILES + src)*MAX_TILES + dst];
+                if (weight == 0.0) continue;
+                messages[cl] += weight;
+                col = src % cols;
+                row = src / cols;
+                while (row != dst / cols || col != dst % cols) {
+                    if (row != dst / cols) dir = (row > dst / cols) ? 0 : 1;
+                    else dir = (col < dst % cols) ? 2 : 3;
+                    link[cl][row*cols + col][dir] += weight;
+                    hops[cl] += weight;
+                    if (dir < 2) vertical += weight;
+                    else horizontal += weight;
+                    col += dir_dcol[dir];
+                    row += dir_drow[dir];
+                }
+            }
+        }
+    }
+
+    printf("MESH_TRAFFIC: %s hash (%d slices), %dx%d mesh, %d memory controllers, %d streams, %ld lines per pass, %d threads, %f seconds\n",
+            config,h.num_slices,cols,rows,num_imcs,num_streams,total_lines,nthreads,mysecond()-t0);
+    if (virtual_addresses) printf("MESH_TRAFFIC: virtual addresses on random 2MiB pages (seed %lu) in %lu MiB\n",seed,2*memory_pages);
+    if (lines_unvalidated > 0) {
+        printf("WARNING: %ld lines are above the validated address bit %d of the %s tables\n",lines_unvalidated,h.high_bit,config);
+    }
+    mean = (double) total_lines / (double) h.num_slices;
+    printf("LINES_BY_CHA cha column row lines ratio_to_mean\n");
+    for (slice=0; slice<h.num_slices; slice++) {
+        printf("%d %d %d %ld %f\n",slice,cha_tile[slice]%cols,cha_tile[slice]/cols,lines_by_slice[slice],(double)lines_by_slice[slice]/mean);
+    }
+    printf("MESSAGES class messages link_traversals mean_hops\n");
+    for (cl=0; cl<NUM_CLASSES; cl++) {
+        printf("%s %.0f %.0f %f\n",class_names[cl],messages[cl],hops[cl],hops[cl]/MAX(messages[cl],1.0));
+    }
+    printf("MESSAGES: %.0f vertical and %.0f horizontal link traversals\n",vertical,horizontal);
+
+    printf("LINKS column row direction request snoop response data total\n");
+    for (src=0; src<cols*rows; src++) {
+        for (dir=0; dir<NUM_DIRS; dir++) {
+            total = 0.0;
+            for (cl=0; cl<NUM_CLASSES; cl++) total += link[cl][src][dir];
+            if (total == 0.0) continue;
+            printf("%d %d %c %.0f %.0f %.0f %.0f %.0f\n",src%cols,src/cols,dir_names[dir],
+                    link[CLASS_REQUEST][src][dir],link[CLASS_SNOOP][src][dir],link[CLASS_RESPONSE][src][dir],link[CLASS_DATA][src][dir],total);
+            hot[num_links].tile = src;
+            hot[num_links].dir = dir;
+            hot[num_links].total = total;
+            num_links++;
+        }
+    }
+    qsort(hot, num_links, sizeof(hot_link_t), compare_hot_links);
+    total = 0.0;
+    for (i=0; i<num_links; i++) total += hot[i].total;
+    printf("HOT_LINKS column row direction total ratio_to_mean\n");
+    for (i=0; i<MIN(num_hot, num_links); i++) {
+        printf("%d %d %c %.0f %f\n",hot[i].tile%cols,hot[i].tile/cols,dir_names[hot[i].dir],hot[i].total,hot[i].total*num_links/total);
+    }
+    return(0);
+}
@@ -0,0 +1,230 @@
+// msr_batch.c -- read a fixed list of MSRs (e.g., one counter in every CHA of a socket) as a batch
+//
+// read_CHA_counter() costs one pread() on /dev/cpu/N/msr per counter, so a before/after snapshot
+// of 60 CHAs on SPR is 120 system calls and the first and last counters of a snapshot are read
+// many microseconds apart.  An msr_batch_t holds the MSR address vector computed once, and reads
+// the whole vector with one of three back-ends:
+//
+//  MSR_BATCH_IOCTL -- a single X86_IOC_MSR_BATCH ioctl on /dev/cpu/msr_batch (msr-safe driver,
+//                     https://github.com/LLNL/msr-safe), i.e., one system call per snapshot.
+//                     The MSRs must be in the msr-safe allowlist.
+//  MSR_BATCH_PREAD -- one pread() per MSR on an already-open /dev/cpu/N/msr file descriptor.
+//                     This is the fallback when msr-safe is not installed.
+//  MSR_BATCH_STUB  -- no device: values come from a caller-provided function (or an internal
+//                     array of values if none is given), for testing without root or hardware.
+//
+// Each read records the TSC just before the first and just after the last MSR access.  The
+// difference ("skew") is the width of the window over which the snapshot was taken, and is
+// accumulated in min/mean/max statistics that msr_batch_report() prints.
+
+#ifndef MSR_BATCH_DEVICE
+#define MSR_BATCH_DEVICE "/dev/cpu/msr_batch"
+#endif
+
+#define MSR_BATCH_IOCTL 0
+#define MSR_BATCH_PREAD 1
+#define MSR_BATCH_STUB  2
+
+// ABI of the msr-safe batch interface (msr_batch.h in the msr-safe sources)
+#ifndef X86_IOC_MSR_BATCH
+struct msr_batch_op {
+    uint16_t cpu;                       // In: CPU on which to execute the rdmsr/wrmsr
+    uint16_t isrdmsr;                   // In: 0=wrmsr, non-zero=rdmsr
+    int32_t err;                        // Out: set if an error occurred for this op
+    uint32_t msr;                       // In: MSR address
+    uint64_t msrdata;                   // In/Out: value written/read
+    uint64_t wmask;                     // Out: write mask applied to wrmsr
+};
+struct msr_batch_array {
+    uint32_t numops;                    // In: number of operations in the ops array
+    struct msr_batch_op *ops;           // In: array[numops] of operations
+};
+#define X86_IOC_MSR_BATCH _IOWR('c', 0xA2, struct msr_batch_array)
+#endif // X86_IOC_MSR_BATCH
+
+typedef uint64_t (*msr_stub_read_t)(void *arg, int cpu, uint32_t msr);
+
+typedef struct {
+    int backend;                        // MSR_BATCH_IOCTL, MSR_BATCH_PREAD or MSR_BATCH_STUB
+    int cpu;                            // logical processor used for the reads (any core in the socket)
+    int fd;                             // /dev/cpu/msr_batch or /dev/cpu/N/msr -- not owned by the batch for PREAD
+    int num_msrs;                       // length of the precomputed address vector
+    uint32_t *msrs;                     // precomputed MSR address vector
+    uint64_t *values;                   // results of the last msr_batch_read()
+    struct msr_batch_op *ops;           // ioctl operations, one per MSR (sized for max_ops)
+    int max_ops;
+    msr_stub_read_t stub_read;          // MSR_BATCH_STUB value source (NULL: stub_values[])
+    void *stub_arg;
+    uint64_t *stub_values;              // MSR_BATCH_STUB values for the address vector when stub_read is NULL
+    uint64_t tsc_first, tsc_last;       // TSC before the first and after the last access of the last read
+    long snapshots;
+    uint64_t skew_min, skew_max;
+    double skew_sum;
+} msr_batch_t;
+
+const char *msr_batch_backend_name(int backend)
+{
+    switch(backend) {
+        case MSR_BATCH_IOCTL: return("msr-safe batch ioctl");
+        case MSR_BATCH_PREAD: return("pread");
+        case MSR_BATCH_STUB:  return("stub");
+        default:              return("unknown");
+    }
+}
+
+// Common part of the initialization -- copies the address vector and allocates the buffers
+static int msr_batch_alloc(msr_batch_t *b, int backend, int cpu, const uint32_t *msrs, int num_msrs)
+{
+    int i;
+
+    memset(b, 0, sizeof(*b));
+    b->backend = backend;
+    b->cpu = cpu;
+    b->fd = -1;
+    b->num_msrs = num_msrs;
+    b->max_ops = num_msrs;
+    b->msrs = (uint32_t *) malloc(num_msrs * sizeof(uint32_t));
+    b->values = (uint64_t *) calloc(num_msrs, sizeof(uint64_t));
+    b->ops = (struct msr_batch_op *) calloc(num_msrs, sizeof(struct msr_batch_op));
+    if (b->msrs == NULL || b->values == NULL || b->ops == NULL) {
+        fprintf(stderr,"ERROR: msr_batch_alloc() out of memory for %d MSRs\n",num_msrs);
+        return(1);
+    }
+    for (i=0; i<num_msrs; i++) {
+        b->msrs[i] = msrs[i];
+        b->ops[i].cpu = (uint16_t) cpu;
+        b->ops[i].isrdmsr = 1;
+        b->ops[i].msr = msrs[i];
+    }
+    b->skew_min = ~0UL;
+    return(0);
+}
+
+// Prepare to read msrs[0..num_msrs-1] on logical processor cpu.  Uses the msr-safe batch device if
+// it can be opened and accepts a test read of the vector, otherwise pread() on msr_fd (which must be
+// an open /dev/cpu/<cpu>/msr or /dev/cpu/<cpu>/msr_safe).  Returns 0 on success.
+int msr_batch_init(msr_batch_t *b, int cpu, int msr_fd, const uint32_t *msrs, int num_msrs)
+{
+    struct msr_batch_array batch;
+    int fd;
+
+    if (msr_batch_alloc(b, MSR_BATCH_PREAD, cpu, msrs, num_msrs) != 0) return(1);
+    b->fd = msr_fd;
+#ifndef MSR_BATCH_NO_IOCTL
+    fd = open(MSR_BATCH_DEVICE, O_RDWR);
+    if (fd != -1) {
+        batch.numops = num_msrs;
+        batch.ops = b->ops;
+        if (ioctl(fd, X86_IOC_MSR_BATCH, &batch) == 0) {
+            b->backend = MSR_BATCH_IOCTL;
+            b->fd = fd;
+        } else {
+            printf("WARNING: %s test read failed (%s) -- check the msr-safe allowlist; using pread\n",MSR_BATCH_DEVICE,strerror(errno));
+            close(fd);
+        }
+    }
+#endif // MSR_BATCH_NO_IOCTL
+    return(0);
+}
+
+// Stub device: values come from stub_read(stub_arg, cpu, msr), or from b->stub_values[] if stub_read is NULL
+int msr_batch_init_stub(msr_batch_t *b, int cpu, const uint32_t *msrs, int num_msrs, msr_stub_read_t stub_read, void *stub_arg)
+{
+    if (msr_batch_alloc(b, MSR_BATCH_STUB, cpu, msrs, num_msrs) != 0) return(1);
+    b->stub_read = stub_read;
+    b->stub_arg = stub_arg;
+    b->stub_values = (uint64_t *) calloc(num_msrs, sizeof(uint64_t));
+    if (b->stub_values == NULL) {
+        fprintf(stderr,"ERROR: msr_batch_init_stub() out of memory\n");
+        return(1);
+    }
+    return(0);
+}
+
+void msr_batch_free(msr_batch_t *b)
+{
+    if (b->backend == MSR_BATCH_IOCTL && b->fd != -1) close(b->fd);
+    free(b->msrs);
+    free(b->values);
+    free(b->ops);
+    free(b->stub_values);
+    memset(b, 0, sizeof(*b));
+    b->fd = -1;
+}
+
+// Read an arbitrary list of MSRs (at most num_msrs of them) -- returns 0 on success
+int msr_batch_read_list(msr_batch_t *b, const uint32_t *msrs, uint64_t *values, int n)
+{
+    struct msr_batch_array batch;
+    uint64_t skew;
+    int i, rc;
+
+    if (n > b->max_ops) {
+        fprintf(stderr,"ERROR: msr_batch_read_list() asked for %d MSRs, batch holds at most %d\n",n,b->max_ops);
+        return(1);
+    }
+    rc = 0;
+    switch(b->backend) {
+        case MSR_BATCH_IOCTL:
+            if (msrs != b->msrs) {
+                for (i=0; i<n; i++) b->ops[i].msr = msrs[i];
+            }
+            batch.numops = n;
+            batch.ops = b->ops;
+            b->tsc_first = rdtscp();
+            if (ioctl(b->fd, X86_IOC_MSR_BATCH, &batch) != 0) rc = 1;
+            b->tsc_last = rdtscp();
+            for (i=0; i<n; i++) {
+                values[i] = b->ops[i].msrdata;
+                if (b->ops[i].err != 0) rc = 1;
+            }
+            if (msrs != b->msrs) {
+                for (i=0; i<n; i++) b->ops[i].msr = b->msrs[i];
+            }
+            break;
+        case MSR_BATCH_PREAD:
+            b->tsc_first = rdtscp();
+            for (i=0; i<n; i++) {
+                if (pread(b->fd,&values[i],sizeof(uint64_t),msrs[i]) != sizeof(uint64_t)) rc = 1;
+            }
+            b->tsc_last = rdtscp();
+            break;
+        case MSR_BATCH_STUB:
+            b->tsc_first = rdtscp();
+            for (i=0; i<n; i++) {
+                if (b->stub_read != NULL) {
+                    values[i] = b->stub_read(b->stub_arg, b->cpu, msrs[i]);
+                } else {
+                    values[i] = (msrs == b->msrs) ? b->stub_values[i] : 0;
+                }
+            }
+            b->tsc_last = rdtscp();
+            break;
+        default:
+            fprintf(stderr,"ERROR: msr_batch_read_list() unknown backend %d\n",b->backend);
+            exit(1);
+    }
+    if (rc != 0) {
+        fprintf(stderr,"ERROR: msr_batch_read_list() %s read of %d MSRs on cpu %d failed\n",msr_batch_backend_name(b->backend),n,b->cpu);
+    }
+    skew = b->tsc_last - b->tsc_first;
+    b->snapshots++;
+    b->skew_sum += (double) skew;
+    b->skew_min = MIN(b->skew_min, skew);
+    b->skew_max = MAX(b->skew_max, skew);
+    return(rc);
+}
+
+// Read the precomputed address vector into b->values -- returns 0 on success
+int msr_batch_read(msr_batch_t *b)
+{
+    return(msr_batch_read_list(b, b->msrs, b->values, b->num_msrs));
+}
+
+void msr_batch_report(msr_batch_t *b, const char *name)
+{
+    if (b->snapshots == 0) return;
+    printf("MSR_BATCH: %s backend %s cpu %d %d MSRs per snapshot, %ld snapshots, skew (TSC cycles first to last read) min %lu mean %.1f max %lu\n",
+            name, msr_batch_backend_name(b->backend), b->cpu, b->num_msrs, b->snapshots,
+            b->skew_min, b->skew_sum/(double)b->snapshots, b->skew_max);
+}
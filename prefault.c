@@ -0,0 +1,146 @@
+// prefault.c -- parallel first touch of the working buffer and bulk physical address lookup (compiled with -DFAST_PREFAULT)
+//
+// The default startup writes every double of the buffer from one thread and then reads one
+// pagemap entry per 2MiB page with a separate pread().  Here the buffer is advised as THP and
+// then touched by PREFAULT_THREADS threads (default: all online processors), with one store per
+// 4 KiB page, so the time is bounded by the kernel's page-zeroing bandwidth.  The threads inherit
+// the CPU affinity and memory policy of the caller, so pages are placed as before under numactl
+// --membind; with the default local policy they go to the nodes of the touching processors.
+//
+// The pagemap entries of all 512 4 KiB pages of each 2MiB page are then read with one pread() per
+// PREFAULT_PAGEMAP_CHUNK 2MiB pages.  A 2MiB page is verified if all 512 entries are present with
+// contiguous frame numbers starting on a 2MiB boundary and, when /proc/kpageflags can be read, the
+// first frame is flagged as the head of a transparent huge page (KPF_THP) or as part of a hugetlbfs
+// huge page (KPF_HUGE -- the 2MiB blocks of a 1GiB page are compound tails).
+// Only verified pages are queued for mapping.
+
+#ifndef PREFAULT_THREADS
+#define PREFAULT_THREADS 0                      // 0: one thread per online processor
+#endif
+#ifndef PREFAULT_PAGEMAP_CHUNK
+#define PREFAULT_PAGEMAP_CHUNK 64               // 2MiB pages per pagemap pread() (256 KiB of entries)
+#endif
+#define PAGEMAP_PRESENT (1UL << 63)
+#define PAGEMAP_PFN_MASK 0x007FFFFFFFFFFFFFUL
+#define KPF_COMPOUND_HEAD 15
+#define KPF_HUGE 17
+#define KPF_THP 22
+
+typedef struct {
+    char *start;
+    char *end;
+} prefault_range_t;
+
+static void *prefault_thread(void *arg)
+{
+    prefault_range_t *r = (prefault_range_t *) arg;
+    char *p;
+
+    for (p=r->start; p<r->end; p+=4096) *(volatile double *)p = 1.0;
+    return(NULL);
+}
+
+static double prefault_seconds(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return((double)tv.tv_sec + 1.0e-6*(double)tv.tv_usec);
+}
+
+// Touch every 4 KiB page of buf[0..len) from num_threads threads (0: all online processors).
+// Ranges whose thread cannot be started are touched by the calling thread.
+void prefault_buffer(char *buf, size_t len, int num_threads)
+{
+    pthread_t threads[256];
+    prefault_range_t ranges[256];
+    size_t pages_4k = len / 4096, per_thread;
+    double t0 = prefault_seconds();
+    int i, started = 0;
+
+    if (num_threads <= 0) num_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    num_threads = MAX(1, MIN(num_threads, 256));
+#ifdef MYHUGEPAGE_THP
+    if (madvise(buf, len, MADV_HUGEPAGE) != 0) {
+        printf("WARNING: madvise(MADV_HUGEPAGE) failed: %s\n",strerror(errno));
+    }
+#endif // MYHUGEPAGE_THP
+    per_thread = (pages_4k + num_threads - 1) / num_threads;
+    for (i=0; i<num_threads; i++) {
+        ranges[started].start = buf + MIN(pages_4k, i*per_thread) * 4096;
+        ranges[started].end = buf + MIN(pages_4k, (i+1)*per_thread) * 4096;
+        if (pthread_create(&threads[started], NULL, prefault_thread, &ranges[started]) == 0) {
+            started++;
+        } else {
+            prefault_thread(&ranges[started]);
+        }
+    }
+    for (i=0; i<started; i++) pthread_join(threads[i], NULL);
+    printf("INFO: prefaulted %ld MiB with %d threads in %f seconds\n",(long)(len>>20),started,prefault_seconds()-t0);
+}
+
+// Look up the physical addresses of the num_pages 2MiB pages starting at buf (2MiB-aligned).
+// paddr[j] is the physical address of page j (0 if not present), and verified[j] is 1 if page j
+// is backed by one 2MiB huge page.  Returns the number of verified pages, or -1 on error.
+long read_pagemap_2m(const char *buf, long num_pages, uint64_t *paddr, int8_t *verified)
+{
+    uint64_t *entries, pfn, flags;
+    long j, first, n, i, num_verified = 0;
+    int pagemap_fd, kpageflags_fd, ok;
+    ssize_t bytes;
+    double t0 = prefault_seconds();
+
+    pagemap_fd = open("/proc/self/pagemap", O_RDONLY);
+    if (pagemap_fd == -1) {
+        printf("ERROR: cannot open /proc/self/pagemap: %s\n",strerror(errno));
+        return(-1);
+    }
+    kpageflags_fd = open("/proc/kpageflags", O_RDONLY);
+    if (kpageflags_fd == -1) {
+        printf("INFO: cannot open /proc/kpageflags (%s) -- verifying huge pages from the pagemap only\n",strerror(errno));
+    }
+    entries = (uint64_t *) malloc(PREFAULT_PAGEMAP_CHUNK * 512 * sizeof(uint64_t));
+    if (entries == NULL) {
+        printf("ERROR: read_pagemap_2m() out of memory\n");
+        close(pagemap_fd);
+        if (kpageflags_fd != -1) close(kpageflags_fd);
+        return(-1);
+    }
+
+    for (first=0; first<num_pages; first+=PREFAULT_PAGEMAP_CHUNK) {
+        n = MIN(PREFAULT_PAGEMAP_CHUNK, num_pages - first);
+        bytes = pread(pagemap_fd, entries, n*512*sizeof(uint64_t), (off_t)(((uintptr_t)buf + first*MYPAGESIZE) >> 12) * sizeof(uint64_t));
+        if (bytes != (ssize_t)(n*512*sizeof(uint64_t))) {
+            printf("ERROR: pagemap pread for pages %ld-%ld returned %ld: %s\n",first,first+n-1,(long)bytes,strerror(errno));
+            num_verified = -1;
+            break;
+        }
+        for (j=0; j<n; j++) {
+            uint64_t *e = &entries[j*512];
+            pfn = e[0] & PAGEMAP_PFN_MASK;
+            paddr[first+j] = (e[0] & PAGEMAP_PRESENT) ? pfn << 12 : 0;
+            ok = (e[0] & PAGEMAP_PRESENT) && pfn != 0 && (pfn & 511) == 0;
+            for (i=1; i<512 && ok; i++) {
+                if (!(e[i] & PAGEMAP_PRESENT) || (e[i] & PAGEMAP_PFN_MASK) != pfn + i) ok = 0;
+            }
+            if (ok && kpageflags_fd != -1) {
+                if (pread(kpageflags_fd, &flags, sizeof(flags), (off_t)(pfn * sizeof(uint64_t))) != sizeof(flags)) {
+                    ok = 0;
+                } else if (!(flags & ((1UL << KPF_THP) | (1UL << KPF_HUGE)))) {
+                    ok = 0;
+                } else if (!(flags & (1UL << KPF_COMPOUND_HEAD)) && !(flags & (1UL << KPF_HUGE))) {
+                    ok = 0;                         // a THP that does not start here (2MiB blocks of 1GiB pages are tails)
+                }
+            }
+            verified[first+j] = (int8_t) ok;
+            num_verified += ok;
+        }
+    }
+    free(entries);
+    close(pagemap_fd);
+    if (kpageflags_fd != -1) close(kpageflags_fd);
+    if (num_verified >= 0) {
+        printf("INFO: %ld of %ld 2MiB pages verified as huge pages in %f seconds\n",num_verified,num_pages,prefault_seconds()-t0);
+    }
+    return(num_verified);
+}
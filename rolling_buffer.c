@@ -0,0 +1,231 @@
+// rolling_buffer.c -- map new physical pages from a small window of memory that is released and reallocated (compiled with -DROLLING_BUFFER)
+//
+// Instead of allocating NUMPAGES 2MiB pages up front, each round allocates a window of
+// ROLLING_WINDOW_PAGES 2MiB pages, maps the pages that do not already have a PADDR_*.map file, and
+// releases the pages whose frames are not needed.  Pages whose physical frame is already known
+// (mapped in this run, or found on disk) stay allocated, so the kernel cannot hand the same frames
+// back in a later round -- the buddy allocator returns just-freed frames first, so releasing them
+// would stall the run on an idle node.  Known frames are only released (oldest first) when the
+// held pages reach the memory budget of ROLLING_BUDGET_MIB MiB (default 4096, at most half of the
+// memory available at startup), which bounds the memory used.
+// With -DROLLING_NODES=n the rounds rotate over NUMA nodes 0..n-1 (raw mbind() system call).
+// With -DROLLING_ROUND_DELAY=s the mapper sleeps s seconds after a round without new frames, to
+// let other activity on the node churn the free lists.
+//
+// Every 2MiB frame seen is recorded in a bitmap of the physical address space, and the coverage --
+// frames seen, 1GiB regions touched, and the fraction of installed memory -- is reported after
+// each round.  The run stops after PAGES_MAPPED new pages, ROLLING_MAX_ROUNDS rounds, or
+// ROLLING_STALL_ROUNDS consecutive rounds without a frame that had not been seen before.
+
+#ifndef ROLLING_WINDOW_PAGES
+#define ROLLING_WINDOW_PAGES 32         // 64 MiB allocated per round
+#endif
+#ifndef ROLLING_BUDGET_MIB
+#define ROLLING_BUDGET_MIB 4096         // memory for the window plus the known frames kept allocated
+#endif
+#ifndef ROLLING_MAX_ROUNDS
+#define ROLLING_MAX_ROUNDS 4096
+#endif
+#ifndef ROLLING_STALL_ROUNDS
+#define ROLLING_STALL_ROUNDS 16
+#endif
+#ifndef ROLLING_NODES
+#define ROLLING_NODES 0                 // 0: use the default memory policy for every round
+#endif
+#ifndef ROLLING_ROUND_DELAY
+#define ROLLING_ROUND_DELAY 0           // seconds to wait after a round without new frames
+#endif
+#define ROLLING_PADDR_BITS 46           // the coverage bitmap spans physical addresses below 64 TiB
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+#ifndef MPOL_MF_STRICT
+#define MPOL_MF_STRICT (1<<0)
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE (1<<1)
+#endif
+
+typedef struct {
+    uint8_t *seen;                      // bit f: 2MiB frame f (paddr >> 21) has been allocated in some round
+    long frames_seen;
+    long pages_mapped;
+    long pages_on_disk;                 // frames that already had a map file
+    long pages_rejected;                // not backed by a 2MiB-aligned physical page
+    uint64_t lowest_paddr, highest_paddr;
+    char **held;                        // FIFO of pages kept allocated
+    long max_held, num_held, next_held;
+} rolling_state_t;
+
+// Keep a page of a known frame allocated -- the oldest one is released only when the budget is full
+static void rolling_hold(rolling_state_t *r, char *page)
+{
+    if (r->num_held == r->max_held) {
+        munmap(r->held[r->next_held], MYPAGESIZE);
+    } else {
+        r->num_held++;
+    }
+    r->held[r->next_held] = page;
+    r->next_held = (r->next_held + 1) % r->max_held;
+}
+
+// Returns 1 if the frame had not been seen before
+static int rolling_mark_seen(rolling_state_t *r, uint64_t paddr)
+{
+    uint64_t frame = paddr >> 21;
+
+    if (frame >= (1UL << (ROLLING_PADDR_BITS - 21))) return(0);
+    if (r->seen[frame/8] & (1 << (frame%8))) return(0);
+    r->seen[frame/8] |= 1 << (frame%8);
+    r->frames_seen++;
+    if (r->frames_seen == 1 || paddr < r->lowest_paddr) r->lowest_paddr = paddr;
+    if (paddr > r->highest_paddr) r->highest_paddr = paddr;
+    return(1);
+}
+
+// Number of 1GiB regions with at least one frame seen (64 Bytes of the bitmap per region)
+static long rolling_regions_seen(const rolling_state_t *r)
+{
+    const uint64_t *words = (const uint64_t *) r->seen;
+    long region, k, count = 0;
+
+    for (region=0; region<(1L << (ROLLING_PADDR_BITS - 30)); region++) {
+        for (k=0; k<8; k++) {
+            if (words[region*8 + k] != 0) {
+                count++;
+                break;
+            }
+        }
+    }
+    return(count);
+}
+
+// One round: allocate, map, and release a window of pages -- returns the number of new frames seen
+static long rolling_round(rolling_state_t *r, line_mapper_t *m, int8_t *cha, int round)
+{
+    size_t len = ROLLING_WINDOW_PAGES * MYPAGESIZE;
+    char *raw, *buf, *page;
+    unsigned long pagemapentry;
+    uint64_t paddr, paddrs[ROLLING_WINDOW_PAGES];
+    long j, k, line_number, new_frames = 0, order[ROLLING_WINDOW_PAGES];
+    size_t off;
+
+    raw = mmap(NULL, len + MYPAGESIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+    if (raw == MAP_FAILED) {
+        printf("ERROR: round %d: mmap of %ld Bytes failed: %s\n",round,(long)len,strerror(errno));
+        return(-1);
+    }
+    // trim to a 2MiB-aligned window so that each page can be released on its own
+    buf = (char *) (((uintptr_t) raw + MYPAGESIZE - 1) & ~(uintptr_t)(MYPAGESIZE - 1));
+    if (buf > raw) munmap(raw, buf - raw);
+    if (raw + len + MYPAGESIZE > buf + len) munmap(buf + len, (raw + len + MYPAGESIZE) - (buf + len));
+#if ROLLING_NODES > 0
+    uint64_t nodemask = 1UL << (round % ROLLING_NODES);
+    if (syscall(SYS_mbind, buf, len, MPOL_BIND, &nodemask, 64, MPOL_MF_STRICT|MPOL_MF_MOVE) != 0) {
+        printf("WARNING: round %d: mbind to node %d failed: %s\n",round,round % ROLLING_NODES,strerror(errno));
+    }
+#endif // ROLLING_NODES
+#ifdef MYHUGEPAGE_THP
+    madvise(buf, len, MADV_HUGEPAGE);
+#endif
+    for (off=0; off<len; off+=4096) *(volatile double *)(buf + off) = 1.0;
+
+    // pages with a checkpoint first (checkpoint.c)
+    for (j=0; j<ROLLING_WINDOW_PAGES; j++) {
+        pagemapentry = get_pagemap_entry(buf + j*MYPAGESIZE);
+        paddrs[j] = (pagemapentry & (unsigned long) 0x007FFFFFFFFFFFFF) << 12;
+        order[j] = j;
+    }
+    checkpoint_first(paddrs, order, ROLLING_WINDOW_PAGES);
+
+    for (k=0; k<ROLLING_WINDOW_PAGES; k++) {
+        j = order[k];
+        page = buf + j*MYPAGESIZE;
+        paddr = paddrs[j];
+        if (paddr == 0 || (paddr & 0x1fffffUL) != 0) {
+            r->pages_rejected++;
+            munmap(page, MYPAGESIZE);
+            continue;
+        }
+        new_frames += rolling_mark_seen(r, paddr);
+        if (read_map_file(paddr, cha) == 1) {
+            r->pages_on_disk++;
+            rolling_hold(r, page);
+        } else if (r->pages_mapped < PAGES_MAPPED) {
+            map_page(m, (double *) page, paddr, cha);
+            write_map_file(paddr, cha, (int) r->pages_mapped);
+            for (line_number=0; line_number<32768; line_number++) lines_by_cha[cha[line_number]]++;
+            r->pages_mapped++;
+            rolling_hold(r, page);
+        } else {
+            munmap(page, MYPAGESIZE);
+        }
+    }
+    return(new_frames);
+}
+
+// Map up to PAGES_MAPPED new pages with a rolling window -- returns the number of pages mapped
+long run_rolling_buffer(const cha_pmon_t *pmon, int socket, int cpu, int *msr_fd, int CHA_per_socket)
+{
+    static rolling_state_t r;
+    line_mapper_t line_mapper;
+    msr_batch_t cha_batch;
+    int8_t *cha;
+    long new_frames, lines_accounted = 0;
+    double installed = (double) sysconf(_SC_PHYS_PAGES) * (double) sysconf(_SC_PAGESIZE);
+    long budget_pages = MIN((long) ROLLING_BUDGET_MIB / (MYPAGESIZE >> 20), (long) ((double) sysconf(_SC_AVPHYS_PAGES) * (double) sysconf(_SC_PAGESIZE) / 2 / MYPAGESIZE));
+    int round, stalled = 0, tile;
+
+    memset(&r, 0, sizeof(r));
+    r.seen = (uint8_t *) calloc(1UL << (ROLLING_PADDR_BITS - 21 - 3), 1);
+    r.max_held = MAX(budget_pages - ROLLING_WINDOW_PAGES, 1);
+    r.held = (char **) malloc(r.max_held * sizeof(char *));
+    cha = (int8_t *) malloc(32768);
+    if (r.seen == NULL || r.held == NULL || cha == NULL) {
+        printf("ERROR: run_rolling_buffer() out of memory\n");
+        exit(8);
+    }
+#ifdef CHECKPOINT
+    checkpoint_install();
+#endif // CHECKPOINT
+    if (line_mapper_setup(&line_mapper, &cha_batch, pmon, socket, cpu, msr_fd, CHA_per_socket) != 0) {
+        exit(6);
+    }
+    printf("INFO: rolling buffer: %d pages per round, up to %ld known pages held, at most %ld MiB\n",
+            ROLLING_WINDOW_PAGES,r.max_held,(long)(ROLLING_WINDOW_PAGES+r.max_held)*(MYPAGESIZE>>20));
+
+    for (round=0; round<ROLLING_MAX_ROUNDS && r.pages_mapped<PAGES_MAPPED && stalled<ROLLING_STALL_ROUNDS; round++) {
+        new_frames = rolling_round(&r, &line_mapper, cha, round);
+        if (new_frames < 0) break;
+        stalled = (new_frames == 0) ? stalled + 1 : 0;
+        if (stalled > 0 && ROLLING_ROUND_DELAY > 0) sleep(ROLLING_ROUND_DELAY);
+        printf("ROLLING: round %d %ld new frames, %ld frames seen in %ld 1GiB regions (%f%% of memory), %ld pages mapped, %ld on disk, %ld rejected\n",
+                round,new_frames,r.frames_seen,rolling_regions_seen(&r),100.0*(double)r.frames_seen*(double)MYPAGESIZE/installed,
+                r.pages_mapped,r.pages_on_disk,r.pages_rejected);
+    }
+    if (stalled >= ROLLING_STALL_ROUNDS) {
+        printf("INFO: rolling buffer stopped after %d rounds without new frames\n",stalled);
+    }
+    printf("ROLLING: coverage %ld 2MiB frames from 0x%.12lx to 0x%.12lx in %ld 1GiB regions\n",
+            r.frames_seen,r.lowest_paddr,r.highest_paddr,rolling_regions_seen(&r));
+    while (r.num_held > 0) {
+        r.num_held--;
+        r.next_held = (r.next_held + r.max_held - 1) % r.max_held;
+        munmap(r.held[r.next_held], MYPAGESIZE);
+    }
+    free(r.held);
+
+    printf("INFO: %ld new 2MiB pages have been mapped\n",r.pages_mapped);
+    printf("DUMMY: globalsum %d\n",line_mapper.globalsum);
+    line_mapper_report_all(&line_mapper);
+    printf("------------\n");
+    printf("LINES_BY_CHA\n");
+    for (tile=0; tile<CHA_per_socket; tile++) {
+        printf("%d %ld\n",tile,lines_by_cha[tile]);
+        lines_accounted += lines_by_cha[tile];
+    }
+    printf("ACCCOUNTED FOR %ld lines expected %ld lines\n",lines_accounted,32768*r.pages_mapped);
+    free(cha);
+    free(r.seen);
+    return(r.pages_mapped);
+}
@@ -0,0 +1,137 @@
+// select_pages.c -- choose the next 2MiB page to map by the information it adds (compiled with -DSELECT_PAGES)
+//
+// The permutation select masks are found by solving a linear system over GF(2) whose rows are the
+// physical addresses of the mapped pages, so a new page only helps if its page number (paddr >> 21)
+// is linearly independent of the page numbers already mapped, and it helps most if the new
+// dimension involves address bits above the highest bit validated by the current tables (e.g., 37
+// in Results/PermSelectMasks_SKX_28-slice.tbl), where the masks are still unknown.
+//
+// The page selector keeps a GF(2) basis of the page numbers of all mapped pages -- the PADDR_*.map
+// files already in the current directory, plus each page as it completes -- and scores every
+// candidate page by reducing its page number against the basis:
+//      2: the remainder has a bit above the validated bit (adds an unresolved dimension)
+//      1: the remainder is non-zero, but only in validated bits
+//      0: the page is a linear combination of pages already mapped
+// Ties are broken by the number of unresolved bits set in the address, then by the prime-stride
+// order of the original page loop.  The validated bit is -DVALIDATED_HIGH_BIT=n, or is read from
+// the tables in RESULTS_DIR, or else every bit is treated as unresolved.
+
+#include <dirent.h>
+
+typedef struct {
+    int validated_bit;                  // highest physical address bit covered by the tables (-1: none)
+    uint64_t basis[64];                 // basis[b]: basis vector (page number) with highest bit b, or 0
+    int rank;                           // dimension of the span of the mapped page numbers
+    int unresolved_rank;                // dimensions whose pivot is above the validated bit
+    char *visited;                      // pages already returned by page_selector_next()
+    long num_pages;
+} page_selector_t;
+
+static int highest_bit(uint64_t v)
+{
+    return(63 - __builtin_clzl(v));
+}
+
+// Reduce a page number against the basis -- returns the remainder (0 if dependent)
+static uint64_t page_selector_reduce(const page_selector_t *ps, uint64_t v)
+{
+    while (v != 0 && ps->basis[highest_bit(v)] != 0) v ^= ps->basis[highest_bit(v)];
+    return(v);
+}
+
+// Add a mapped page to the basis -- returns 1 if it added a dimension
+int page_selector_add(page_selector_t *ps, uint64_t paddr)
+{
+    uint64_t v = page_selector_reduce(ps, paddr >> 21);
+    int b;
+
+    if (v == 0) return(0);
+    b = highest_bit(v);
+    ps->basis[b] = v;
+    ps->rank++;
+    if (b + 21 > ps->validated_bit) ps->unresolved_rank++;
+    return(1);
+}
+
+// Add the pages of the PADDR_0x*.map files (SIM_PADDR_0x*.map with -DSIM_UNCORE) in directory dir -- returns the number of files found
+long page_selector_scan_maps(page_selector_t *ps, const char *dir)
+{
+    DIR *dp;
+    struct dirent *de;
+    unsigned long paddr;
+    long count = 0;
+    int name_len;
+
+    dp = opendir(dir);
+    if (dp == NULL) return(0);
+    while ((de = readdir(dp)) != NULL) {
+        name_len = 0;                   // exactly <prefix>_0x<hex>.map -- checkpoints are not finished pages
+        if (sscanf(de->d_name, MAP_FILE_PREFIX "_0x%lx%n", &paddr, &name_len) == 1 && strcmp(de->d_name + name_len, ".map") == 0) {
+            page_selector_add(ps, paddr);
+            count++;
+        }
+    }
+    closedir(dp);
+    return(count);
+}
+
+int page_selector_init(page_selector_t *ps, line_mapper_t *m, long num_pages)
+{
+    long num_maps;
+
+    memset(ps, 0, sizeof(*ps));
+    ps->num_pages = num_pages;
+    ps->visited = (char *) calloc(num_pages, 1);
+    if (ps->visited == NULL) {
+        printf("ERROR: page_selector_init() out of memory\n");
+        return(1);
+    }
+#ifdef VALIDATED_HIGH_BIT
+    ps->validated_bit = VALIDATED_HIGH_BIT;
+#else
+    slice_hash_t h;
+    ps->validated_bit = -1;
+    if (line_mapper_open_tables(m, &h) == 0) {
+        ps->validated_bit = h.high_bit;
+        slice_hash_free(&h);
+    }
+#endif // VALIDATED_HIGH_BIT
+    num_maps = page_selector_scan_maps(ps, ".");
+    printf("INFO: page selection: validated through bit %d, %ld existing map files span %d dimensions (%d above the validated bit)\n",
+            ps->validated_bit, num_maps, ps->rank, ps->unresolved_rank);
+    return(0);
+}
+
+// Returns the index of the best page not yet visited, or -1 when all pages have been visited
+long page_selector_next(page_selector_t *ps, const uint64_t *paddr_by_page, long primestride)
+{
+    long iii, page, best_page = -1;
+    int score, best_score = -1, bits, best_bits = -1;
+    uint64_t v, unresolved_mask;
+
+    unresolved_mask = (ps->validated_bit >= 63) ? 0 : ~0UL << (ps->validated_bit + 1);
+    for (iii=0; iii<ps->num_pages; iii++) {
+        page = (primestride * iii) % ps->num_pages;
+        if (ps->visited[page]) continue;
+        v = page_selector_reduce(ps, paddr_by_page[page] >> 21);
+        if (v == 0) {
+            score = 0;
+        } else if (highest_bit(v) + 21 > ps->validated_bit) {
+            score = 2;
+        } else {
+            score = 1;
+        }
+        bits = __builtin_popcountl(paddr_by_page[page] & unresolved_mask);
+        if (score > best_score || (score == best_score && bits > best_bits)) {
+            best_score = score;
+            best_bits = bits;
+            best_page = page;
+        }
+    }
+    if (best_page >= 0) {
+        ps->visited[best_page] = 1;
+        printf("SELECT: page %ld paddr 0x%.12lx score %d unresolved bits %d (rank %d, %d unresolved)\n",
+                best_page, paddr_by_page[best_page], best_score, best_bits, ps->rank, ps->unresolved_rank);
+    }
+    return(best_page);
+}
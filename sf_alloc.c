@@ -0,0 +1,492 @@
+// sf_alloc.c -- conflict-aware allocation of large arrays on 2MiB pages (interface in sf_alloc.h)
+//
+// For an allocation of n 2MiB pages, a pool of pool_factor*n pages (at least n+1) is mapped,
+// advised for transparent huge pages and touched, and the physical address of every 4KiB page is
+// read from /proc/self/pagemap (get_pagemap_entries() in va2pa_lib.c).  For each pool page and
+// each stride 64<<s (s = 0..15, up to 2MiB), the slices of the lines at the multiples of the
+// stride within the page are counted with the batch kernels of the hash library, so the per-slice
+// counts of any set of pages are the sums of the counts of its pages.
+//
+// The pages are chosen greedily: each step adds the page that minimizes
+//      sum over strides s of  sum over slices of count[s][slice]^2 / (lines per page at s)^2
+// i.e., the (weighted) variance of the per-slice counts of the pages chosen so far, so every
+// prefix of the array is balanced as well as the whole.  Each step looks at SF_ALLOC_CANDIDATES
+// pages of the pool (all of them if the pool is smaller, else a fixed-seed random sample), so the
+// selection costs O(n * SF_ALLOC_CANDIDATES * 16 * slices).  The chosen pages are moved in order
+// into a reserved, 2MiB-aligned virtual range with mremap(), which keeps the huge pages intact,
+// and the rest of the pool is unmapped.
+//
+// The quality of a set of pages is reported as in sf_conflict.c: for each stride with at least
+// SF_ALLOC_MIN_LINES_PER_SLICE lines per slice, the count of the busiest slice divided by the
+// mean, and the worst ratio over those strides.  If the greedy choice has a worse ratio than the
+// first n pages of the pool, the first n pages are kept.
+//
+// mmap(), munmap() and mremap() are called through syscall(), so that the library can be used
+// inside the LD_PRELOAD shim (sf_alloc_preload.c), which replaces mmap() and munmap().
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "slice_hash.h"
+#include "sf_alloc.h"
+
+#ifndef MIN
+#define MIN(x,y) ((x)<(y)?(x):(y))
+#endif
+#ifndef MAX
+#define MAX(x,y) ((x)>(y)?(x):(y))
+#endif
+
+#define SF_ALLOC_MAX_BLOCKS 1024        // live allocations
+#define SF_ALLOC_MAX_SLICES 64
+#define SF_ALLOC_CANDIDATES 256
+#define SF_ALLOC_MIN_LINES_PER_SLICE 256
+#define SF_ALLOC_DEFAULT_POOL_FACTOR 1.5
+#define PAGEMAP_PRESENT (1UL << 63)
+#define PAGEMAP_PFN_MASK 0x007fffffffffffffUL
+
+// interfaces for va2pa_lib.c
+int open_pagemap(pid_t pid);
+long get_pagemap_entries(int pagemap_fd, unsigned long va, long num_pages, unsigned long long *entries);
+
+typedef uint16_t sf_hist_t[SF_ALLOC_NUM_STRIDES][SF_ALLOC_MAX_SLICES];
+
+static struct {
+    pthread_mutex_t lock;
+    int initialized;                    // sf_alloc_init() has been called (successfully or not)
+    int have_hash;
+    slice_hash_t hash;
+    double pool_factor;
+    int pagemap_fd;
+    int verbose;
+    struct { void *p; size_t size; } blocks[SF_ALLOC_MAX_BLOCKS];
+    int num_blocks;
+} sf = { PTHREAD_MUTEX_INITIALIZER };
+
+// -----------------------------------------------------------------------------------------
+// Raw memory mapping (not through the mmap()/munmap() symbols, which the shim replaces)
+
+static void *sf_sys_mmap(size_t len, int prot)
+{
+    long r = syscall(SYS_mmap, NULL, len, prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return((r == -1) ? NULL : (void *) r);
+}
+
+static void sf_sys_munmap(void *p, size_t len)
+{
+    if (len > 0) syscall(SYS_munmap, p, len);
+}
+
+// Map num_pages 2MiB pages at a 2MiB-aligned address
+static char *sf_map_aligned(long num_pages, int prot)
+{
+    size_t len = num_pages * SF_ALLOC_PAGE;
+    char *raw = (char *) sf_sys_mmap(len + SF_ALLOC_PAGE, prot);
+    char *p;
+
+    if (raw == NULL) return(NULL);
+    p = (char *) (((uintptr_t) raw + SF_ALLOC_PAGE - 1) & ~(SF_ALLOC_PAGE - 1));
+    sf_sys_munmap(raw, p - raw);
+    sf_sys_munmap(p + len, raw + SF_ALLOC_PAGE - p);
+    return(p);
+}
+
+static double sf_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return((double) ts.tv_sec + 1.0e-9 * (double) ts.tv_nsec);
+}
+
+// -----------------------------------------------------------------------------------------
+int sf_alloc_init(const char *config, const char *results_dir, double pool_factor)
+{
+    int rc = 0;
+
+    pthread_mutex_lock(&sf.lock);
+    if (sf.have_hash) slice_hash_free(&sf.hash);
+    sf.initialized = 1;
+    sf.have_hash = 0;
+    sf.pool_factor = (pool_factor >= 1.0) ? pool_factor : SF_ALLOC_DEFAULT_POOL_FACTOR;
+    sf.verbose = getenv("SF_ALLOC_VERBOSE") != NULL;
+    if (config == NULL || config[0] == '\0') {
+        fprintf(stderr,"WARNING: sf_alloc: no hash configuration -- allocations are not conflict-aware\n");
+        rc = 1;
+    } else if (slice_hash_load(&sf.hash, (results_dir != NULL) ? results_dir : "Results", config) != 0) {
+        rc = 1;
+    } else if (sf.hash.num_slices > SF_ALLOC_MAX_SLICES) {
+        fprintf(stderr,"ERROR: sf_alloc: %s has %d slices, more than %d\n",config,sf.hash.num_slices,SF_ALLOC_MAX_SLICES);
+        slice_hash_free(&sf.hash);
+        rc = 1;
+    } else {
+        sf.have_hash = 1;
+    }
+    if (sf.pagemap_fd <= 0) sf.pagemap_fd = open_pagemap(0);
+    pthread_mutex_unlock(&sf.lock);
+    return(rc);
+}
+
+static void sf_alloc_init_from_env(void)
+{
+    const char *factor = getenv("SF_ALLOC_POOL_FACTOR");
+
+    sf_alloc_init(getenv("SF_ALLOC_CONFIG"), getenv("SF_ALLOC_RESULTS"), (factor != NULL) ? atof(factor) : 0.0);
+}
+
+// -----------------------------------------------------------------------------------------
+// Per-slice counts of the lines at the multiples of each stride in the 2MiB page at va.
+// Returns 1 if the page is a transparent huge page, 0 if not, -1 if a physical address is missing.
+static int sf_page_histogram(const char *va, sf_hist_t hist, uint64_t *paddr, int8_t *slices)
+{
+    static unsigned long long entries[512];
+    long i, j;
+    int s, tz, huge;
+
+    if (get_pagemap_entries(sf.pagemap_fd, (unsigned long) va, 512, entries) != 512) return(-1);
+    huge = ((entries[0] & PAGEMAP_PFN_MASK) & 511) == 0;
+    for (j=0; j<512; j++) {
+        if (!(entries[j] & PAGEMAP_PRESENT) || (entries[j] & PAGEMAP_PFN_MASK) == 0) return(-1);
+        if ((entries[j] & PAGEMAP_PFN_MASK) != (entries[0] & PAGEMAP_PFN_MASK) + j) huge = 0;
+        for (i=0; i<64; i++) paddr[j*64 + i] = ((entries[j] & PAGEMAP_PFN_MASK) << 12) + 64*i;
+    }
+    slice_hash_slices_of(&sf.hash, paddr, slices, 32768);
+    memset(hist, 0, sizeof(sf_hist_t));
+    for (i=0; i<32768; i++) {
+        tz = (i == 0) ? SF_ALLOC_NUM_STRIDES-1 : MIN(__builtin_ctzl(i), SF_ALLOC_NUM_STRIDES-1);
+        for (s=0; s<=tz; s++) hist[s][slices[i]]++;
+    }
+    return(huge);
+}
+
+// Worst busiest-slice/mean ratio over the strides with enough lines, and that stride
+static double sf_worst_ratio(long count[SF_ALLOC_NUM_STRIDES][SF_ALLOC_MAX_SLICES], long num_pages, int *worst_stride)
+{
+    double mean, ratio, worst = 1.0;
+    long max_count;
+    int s, slice;
+
+    *worst_stride = 0;
+    for (s=0; s<SF_ALLOC_NUM_STRIDES; s++) {
+        mean = (double) num_pages * (double) (32768 >> s) / (double) sf.hash.num_slices;
+        if (mean < SF_ALLOC_MIN_LINES_PER_SLICE) continue;
+        max_count = 0;
+        for (slice=0; slice<sf.hash.num_slices; slice++) max_count = MAX(max_count, count[s][slice]);
+        ratio = (double) max_count / mean;
+        if (ratio > worst) {
+            worst = ratio;
+            *worst_stride = s;
+        }
+    }
+    return(worst);
+}
+
+static void sf_register(void *p, size_t size)
+{
+    sf.blocks[sf.num_blocks].p = p;
+    sf.blocks[sf.num_blocks].size = size;
+    sf.num_blocks++;
+}
+
+// Plain 2MiB-aligned memory on transparent huge pages (no hash, or no physical addresses)
+static void *sf_alloc_plain(long n, sf_alloc_stats_t *stats)
+{
+    char *p = sf_map_aligned(n, PROT_READ | PROT_WRITE);
+
+    if (p == NULL) return(NULL);
+    madvise(p, n * SF_ALLOC_PAGE, MADV_HUGEPAGE);
+    sf_register(p, n * SF_ALLOC_PAGE);
+    stats->selected = 0;
+    return(p);
+}
+
+// Choose n of the pool_pages pages greedily -- order[k] is the pool page placed k-th
+static void sf_select(sf_hist_t *hist, long pool_pages, long n, long *order, long count[SF_ALLOC_NUM_STRIDES][SF_ALLOC_MAX_SLICES])
+{
+    double w[SF_ALLOC_NUM_STRIDES], *self, cost, best_cost;
+    long *remaining, num_remaining = pool_pages, k, c, best, j;
+    uint64_t rng = 0x9e3779b97f4a7c15UL;
+    int s, slice, num_slices = sf.hash.num_slices;
+
+    self = (double *) malloc(pool_pages * sizeof(double));
+    remaining = (long *) malloc(pool_pages * sizeof(long));
+    for (s=0; s<SF_ALLOC_NUM_STRIDES; s++) w[s] = 1.0 / ((double) (32768 >> s) * (double) (32768 >> s));
+    for (j=0; j<pool_pages; j++) {
+        remaining[j] = j;
+        self[j] = 0.0;
+        for (s=0; s<SF_ALLOC_NUM_STRIDES; s++) {
+            for (slice=0; slice<num_slices; slice++) self[j] += w[s] * hist[j][s][slice] * hist[j][s][slice];
+        }
+    }
+    memset(count, 0, SF_ALLOC_NUM_STRIDES * SF_ALLOC_MAX_SLICES * sizeof(long));
+    for (k=0; k<n; k++) {
+        best = 0;
+        best_cost = 1.0e300;
+        for (c=0; c<MIN(num_remaining, SF_ALLOC_CANDIDATES); c++) {
+            if (num_remaining > SF_ALLOC_CANDIDATES) {           // sample without replacement into remaining[0..c]
+                rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+                j = c + (long) (rng % (uint64_t) (num_remaining - c));
+                long t = remaining[c]; remaining[c] = remaining[j]; remaining[j] = t;
+            }
+            j = remaining[c];
+            cost = self[j];
+            for (s=0; s<SF_ALLOC_NUM_STRIDES; s++) {
+                double dot = 0.0;
+                for (slice=0; slice<num_slices; slice++) dot += (double) count[s][slice] * hist[j][s][slice];
+                cost += 2.0 * w[s] * dot;
+            }
+            if (cost < best_cost) {
+                best_cost = cost;
+                best = c;
+            }
+        }
+        j = remaining[best];
+        order[k] = j;
+        remaining[best] = remaining[--num_remaining];
+        for (s=0; s<SF_ALLOC_NUM_STRIDES; s++) {
+            for (slice=0; slice<num_slices; slice++) count[s][slice] += hist[j][s][slice];
+        }
+    }
+    free(self);
+    free(remaining);
+}
+
+void *sf_alloc(size_t bytes, sf_alloc_stats_t *stats)
+{
+    static long first_count[SF_ALLOC_NUM_STRIDES][SF_ALLOC_MAX_SLICES], count[SF_ALLOC_NUM_STRIDES][SF_ALLOC_MAX_SLICES];
+    sf_alloc_stats_t local;
+    sf_hist_t *hist = NULL;
+    uint64_t *paddr = NULL;
+    int8_t *slices = NULL;
+    long n, pool_pages, j, k, *order = NULL;
+    char *pool = NULL, *target = NULL, *result = NULL;
+    int rc, s, slice;
+    double t0 = sf_seconds();
+
+    if (stats == NULL) stats = &local;
+    memset(stats, 0, sizeof(*stats));
+    if (bytes == 0) return(NULL);
+    n = (long) ((bytes + SF_ALLOC_PAGE - 1) / SF_ALLOC_PAGE);
+    stats->pages = n;
+
+    if (!sf.initialized) sf_alloc_init_from_env();
+    pthread_mutex_lock(&sf.lock);
+    if (sf.num_blocks == SF_ALLOC_MAX_BLOCKS) {
+        fprintf(stderr,"ERROR: sf_alloc: more than %d live allocations\n",SF_ALLOC_MAX_BLOCKS);
+        goto done;
+    }
+    if (!sf.have_hash || sf.pagemap_fd < 0) {
+        result = (char *) sf_alloc_plain(n, stats);
+        goto done;
+    }
+
+    // the pool: mapped, advised for huge pages, and faulted in by writing every 4KiB page
+    pool_pages = MAX(n + 1, (long) (sf.pool_factor * n + 0.999));
+    pool = sf_map_aligned(pool_pages, PROT_READ | PROT_WRITE);
+    hist = (sf_hist_t *) malloc(pool_pages * sizeof(sf_hist_t));
+    order = (long *) malloc(n * sizeof(long));
+    paddr = (uint64_t *) malloc(32768 * sizeof(uint64_t));
+    slices = (int8_t *) malloc(32768 + SLICE_HASH_TABLE_PAD);
+    if (pool == NULL || hist == NULL || order == NULL || paddr == NULL || slices == NULL) {
+        fprintf(stderr,"ERROR: sf_alloc: out of memory for a pool of %ld 2MiB pages\n",pool_pages);
+        if (pool != NULL) sf_sys_munmap(pool, pool_pages * SF_ALLOC_PAGE);
+        goto done;
+    }
+    stats->pool_pages = pool_pages;
+    madvise(pool, pool_pages * SF_ALLOC_PAGE, MADV_HUGEPAGE);
+    for (j=0; j<pool_pages * (long) (SF_ALLOC_PAGE / 4096); j++) pool[j*4096] = 0;
+
+    for (j=0; j<pool_pages; j++) {
+        rc = sf_page_histogram(pool + j*SF_ALLOC_PAGE, hist[j], paddr, slices);
+        if (rc < 0) {                   // no physical addresses (not root): use the first n pages as they are
+            if (sf.verbose) fprintf(stderr,"INFO: sf_alloc: physical addresses not available -- plain huge page allocation\n");
+            sf_sys_munmap(pool + n*SF_ALLOC_PAGE, (pool_pages - n) * SF_ALLOC_PAGE);
+            sf_register(pool, n * SF_ALLOC_PAGE);
+            result = pool;
+            goto done;
+        }
+        stats->huge_pages += rc;
+    }
+
+    // the first n pages of the pool are what an ordinary allocation would have received
+    memset(first_count, 0, sizeof(first_count));
+    for (j=0; j<n; j++) {
+        for (s=0; s<SF_ALLOC_NUM_STRIDES; s++) {
+            for (slice=0; slice<sf.hash.num_slices; slice++) first_count[s][slice] += hist[j][s][slice];
+        }
+    }
+    stats->ratio_first = sf_worst_ratio(first_count, n, &s);
+    sf_select(hist, pool_pages, n, order, count);
+    stats->ratio_selected = sf_worst_ratio(count, n, &stats->worst_stride);
+    if (stats->ratio_selected > stats->ratio_first) {  // the greedy choice is no better by the reported measure
+        for (k=0; k<n; k++) order[k] = k;
+        stats->ratio_selected = sf_worst_ratio(first_count, n, &stats->worst_stride);
+    }
+
+    // move the chosen pages into a contiguous range, and release the rest of the pool
+    target = sf_map_aligned(n, PROT_NONE);
+    if (target == NULL) {
+        fprintf(stderr,"ERROR: sf_alloc: cannot reserve %ld 2MiB pages of address space\n",n);
+        sf_sys_munmap(pool, pool_pages * SF_ALLOC_PAGE);
+        goto done;
+    }
+    for (k=0; k<n; k++) {
+        if (syscall(SYS_mremap, pool + order[k]*SF_ALLOC_PAGE, SF_ALLOC_PAGE, SF_ALLOC_PAGE,
+                    MREMAP_MAYMOVE | MREMAP_FIXED, target + k*SF_ALLOC_PAGE) == -1) {
+            fprintf(stderr,"ERROR: sf_alloc: mremap of page %ld failed: %s\n",k,strerror(errno));
+            sf_sys_munmap(pool, pool_pages * SF_ALLOC_PAGE);
+            sf_sys_munmap(target, n * SF_ALLOC_PAGE);
+            goto done;
+        }
+    }
+    sf_sys_munmap(pool, pool_pages * SF_ALLOC_PAGE);
+    sf_register(target, n * SF_ALLOC_PAGE);
+    stats->selected = 1;
+    result = target;
+
+done:
+    stats->seconds = sf_seconds() - t0;
+    if (result != NULL && sf.verbose) {
+        if (stats->selected) {
+            fprintf(stderr,"INFO: sf_alloc: %ld pages at %p chosen from %ld (%ld huge) in %f seconds, worst ratio %.3f -> %.3f (stride %lu)\n",
+                    n,result,stats->pool_pages,stats->huge_pages,stats->seconds,stats->ratio_first,stats->ratio_selected,64UL << stats->worst_stride);
+        } else {
+            fprintf(stderr,"INFO: sf_alloc: %ld pages at %p, not conflict-aware\n",n,result);
+        }
+    }
+    pthread_mutex_unlock(&sf.lock);
+    free(hist);
+    free(order);
+    free(paddr);
+    free(slices);
+    return(result);
+}
+
+size_t sf_alloc_size(const void *p)
+{
+    size_t size = 0;
+    int i;
+
+    if (((uintptr_t) p & (SF_ALLOC_PAGE - 1)) != 0 || __atomic_load_n(&sf.num_blocks, __ATOMIC_RELAXED) == 0) return(0);
+    pthread_mutex_lock(&sf.lock);
+    for (i=0; i<sf.num_blocks; i++) {
+        if (sf.blocks[i].p == p) size = sf.blocks[i].size;
+    }
+    pthread_mutex_unlock(&sf.lock);
+    return(size);
+}
+
+// 1 if [lo, hi) overlaps a block (2 if it lies strictly inside one, which splits it), else 0
+static int sf_overlap(uintptr_t lo, uintptr_t hi)
+{
+    uintptr_t b, e;
+    int i, overlap = 0;
+
+    for (i=0; i<sf.num_blocks; i++) {
+        b = (uintptr_t) sf.blocks[i].p;
+        e = b + sf.blocks[i].size;
+        if (lo > b && hi < e) return(2);
+        if (hi > b && lo < e) overlap = 1;
+    }
+    return(overlap);
+}
+
+// Remove [lo, hi) from the blocks it overlaps -- the caller holds the lock and has checked the slots
+static void sf_forget(uintptr_t lo, uintptr_t hi)
+{
+    uintptr_t b, e;
+    int i;
+
+    for (i=sf.num_blocks-1; i>=0; i--) {
+        b = (uintptr_t) sf.blocks[i].p;
+        e = b + sf.blocks[i].size;
+        if (hi <= b || lo >= e) continue;
+        if (lo <= b && hi >= e) {                   // the whole block
+            sf.blocks[i] = sf.blocks[--sf.num_blocks];
+        } else if (lo <= b) {                       // its head
+            sf.blocks[i].p = (void *) hi;
+            sf.blocks[i].size = e - hi;
+        } else {                                    // its tail, or the middle
+            sf.blocks[i].size = lo - b;
+            if (hi < e) sf_register((void *) hi, e - hi);
+        }
+    }
+}
+
+int sf_unmap(void *addr, size_t length)
+{
+    uintptr_t lo = (uintptr_t) addr, hi = lo + ((length + 4095) & ~4095UL);
+    int rc;
+
+    if (__atomic_load_n(&sf.num_blocks, __ATOMIC_RELAXED) == 0) return((int) syscall(SYS_munmap, addr, length));
+    pthread_mutex_lock(&sf.lock);
+    // a block unmapped in the middle needs a second slot -- check before anything is unmapped
+    if (sf_overlap(lo, hi) == 2 && sf.num_blocks == SF_ALLOC_MAX_BLOCKS) {
+        pthread_mutex_unlock(&sf.lock);
+        errno = ENOMEM;
+        return(-1);
+    }
+    rc = (int) syscall(SYS_munmap, addr, length);
+    if (rc == 0) sf_forget(lo, hi);
+    pthread_mutex_unlock(&sf.lock);
+    return(rc);
+}
+
+void *sf_remap(void *old_addr, size_t old_size, size_t new_size, int flags, void *new_addr)
+{
+    uintptr_t lo = (uintptr_t) old_addr, hi = lo + ((old_size + 4095) & ~4095UL);
+    uintptr_t new_lo = (uintptr_t) new_addr, new_hi = new_lo + ((new_size + 4095) & ~4095UL);
+    int old_overlap, new_overlap = 0, keep_old = 0;
+    long r;
+
+    if (__atomic_load_n(&sf.num_blocks, __ATOMIC_RELAXED) == 0) {
+        return((void *) syscall(SYS_mremap, old_addr, old_size, new_size, flags, new_addr));
+    }
+#ifdef MREMAP_DONTUNMAP
+    keep_old = (flags & MREMAP_DONTUNMAP) != 0;
+#endif
+    pthread_mutex_lock(&sf.lock);
+    old_overlap = keep_old ? 0 : sf_overlap(lo, hi);
+    if (flags & MREMAP_FIXED) new_overlap = sf_overlap(new_lo, new_hi);     // replaced by the move
+    // each split needs a slot, and the moved range one more -- check before anything is remapped
+    if (sf.num_blocks + (old_overlap == 2) + (new_overlap == 2) + (old_overlap != 0) > SF_ALLOC_MAX_BLOCKS) {
+        pthread_mutex_unlock(&sf.lock);
+        errno = ENOMEM;
+        return(MAP_FAILED);
+    }
+    r = syscall(SYS_mremap, old_addr, old_size, new_size, flags, new_addr);
+    if (r != -1) {
+        if (new_overlap) sf_forget(new_lo, new_hi);
+        if (old_overlap) {
+            sf_forget(lo, hi);
+            sf_register((void *) r, (new_size + 4095) & ~4095UL);
+        }
+    }
+    pthread_mutex_unlock(&sf.lock);
+    return((void *) r);                 // -1 is MAP_FAILED
+}
+
+int sf_free(void *p)
+{
+    int i, rc = -1;
+
+    if (((uintptr_t) p & (SF_ALLOC_PAGE - 1)) != 0 || __atomic_load_n(&sf.num_blocks, __ATOMIC_RELAXED) == 0) return(-1);
+    pthread_mutex_lock(&sf.lock);
+    for (i=0; i<sf.num_blocks; i++) {
+        if (sf.blocks[i].p == p) {
+            sf_sys_munmap(p, sf.blocks[i].size);
+            sf.blocks[i] = sf.blocks[--sf.num_blocks];
+            rc = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sf.lock);
+    return(rc);
+}
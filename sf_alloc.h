@@ -0,0 +1,64 @@
+// sf_alloc.h -- conflict-aware allocation of large arrays on 2MiB pages (sf_alloc.c)
+//
+// The slices of the lines of a contiguous array depend on which physical 2MiB pages back it, and
+// some combinations of pages concentrate the lines touched at some strides on a few L3 slices
+// (and their Snoop Filters).  sf_alloc() over-allocates a pool of 2MiB pages, looks up their
+// physical addresses in /proc/self/pagemap, picks the set of pages that spreads the lines most
+// evenly over the slices according to the hash tables in Results/, moves those pages into one
+// contiguous virtual range with mremap(), and returns the rest of the pool to the kernel.
+//
+// The library needs the physical addresses, so the process must have CAP_SYS_ADMIN (run as
+// root).  Without them, or without a hash configuration, sf_alloc() returns ordinary 2MiB-aligned
+// memory on transparent huge pages, and sets stats->selected to 0.
+//
+// libsfalloc_preload.so (sf_alloc_preload.c) applies this to the large malloc/calloc/realloc,
+// posix_memalign/aligned_alloc/memalign and anonymous mmap calls of an unmodified program:
+//     SF_ALLOC_CONFIG=SKX_24 LD_PRELOAD=./libsfalloc_preload.so ./xhpl
+
+#ifndef SF_ALLOC_H
+#define SF_ALLOC_H
+
+#include <stddef.h>
+
+#define SF_ALLOC_PAGE (2UL << 20)
+#define SF_ALLOC_NUM_STRIDES 16         // strides 64 Bytes, 128 Bytes, ..., 2MiB
+
+typedef struct sf_alloc_stats {
+    long pages;                         // 2MiB pages in the allocation
+    long pool_pages;                    // 2MiB pages over-allocated to choose from
+    long huge_pages;                    // pages of the pool backed by a transparent huge page
+    int selected;                       // 1 if the pages were chosen with the hash, 0 if not
+    int worst_stride;                   // log2(stride/64) of the worst stride after selection
+    double ratio_first;                 // worst busiest-slice/mean ratio of the first pages of the pool
+    double ratio_selected;              // the same for the selected pages
+    double seconds;
+} sf_alloc_stats_t;
+
+// Load the hash tables for config (e.g., "SKX_24") from results_dir.  pool_factor is the size of
+// the pool relative to the allocation (at least 1.0; 0 for the default of 1.5).  Without a call to
+// sf_alloc_init(), the first sf_alloc() uses $SF_ALLOC_CONFIG, $SF_ALLOC_RESULTS (default
+// "Results") and $SF_ALLOC_POOL_FACTOR.  Returns 0 on success, non-zero (with a message on stderr).
+int sf_alloc_init(const char *config, const char *results_dir, double pool_factor);
+
+// Allocate bytes (rounded up to 2MiB) of zeroed memory at a 2MiB-aligned address, or NULL.
+// stats may be NULL.
+void *sf_alloc(size_t bytes, sf_alloc_stats_t *stats);
+
+// Size of the allocation starting at p, or 0 if p was not returned by sf_alloc()
+size_t sf_alloc_size(const void *p);
+
+// Release an allocation -- returns 0, or -1 if p was not returned by sf_alloc()
+int sf_free(void *p);
+
+// munmap() that keeps the allocations consistent: the parts of any allocation in [addr, addr+length)
+// are removed from it (an allocation unmapped in the middle becomes two).  Returns 0, or -1 with
+// errno set (ENOMEM if the split needs more allocation slots than there are).
+int sf_unmap(void *addr, size_t length);
+
+// mremap() that keeps the allocations consistent: the remapped part of an allocation is removed from
+// it and the new range becomes an allocation of its own (new_addr is used only with MREMAP_FIXED).
+// The new range is 2MiB-aligned only if the kernel places it so, and the pages it grows by are not
+// chosen with the hash.  Returns the new address, or MAP_FAILED with errno set.
+void *sf_remap(void *old_addr, size_t old_size, size_t new_size, int flags, void *new_addr);
+
+#endif // SF_ALLOC_H
@@ -0,0 +1,188 @@
+// sf_alloc_preload.c -- LD_PRELOAD shim that serves the large allocations of a program from sf_alloc()
+//
+// Usage: SF_ALLOC_CONFIG=SKX_24 [SF_ALLOC_RESULTS=dir] [SF_ALLOC_MIN_MB=64] [SF_ALLOC_VERBOSE=1]
+//            LD_PRELOAD=./libsfalloc_preload.so program ...
+//
+// malloc(), calloc(), realloc(), posix_memalign(), aligned_alloc(), memalign() (for alignments up
+// to 2MiB) and anonymous private read/write mmap() calls without an address hint for at least
+// SF_ALLOC_MIN_MB MiB (default 64) are served by sf_alloc() (sf_alloc.c); all other calls go to
+// the C library (__libc_malloc() etc.) or directly to the system calls.  free(), realloc() and
+// malloc_usable_size() recognize the blocks of sf_alloc() (only 2MiB-aligned pointers are looked
+// up).  munmap() goes through sf_unmap(), which trims or splits the blocks it overlaps, so a
+// partial munmap() leaves no stale block behind, and mremap() goes through sf_remap(), which
+// moves the remapped part of a block to its new address.  valloc() and pvalloc() are not
+// redirected (their memory stays with the C library).  Memory that sf_alloc()
+// allocates for its own work is never redirected (a per-thread guard prevents the recursion).
+// If sf_alloc() fails, the request falls back to the C library.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "sf_alloc.h"
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+extern void *__libc_memalign(size_t alignment, size_t size);
+static size_t (*libc_malloc_usable_size)(void *ptr);    // the C library has no __libc_ alias for it
+
+static __thread int in_sf_alloc;        // recursion guard
+static size_t min_bytes;                // 0 until the first large request reads SF_ALLOC_MIN_MB
+
+static int sf_eligible(size_t bytes)
+{
+    const char *env;
+
+    if (in_sf_alloc) return(0);
+    if (min_bytes == 0) {
+        env = getenv("SF_ALLOC_MIN_MB");
+        min_bytes = ((env != NULL && atol(env) > 0) ? (size_t) atol(env) : 64) << 20;
+    }
+    return(bytes >= min_bytes);
+}
+
+static void *sf_try_alloc(size_t bytes)
+{
+    void *p;
+
+    in_sf_alloc = 1;
+    p = sf_alloc(bytes, NULL);
+    in_sf_alloc = 0;
+    return(p);
+}
+
+void *malloc(size_t size)
+{
+    void *p;
+
+    if (sf_eligible(size) && (p = sf_try_alloc(size)) != NULL) return(p);
+    return(__libc_malloc(size));
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    if (size != 0 && nmemb > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return(NULL);
+    }
+    if (sf_eligible(nmemb * size) && (p = sf_try_alloc(nmemb * size)) != NULL) return(p);     // already zeroed
+    return(__libc_calloc(nmemb, size));
+}
+
+// Blocks of sf_alloc() are 2MiB-aligned, which covers every alignment up to SF_ALLOC_PAGE
+void *memalign(size_t alignment, size_t size)
+{
+    void *p;
+
+    if (alignment <= SF_ALLOC_PAGE && sf_eligible(size) && (p = sf_try_alloc(size)) != NULL) return(p);
+    return(__libc_memalign(alignment, size));
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    return(memalign(alignment, size));
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *p;
+
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0 || alignment == 0) return(EINVAL);
+    p = memalign(alignment, size);
+    if (p == NULL && size != 0) return(ENOMEM);
+    *memptr = p;
+    return(0);
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL || sf_free(ptr) == 0) return;
+    __libc_free(ptr);
+}
+
+size_t malloc_usable_size(void *ptr)
+{
+    size_t (*fn)(void *);
+    size_t size;
+
+    if (ptr == NULL) return(0);
+    size = sf_alloc_size(ptr);
+    if (size != 0) return(size);
+    fn = __atomic_load_n(&libc_malloc_usable_size, __ATOMIC_RELAXED);
+    if (fn == NULL) {
+        fn = (size_t (*)(void *)) dlsym(RTLD_NEXT, "malloc_usable_size");
+        if (fn == NULL) return(0);
+        __atomic_store_n(&libc_malloc_usable_size, fn, __ATOMIC_RELAXED);
+    }
+    return(fn(ptr));
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    size_t old_size;
+    void *p;
+
+    if (ptr == NULL) return(malloc(size));
+    old_size = sf_alloc_size(ptr);
+    if (old_size == 0) {
+        if (!sf_eligible(size)) return(__libc_realloc(ptr, size));
+        p = sf_try_alloc(size);         // a C library block growing past the threshold
+        if (p == NULL) return(__libc_realloc(ptr, size));
+        memcpy(p, ptr, (malloc_usable_size(ptr) < size) ? malloc_usable_size(ptr) : size);
+        __libc_free(ptr);
+        return(p);
+    }
+    if (size <= old_size && size > old_size / 2) return(ptr);
+    p = malloc(size);
+    if (p == NULL) return(NULL);
+    memcpy(p, ptr, (size < old_size) ? size : old_size);
+    sf_free(ptr);
+    return(p);
+}
+
+void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+    long r;
+    void *p;
+
+    if (addr == NULL && (flags & (MAP_PRIVATE | MAP_ANONYMOUS)) == (MAP_PRIVATE | MAP_ANONYMOUS) && !(flags & MAP_FIXED)
+            && prot == (PROT_READ | PROT_WRITE) && sf_eligible(length) && (p = sf_try_alloc(length)) != NULL) {
+        return(p);
+    }
+    r = syscall(SYS_mmap, addr, length, prot, flags, fd, offset);
+    return((void *) r);                 // -1 is MAP_FAILED
+}
+
+int munmap(void *addr, size_t length)
+{
+    size_t size = sf_alloc_size(addr);
+
+    // the whole block (its size is the mmap() length rounded up to 2MiB)
+    if (size != 0 && length + SF_ALLOC_PAGE > size && length <= size && sf_free(addr) == 0) return(0);
+    return(sf_unmap(addr, length));
+}
+
+void *mremap(void *old_address, size_t old_size, size_t new_size, int flags, ...)
+{
+    void *new_address = NULL;
+    va_list ap;
+
+    if (flags & MREMAP_FIXED) {
+        va_start(ap, flags);
+        new_address = va_arg(ap, void *);
+        va_end(ap);
+    }
+    return(sf_remap(old_address, old_size, new_size, flags, new_address));
+}
@@ -0,0 +1,298 @@
+// sf_conflict.c -- score the L3/Snoop Filter slice conflicts of the memory of a running process
+//
+// Usage: sf_conflict.exe [-d results_dir] [-n num_worst_pages] [-s stride_bytes]... CONFIG PID [START-END ...]
+//     e.g., sf_conflict.exe SKX_24 12345 0x7f3a00000000-0x7f3c00000000
+//
+// The virtual address ranges (hexadecimal, END exclusive) default to all of the writable
+// mappings in /proc/PID/maps.  The ranges are translated through /proc/PID/pagemap in bulk
+// (get_pagemap_entries() in va2pa_lib.c), and the slice of every resident cache line is
+// computed with the batch kernels of the hash library for CONFIG (slice_hash.h).  Reading the
+// physical addresses of another process needs root (CAP_SYS_ADMIN and ptrace access).
+//
+// For each access stride -- powers of 2 from 64 Bytes to 2MiB, plus any given with -s -- the
+// lines touched by a sweep through each range at that stride (start, start+stride, ...) are
+// counted per slice.  A stride is scored when it touches at least STRIDE_MIN_LINES_PER_SLICE
+// lines per slice on average, and its conflict ratio is the count of the busiest slice divided
+// by the mean count over the slices: 1.0 is a perfectly even spread, and a ratio of r means
+// that the busiest slice (and its Snoop Filter) has to hold r times its share of the lines.
+// The conflict score of the process is the largest ratio over the scored strides.
+//
+// A second pass ranks the 2MiB virtual pages by their excess lines on the busiest slice at the
+// worst stride (lines on that slice minus the page's even share), i.e., the pages whose
+// physical placement contributes most to the conflict.  Pages are re-translated in the second
+// pass, so pages that migrate between the passes are attributed to their new frames.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include "slice_hash.h"
+
+#ifndef MIN
+#define MIN(x,y) ((x)<(y)?(x):(y))
+#endif
+#ifndef MAX
+#define MAX(x,y) ((x)>(y)?(x):(y))
+#endif
+
+#define MAX_RANGES 4096
+#define MAX_STRIDES 32
+#define MAX_SLICES 64
+#define CHUNK_PAGES 4096                // 4KiB pages translated and hashed per batch
+#define STRIDE_MIN_LINES_PER_SLICE 256
+#define PAGEMAP_PRESENT (1UL << 63)
+#define PAGEMAP_PFN_MASK 0x007fffffffffffffUL
+
+// interfaces for va2pa_lib.c
+int open_pagemap(pid_t pid);
+long get_pagemap_entries(int pagemap_fd, unsigned long va, long num_pages, unsigned long long *entries);
+
+typedef struct {
+    uint64_t start, end;                // virtual, 4KiB-aligned, end exclusive
+} range_t;
+
+typedef struct {
+    uint64_t va;                        // 2MiB virtual page
+    uint64_t paddr;                     // physical address of its first resident line
+    long lines;                         // lines touched at the worst stride
+    long hot;                           // of which on the busiest slice
+    double excess;
+} page_score_t;
+
+static range_t ranges[MAX_RANGES];
+static int num_ranges;
+static uint64_t strides[MAX_STRIDES];   // Bytes, multiples of 64
+static int num_strides;
+static long counts[MAX_STRIDES][MAX_SLICES];
+static long lines_resident, lines_absent, lines_unvalidated, pages_no_pfn;
+
+// Writable mappings of the process, from /proc/PID/maps
+static int read_maps(pid_t pid)
+{
+    char filename[64], line[512], perms[8];
+    unsigned long start, end;
+    FILE *fp;
+
+    sprintf(filename,"/proc/%d/maps",(int) pid);
+    fp = fopen(filename, "r");
+    if (fp == NULL) return(-1);
+    while (fgets(line, sizeof(line), fp) != NULL && num_ranges < MAX_RANGES) {
+        if (sscanf(line, "%lx-%lx %4s", &start, &end, perms) != 3) continue;
+        if (perms[1] != 'w' || strstr(line, "[vvar]") != NULL || strstr(line, "[vsyscall]") != NULL) continue;
+        ranges[num_ranges].start = start;
+        ranges[num_ranges].end = end;
+        num_ranges++;
+    }
+    fclose(fp);
+    return(num_ranges);
+}
+
+// Translate and hash one range, CHUNK_PAGES pages at a time.  Pass 1 counts the resident lines
+// per slice for every stride; pass 2 charges the lines of the worst stride to their 2MiB page.
+static int process_range(int pagemap_fd, slice_hash_t *h, const range_t *r, int pass, int worst, int hot,
+                         page_score_t **pages, long *num_pages, long *max_pages)
+{
+    static unsigned long long entries[CHUNK_PAGES];
+    static uint64_t paddr[CHUNK_PAGES * 64];
+    static int8_t slices[CHUNK_PAGES * 64];
+    uint64_t va, line_index, k, first_line;
+    page_score_t *p;
+    long n, got, j, i, num_lines, cur = -1;
+    int s, line;
+
+    for (va=r->start; va<r->end; va+=n*4096) {
+        n = MIN(CHUNK_PAGES, (long)((r->end - va) >> 12));
+        got = get_pagemap_entries(pagemap_fd, va, n, entries);
+        if (got < 0) return(-1);
+        if (got == 0) break;
+        n = got;
+        num_lines = 0;
+        for (j=0; j<n; j++) {
+            if (!(entries[j] & PAGEMAP_PRESENT)) {
+                lines_absent += (pass == 1) ? 64 : 0;
+                continue;
+            }
+            if ((entries[j] & PAGEMAP_PFN_MASK) == 0) {
+                pages_no_pfn += (pass == 1);
+                continue;
+            }
+            for (line=0; line<64; line++) paddr[num_lines++] = ((entries[j] & PAGEMAP_PFN_MASK) << 12) + 64*line;
+        }
+        slice_hash_slices_of(h, paddr, slices, num_lines);
+
+        // walk the resident pages again, in the same order as paddr[]
+        i = 0;
+        for (j=0; j<n; j++) {
+            if (!(entries[j] & PAGEMAP_PRESENT) || (entries[j] & PAGEMAP_PFN_MASK) == 0) continue;
+            first_line = (va + 4096*j - r->start) >> 6;         // line index of the page within the range
+            if (pass == 1) {
+                lines_resident += 64;
+                if (!slice_hash_address_validated(h, paddr[i])) lines_unvalidated += 64;
+                for (s=0; s<num_strides; s++) {
+                    k = strides[s] / 64;
+                    for (line_index = (k - first_line % k) % k; line_index < 64; line_index += k) {
+                        counts[s][slices[i + line_index]]++;
+                    }
+                }
+            } else {
+                uint64_t page_va = (va + 4096*j) & ~((1UL << 21) - 1);
+                if (cur < 0 || (*pages)[cur].va != page_va) {
+                    if (*num_pages == *max_pages) {
+                        *max_pages = MAX(2 * *max_pages, 1024);
+                        *pages = (page_score_t *) realloc(*pages, *max_pages * sizeof(page_score_t));
+                        if (*pages == NULL) return(-1);
+                    }
+                    cur = (*num_pages)++;
+                    memset(&(*pages)[cur], 0, sizeof(page_score_t));
+                    (*pages)[cur].va = page_va;
+                    (*pages)[cur].paddr = paddr[i];
+                }
+                p = &(*pages)[cur];
+                k = strides[worst] / 64;
+                for (line_index = (k - first_line % k) % k; line_index < 64; line_index += k) {
+                    p->lines++;
+                    if (slices[i + line_index] == hot) p->hot++;
+                }
+            }
+            i += 64;
+        }
+    }
+    return(0);
+}
+
+static int compare_excess(const void *a, const void *b)
+{
+    double x = ((const page_score_t *) a)->excess, y = ((const page_score_t *) b)->excess;
+    return((x < y) - (x > y));
+}
+
+int main(int argc, char *argv[])
+{
+    slice_hash_t h;
+    const char *results_dir = "Results", *config;
+    page_score_t *pages = NULL;
+    long num_pages = 0, max_pages = 0, total, max_count, j;
+    double mean, ratio, score = 0.0;
+    int pagemap_fd, opt, num_worst = 20, r, s, slice, worst = -1, hot = 0, busiest;
+    unsigned long start, end;
+    uint64_t stride;
+    pid_t pid;
+
+    for (stride=64; stride<=(1UL << 21); stride*=2) strides[num_strides++] = stride;
+    while ((opt = getopt(argc, argv, "d:n:s:")) != -1) {
+        switch (opt) {
+        case 'd':
+            results_dir = optarg;
+            break;
+        case 'n':
+            num_worst = atoi(optarg);
+            break;
+        case 's':
+            stride = strtoul(optarg, NULL, 0);
+            if (stride == 0 || stride % 64 != 0 || num_strides == MAX_STRIDES) {
+                fprintf(stderr,"ERROR: strides must be multiples of 64 Bytes, at most %d strides\n",MAX_STRIDES);
+                return(1);
+            }
+            strides[num_strides++] = stride;
+            break;
+        default:
+            optind = argc + 1;
+        }
+    }
+    if (argc - optind < 2) {
+        fprintf(stderr,"Usage: %s [-d results_dir] [-n num_worst_pages] [-s stride_bytes]... CONFIG PID [START-END ...]\n",argv[0]);
+        return(1);
+    }
+    config = argv[optind];
+    pid = (pid_t) atoi(argv[optind+1]);
+    for (r=optind+2; r<argc && num_ranges<MAX_RANGES; r++) {
+        if (sscanf(argv[r], "%lx-%lx", &start, &end) != 2 || end <= start) {
+            fprintf(stderr,"ERROR: bad address range %s -- expected START-END in hexadecimal\n",argv[r]);
+            return(1);
+        }
+        ranges[num_ranges].start = start & ~4095UL;
+        ranges[num_ranges].end = (end + 4095) & ~4095UL;
+        num_ranges++;
+    }
+    if (num_ranges == 0 && read_maps(pid) <= 0) {
+        fprintf(stderr,"ERROR: no writable mappings found in /proc/%d/maps: %s\n",(int) pid,strerror(errno));
+        return(2);
+    }
+    if (slice_hash_load(&h, results_dir, config) != 0) return(2);
+    if (h.num_slices > MAX_SLICES) {
+        fprintf(stderr,"ERROR: %s has %d slices, more than %d\n",config,h.num_slices,MAX_SLICES);
+        return(2);
+    }
+    pagemap_fd = open_pagemap(pid);
+    if (pagemap_fd == -1) {
+        fprintf(stderr,"ERROR: cannot open /proc/%d/pagemap: %s\n",(int) pid,strerror(errno));
+        return(2);
+    }
+
+    // pass 1: per-slice line counts for every stride
+    for (r=0; r<num_ranges; r++) {
+        if (process_range(pagemap_fd, &h, &ranges[r], 1, 0, 0, NULL, NULL, NULL) != 0) {
+            fprintf(stderr,"ERROR: pagemap read failed for 0x%lx-0x%lx: %s\n",ranges[r].start,ranges[r].end,strerror(errno));
+            return(3);
+        }
+    }
+    if (lines_resident == 0) {
+        fprintf(stderr,"ERROR: no resident pages with physical addresses in the ranges%s\n",
+                (pages_no_pfn > 0) ? " -- the page frame numbers are hidden, run as root" : "");
+        return(4);
+    }
+    printf("SF_CONFLICT: pid %d, %d ranges, %s hash (%d slices), %ld resident lines, %ld lines not resident\n",
+            (int) pid,num_ranges,config,h.num_slices,lines_resident,lines_absent);
+    if (lines_unvalidated > 0) {
+        printf("WARNING: %ld lines are above the validated address bit %d of the %s tables\n",lines_unvalidated,h.high_bit,config);
+    }
+    printf("STRIDE bytes lines busiest_slice busiest_count mean ratio\n");
+    for (s=0; s<num_strides; s++) {
+        total = 0;
+        max_count = 0;
+        busiest = 0;
+        for (slice=0; slice<h.num_slices; slice++) {
+            total += counts[s][slice];
+            if (counts[s][slice] > max_count) {
+                max_count = counts[s][slice];
+                busiest = slice;
+            }
+        }
+        mean = (double) total / (double) h.num_slices;
+        ratio = (double) max_count / MAX(mean, 1.0e-9);
+        printf("%lu %ld %d %ld %.1f %.3f%s\n",strides[s],total,busiest,max_count,mean,ratio,
+                (mean < STRIDE_MIN_LINES_PER_SLICE) ? " (too few lines, not scored)" : "");
+        if (mean >= STRIDE_MIN_LINES_PER_SLICE && ratio > score) {
+            score = ratio;
+            worst = s;
+            hot = busiest;
+        }
+    }
+    if (worst < 0) {
+        printf("SF_CONFLICT: too few resident lines to score any stride\n");
+        return(0);
+    }
+    printf("CONFLICT_SCORE %.3f at stride %lu Bytes (slice %d holds %.2fx its share of the lines)\n",score,strides[worst],hot,score);
+
+    // pass 2: the 2MiB pages with the most excess lines on the busiest slice at the worst stride
+    for (r=0; r<num_ranges; r++) {
+        if (process_range(pagemap_fd, &h, &ranges[r], 2, worst, hot, &pages, &num_pages, &max_pages) != 0) {
+            fprintf(stderr,"ERROR: pagemap read failed in the second pass: %s\n",strerror(errno));
+            return(3);
+        }
+    }
+    close(pagemap_fd);
+    for (j=0; j<num_pages; j++) pages[j].excess = (double) pages[j].hot - (double) pages[j].lines / (double) h.num_slices;
+    qsort(pages, num_pages, sizeof(page_score_t), compare_excess);
+    printf("WORST_PAGES virtual_2MiB_page first_paddr lines lines_on_slice_%d excess\n",hot);
+    for (j=0; j<MIN(num_worst, num_pages); j++) {
+        printf("0x%.12lx 0x%.12lx %ld %ld %.1f\n",pages[j].va,pages[j].paddr,pages[j].lines,pages[j].hot,pages[j].excess);
+    }
+    free(pages);
+    slice_hash_free(&h);
+    return(0);
+}
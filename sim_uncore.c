@@ -0,0 +1,193 @@
+// sim_uncore.c -- simulated CHA counters for running the mapper without the hardware (compiled with -DSIM_UNCORE)
+//
+// The mapper needs /dev/cpu/N/msr and real CHA counters, so its software overhead (counter reads,
+// classification, retries, map file I/O) cannot otherwise be measured or regression-tested on a
+// build machine.  In this mode the CHA counters are served through the stub back-end of
+// msr_batch.c by sim_uncore_read(), and every load/flush loop of the measurement reports the line
+// and the number of iterations to sim_uncore_probe().  The owner of each line is computed from
+// the hash tables in Results/ for SIM_UNCORE_CONFIG (e.g., "SKX_28", "ICX_40", "SPR_60"), and each
+// iteration counts one lookup at the owning CHA.  On top of that:
+//   - every CHA counts background noise, uniform in 0..2*SIM_NOISE per 1000 iterations,
+//   - with probability SIM_BURST_RATE a probe window also sees a contention burst of as many
+//     events as the probe itself at a random other CHA (the line fails the goodness tests and is
+//     retried),
+//   - the counters start SIM_COUNTER_HEADROOM events below 2^48 and wrap at 48 bits, so the
+//     wraparound handling of corrected_pmc_delta() is exercised early in the run.
+// The random numbers come from a fixed seed (SIM_SEED), so runs are reproducible.
+//
+// The CPUID signature and CHA MSR layout are those of the cha_pmon.c table entry whose hash prefix
+// matches SIM_UNCORE_CONFIG.  The buffer's 2MiB pages get synthetic physical addresses (distinct
+// 2MiB frames below 2^SIM_PADDR_BITS) instead of pagemap lookups, so no privileges are needed.
+// Each page mapped is compared with the simulated hash, and the number of lines that differ is
+// reported at the end of the run.  Only the default single-threaded mapper loop is simulated.
+
+#if defined(PER_SOCKET_WORKERS) || defined(ROLLING_BUFFER) || defined(LATENCY_ENGINE) || defined(FAST_PREFAULT)
+#error "SIM_UNCORE only simulates the default mapper loop -- it cannot be combined with PER_SOCKET_WORKERS, ROLLING_BUFFER, LATENCY_ENGINE or FAST_PREFAULT"
+#endif
+
+#include "slice_hash.h"
+#ifndef RESULTS_DIR
+#define RESULTS_DIR "Results"
+#endif
+#ifndef SIM_UNCORE_CONFIG
+#define SIM_UNCORE_CONFIG "SKX_28"
+#endif
+#ifndef SIM_NOISE
+#define SIM_NOISE 5                     // mean background events per CHA per 1000 load/flush iterations
+#endif
+#ifndef SIM_BURST_RATE
+#define SIM_BURST_RATE 0.001            // probability of a contention burst in a probe window
+#endif
+#ifndef SIM_COUNTER_HEADROOM
+#define SIM_COUNTER_HEADROOM 1000000UL  // events before the first 48-bit wraparound
+#endif
+#ifndef SIM_SEED
+#define SIM_SEED 1
+#endif
+// The map and checkpoint files of the synthetic physical addresses are SIM_PADDR_0x<paddr>.map and
+// SIM_CHECKPOINT_0x<paddr>.bin, so they never mix with (or are mistaken for) measured ones
+#define MAP_FILE_PREFIX "SIM_PADDR"
+#define CHECKPOINT_FILE_PREFIX "SIM_CHECKPOINT"
+#define FLUSHES_FILE_PREFIX "SIM_FLUSHES"
+
+#ifndef SIM_PADDR_BITS
+#define SIM_PADDR_BITS 36               // synthetic physical addresses are below 64 GiB
+#endif
+#define SIM_COUNTER_MASK ((1UL << 48) - 1)
+
+typedef struct {
+    slice_hash_t hash;
+    const cha_pmon_t *pmon;
+    const char *base;                   // the buffer, and the synthetic physical address of each of its pages
+    const uint64_t *paddr_by_page;
+    long num_pages;
+    uint64_t count[NUM_CHA_BOXES];      // events since the start of the run
+    uint32_t msr_lo;                    // cha_of_msr[msr - msr_lo]: CHA whose counter 0 is msr, -1 if none
+    int num_msr_slots;
+    int8_t *cha_of_msr;
+    uint64_t rng;
+    long probes, iterations, bursts, reads;
+    long lines_checked, lines_wrong;
+} sim_uncore_t;
+
+sim_uncore_t sim_uncore;
+
+static uint64_t sim_uncore_random(sim_uncore_t *s)
+{
+    s->rng ^= s->rng << 13;
+    s->rng ^= s->rng >> 7;
+    s->rng ^= s->rng << 17;
+    return(s->rng);
+}
+
+// CPUID signature of the table entry that matches the SIM_UNCORE_CONFIG prefix, 0 if none
+uint32_t sim_uncore_signature(const char *config)
+{
+    int i;
+    size_t len;
+
+    for (i=0; i<(int)(sizeof(cha_pmon_table)/sizeof(cha_pmon_table[0])); i++) {
+        len = strlen(cha_pmon_table[i].hash_prefix);
+        if (strncmp(config, cha_pmon_table[i].hash_prefix, len) == 0 && config[len] == '_') return(cha_pmon_table[i].signature);
+    }
+    return(0);
+}
+
+// Synthetic physical address of page j: distinct 2MiB frames, scattered over the address range
+uint64_t sim_uncore_page_paddr(long j)
+{
+    uint64_t frames = 1UL << (SIM_PADDR_BITS - 21);
+
+    return((((uint64_t) j * 0x9e3779b1UL + 1) % frames) << 21);
+}
+
+// Load the hash for SIM_UNCORE_CONFIG and set up the counter address lookup -- returns 0 on success
+int sim_uncore_init(sim_uncore_t *s, const cha_pmon_t *pmon, const void *base, const uint64_t *paddr_by_page, long num_pages)
+{
+    uint32_t msr_hi;
+    int cha;
+
+    memset(s, 0, sizeof(*s));
+    if (slice_hash_load(&s->hash, RESULTS_DIR, SIM_UNCORE_CONFIG) != 0) {
+        printf("ERROR: could not load the %s hash tables from %s for the simulated uncore\n",SIM_UNCORE_CONFIG,RESULTS_DIR);
+        return(1);
+    }
+    if (s->hash.num_slices > pmon->num_chas) {
+        printf("ERROR: %s has %d slices but %s has only %d CHAs\n",SIM_UNCORE_CONFIG,s->hash.num_slices,pmon->desc->name,pmon->num_chas);
+        return(1);
+    }
+    s->pmon = pmon;
+    s->base = (const char *) base;
+    s->paddr_by_page = paddr_by_page;
+    s->num_pages = num_pages;
+    s->rng = 0x9e3779b97f4a7c15UL * (SIM_SEED + 1);
+    s->msr_lo = pmon->ctr[0][0];
+    msr_hi = pmon->ctr[0][0];
+    for (cha=0; cha<pmon->num_chas; cha++) {
+        s->msr_lo = MIN(s->msr_lo, pmon->ctr[cha][0]);
+        msr_hi = MAX(msr_hi, pmon->ctr[cha][0]);
+    }
+    s->num_msr_slots = msr_hi - s->msr_lo + 1;
+    s->cha_of_msr = (int8_t *) malloc(s->num_msr_slots);
+    if (s->cha_of_msr == NULL) return(1);
+    memset(s->cha_of_msr, -1, s->num_msr_slots);
+    for (cha=0; cha<pmon->num_chas; cha++) s->cha_of_msr[pmon->ctr[cha][0] - s->msr_lo] = (int8_t) cha;
+    printf("INFO: simulated uncore: %s hash on %s CHA MSRs, noise %d per 1000, burst rate %g, counters wrap after %lu events, seed %d\n",
+            SIM_UNCORE_CONFIG,pmon->desc->name,SIM_NOISE,SIM_BURST_RATE,SIM_COUNTER_HEADROOM,SIM_SEED);
+    return(0);
+}
+
+// msr_batch.c stub read function: the current value of a simulated CHA counter 0
+uint64_t sim_uncore_read(void *arg, int cpu, uint32_t msr)
+{
+    sim_uncore_t *s = (sim_uncore_t *) arg;
+    int cha;
+
+    s->reads++;
+    if (msr < s->msr_lo || msr - s->msr_lo >= (uint32_t) s->num_msr_slots) return(0);
+    cha = s->cha_of_msr[msr - s->msr_lo];
+    if (cha < 0) return(0);
+    return(((1UL << 48) - SIM_COUNTER_HEADROOM + s->count[cha]) & SIM_COUNTER_MASK);
+}
+
+// The mapper loaded and flushed the line at virtual address line iterations times
+void sim_uncore_probe(sim_uncore_t *s, const void *line, long iterations)
+{
+    long offset = (const char *) line - s->base;
+    uint64_t paddr, noise_range;
+    int cha, owner;
+
+    if (offset < 0 || offset >= s->num_pages * MYPAGESIZE) return;
+    paddr = s->paddr_by_page[offset / MYPAGESIZE] + (offset % MYPAGESIZE);
+    owner = slice_hash_slice_of(&s->hash, paddr);
+    s->count[owner] += iterations;
+    noise_range = (2 * SIM_NOISE * iterations) / 1000 + 1;
+    for (cha=0; cha<s->pmon->num_chas; cha++) s->count[cha] += sim_uncore_random(s) % noise_range;
+    if ((double)(sim_uncore_random(s) >> 11) / 9007199254740992.0 < SIM_BURST_RATE) {
+        cha = (owner + 1 + (int)(sim_uncore_random(s) % (s->pmon->num_chas - 1))) % s->pmon->num_chas;
+        s->count[cha] += iterations;
+        s->bursts++;
+    }
+    s->probes++;
+    s->iterations += iterations;
+}
+
+// Compare the map of one page with the simulated hash -- returns the number of lines that differ
+long sim_uncore_check_page(sim_uncore_t *s, uint64_t paddr, const int8_t *cha)
+{
+    long line_number, wrong = 0;
+
+    for (line_number=0; line_number<32768; line_number++) {
+        if (cha[line_number] != slice_hash_slice_of(&s->hash, paddr + 64*line_number)) wrong++;
+    }
+    s->lines_checked += 32768;
+    s->lines_wrong += wrong;
+    return(wrong);
+}
+
+void sim_uncore_report(sim_uncore_t *s)
+{
+    printf("SIM_UNCORE: %ld probe windows, %ld load/flush iterations, %ld contention bursts, %ld counter reads\n",
+            s->probes,s->iterations,s->bursts,s->reads);
+    printf("SIM_UNCORE: %ld of %ld lines mapped differ from the %s hash\n",s->lines_wrong,s->lines_checked,SIM_UNCORE_CONFIG);
+}
@@ -0,0 +1,216 @@
+// slice_hash.c -- load the Results/ hash tables and evaluate address-to-slice lookups.
+// See slice_hash.h for a description of the hash and of the lookup strategy.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "slice_hash.h"
+
+#define SLICE_HASH_NO_PAGE (~0UL)       // memo tag that can never match a real 2MiB page number
+
+// -----------------------------------------------------------------------------------------
+// Read a BaseSequence file: one decimal slice number per line, length must be a power of 2.
+static int read_base_sequence(slice_hash_t *h, const char *filename)
+{
+    FILE *fp;
+    long n, capacity;
+    int value, max_slice;
+    int8_t *seq, *tmp;
+
+    fp = fopen(filename,"r");
+    if (!fp) {
+        fprintf(stderr,"ERROR: slice_hash_load() failed to open %s: %s\n",filename,strerror(errno));
+        return(1);
+    }
+    capacity = 1024;
+    seq = (int8_t *) malloc(capacity);
+    n = 0;
+    max_slice = -1;
+    while (seq != NULL && fscanf(fp,"%d",&value) == 1) {
+        if (value < 0 || value > 127) {
+            fprintf(stderr,"ERROR: slice number %d at line %ld of %s is out of range\n",value,n+1,filename);
+            free(seq);
+            fclose(fp);
+            return(1);
+        }
+        if (n == capacity) {
+            capacity *= 2;
+            tmp = (int8_t *) realloc(seq, capacity);
+            if (tmp == NULL) free(seq);
+            seq = tmp;
+            if (seq == NULL) break;
+        }
+        seq[n++] = (int8_t) value;
+        if (value > max_slice) max_slice = value;
+    }
+    fclose(fp);
+    if (seq == NULL) {
+        fprintf(stderr,"ERROR: slice_hash_load() out of memory reading %s\n",filename);
+        return(1);
+    }
+    if (n == 0 || (n & (n-1)) != 0) {
+        fprintf(stderr,"ERROR: %s contains %ld entries -- expected a power of 2\n",filename,n);
+        free(seq);
+        return(1);
+    }
+    // pad the table so that vector gathers may load a full word starting at the last entry
+    tmp = (int8_t *) realloc(seq, n + SLICE_HASH_TABLE_PAD);
+    if (tmp == NULL) {
+        fprintf(stderr,"ERROR: slice_hash_load() out of memory reading %s\n",filename);
+        free(seq);
+        return(1);
+    }
+    seq = tmp;
+    memset(&seq[n], 0, SLICE_HASH_TABLE_PAD);
+    h->base_sequence = seq;
+    h->base_len = n;
+    h->base_bits = __builtin_ctzl((unsigned long) n);
+    h->num_slices = max_slice + 1;
+    return(0);
+}
+
+// -----------------------------------------------------------------------------------------
+// Read a PermSelectMasks file: "low_bit high_bit" on the first line, then 14 hex masks.
+static int read_perm_select_masks(slice_hash_t *h, const char *filename)
+{
+    FILE *fp;
+    int i;
+    unsigned long long mask;
+
+    fp = fopen(filename,"r");
+    if (!fp) {
+        fprintf(stderr,"ERROR: slice_hash_load() failed to open %s: %s\n",filename,strerror(errno));
+        return(1);
+    }
+    if (fscanf(fp,"%d %d",&h->low_bit,&h->high_bit) != 2) {
+        fprintf(stderr,"ERROR: %s does not start with the low and high address bits\n",filename);
+        fclose(fp);
+        return(1);
+    }
+    h->num_masks_used = 0;
+    for (i=0; i<SLICE_HASH_NUM_MASKS; i++) {
+        if (fscanf(fp,"%llx",&mask) != 1) {
+            fprintf(stderr,"ERROR: %s contains only %d of the %d permutation select masks\n",filename,i,SLICE_HASH_NUM_MASKS);
+            fclose(fp);
+            return(1);
+        }
+        h->masks[i] = (uint64_t) mask;
+        if (mask != 0) h->num_masks_used = i+1;
+    }
+    fclose(fp);
+    return(0);
+}
+
+// -----------------------------------------------------------------------------------------
+int slice_hash_load(slice_hash_t *h, const char *results_dir, const char *config)
+{
+    char filename[4096];
+    long i, lowmask;
+    int j;
+    uint64_t paddr;
+
+    memset(h, 0, sizeof(*h));
+    snprintf(h->config, sizeof(h->config), "%s", config);
+
+    snprintf(filename, sizeof(filename), "%s/BaseSequence_%s-slice.tbl", results_dir, config);
+    if (read_base_sequence(h, filename) != 0) return(1);
+    snprintf(filename, sizeof(filename), "%s/PermSelectMasks_%s-slice.tbl", results_dir, config);
+    if (read_perm_select_masks(h, filename) != 0) {
+        slice_hash_free(h);
+        return(1);
+    }
+
+    // consistency checks between the two files
+    if (h->low_bit != 6 + h->base_bits) {
+        fprintf(stderr,"WARNING: %s masks start at bit %d, but the base sequence length %ld implies bit %d\n",
+                config,h->low_bit,h->base_len,6+h->base_bits);
+    }
+    if (h->num_masks_used > h->base_bits) {
+        fprintf(stderr,"ERROR: %s has %d permutation select masks but only %d base sequence index bits\n",
+                config,h->num_masks_used,h->base_bits);
+        slice_hash_free(h);
+        return(1);
+    }
+    for (j=0; j<SLICE_HASH_NUM_MASKS; j++) {
+        if (h->masks[j] & ((1UL << h->low_bit) - 1)) {
+            fprintf(stderr,"ERROR: %s mask %d (0x%lx) uses address bits below bit %d\n",config,j,h->masks[j],h->low_bit);
+            slice_hash_free(h);
+            return(1);
+        }
+        h->page_masks[j] = h->masks[j] & ~((1UL << SLICE_HASH_PAGE_SHIFT) - 1);
+    }
+
+    // Precompute the permutation contribution of mask bits below the 2MiB boundary.
+    // These only exist for the short base sequences (e.g., 16 entries for SKX_16).
+    h->low_perm_bits = (h->low_bit < SLICE_HASH_PAGE_SHIFT) ? SLICE_HASH_PAGE_SHIFT - h->low_bit : 0;
+    h->low_perm = (uint16_t *) calloc((1L << h->low_perm_bits) + SLICE_HASH_TABLE_PAD/sizeof(uint16_t), sizeof(uint16_t));
+    if (h->low_perm == NULL) {
+        fprintf(stderr,"ERROR: slice_hash_load() out of memory\n");
+        slice_hash_free(h);
+        return(1);
+    }
+    lowmask = (1L << SLICE_HASH_PAGE_SHIFT) - 1;
+    for (i=0; i<(1L << h->low_perm_bits); i++) {
+        paddr = ((uint64_t) i << h->low_bit) & lowmask;
+        h->low_perm[i] = (uint16_t) slice_hash_perm_of(h, paddr);
+    }
+
+    for (j=0; j<SLICE_HASH_MEMO_ENTRIES; j++) {
+        h->memo_page[j] = SLICE_HASH_NO_PAGE;
+        h->memo_perm[j] = 0;
+    }
+    return(0);
+}
+
+void slice_hash_free(slice_hash_t *h)
+{
+    free(h->base_sequence);
+    free(h->low_perm);
+    h->base_sequence = NULL;
+    h->low_perm = NULL;
+}
+
+// -----------------------------------------------------------------------------------------
+uint32_t slice_hash_perm_of(const slice_hash_t *h, uint64_t paddr)
+{
+    uint32_t perm = 0;
+    int j;
+
+    for (j=0; j<h->num_masks_used; j++) {
+        perm |= (uint32_t) __builtin_parityl(paddr & h->masks[j]) << j;
+    }
+    return(perm);
+}
+
+uint32_t slice_hash_page_perm(const slice_hash_t *h, uint64_t paddr)
+{
+    uint32_t perm = 0;
+    int j;
+
+    for (j=0; j<h->num_masks_used; j++) {
+        perm |= (uint32_t) __builtin_parityl(paddr & h->page_masks[j]) << j;
+    }
+    return(perm);
+}
+
+int slice_hash_slice_of(slice_hash_t *h, uint64_t paddr)
+{
+    uint64_t page = paddr >> SLICE_HASH_PAGE_SHIFT;
+    int slot = page & (SLICE_HASH_MEMO_ENTRIES - 1);
+    uint32_t index;
+
+    if (h->memo_page[slot] != page) {
+        h->memo_page[slot] = page;
+        h->memo_perm[slot] = (uint16_t) slice_hash_page_perm(h, paddr);
+    }
+    index = (uint32_t) (paddr >> 6) & (uint32_t) (h->base_len - 1);
+    index ^= h->memo_perm[slot];
+    index ^= h->low_perm[(paddr >> h->low_bit) & ((1UL << h->low_perm_bits) - 1)];
+    return(h->base_sequence[index]);
+}
+
+int slice_hash_address_validated(const slice_hash_t *h, uint64_t paddr)
+{
+    return( (paddr >> (h->high_bit + 1)) == 0 );
+}
@@ -0,0 +1,101 @@
+// slice_hash.h -- evaluate the Intel address-to-L3/CHA-slice hash from the tables in Results/
+//
+// The hash (see Results/README.md and the technical report referenced there) consists of
+// a "base sequence" of slice numbers for the 2^n cache lines starting at physical address
+// zero, repeated for each 2^n-line block of memory with a binary permutation applied.
+// Bit j of the permutation is the XOR-reduction (parity) of the physical address ANDed
+// with permutation select mask j, and the permutation is applied by XOR'ing it into the
+// cache line index within the block:
+//
+//      slice = BaseSequence[ ((paddr >> 6) & (len-1)) ^ perm(paddr) ]
+//
+// The permutation select masks only touch address bits at or above 6+log2(len), so the
+// part of the permutation that comes from bits 21 and above is constant over a 2MiB page.
+// slice_hash_slice_of() memoizes that part for recently used 2MiB pages and gets the
+// contribution of any mask bits below bit 21 from a small precomputed table, so a
+// lookup costs a memo probe plus two table loads.
+
+#ifndef SLICE_HASH_H
+#define SLICE_HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SLICE_HASH_NUM_MASKS 14         // every PermSelectMasks_*.tbl file has 14 masks (unused ones are 0x0)
+#define SLICE_HASH_PAGE_SHIFT 21        // memoize the permutation at 2MiB granularity
+#define SLICE_HASH_MEMO_ENTRIES 64      // direct-mapped memo of recently used 2MiB pages (power of 2)
+#define SLICE_HASH_TABLE_PAD 8          // zero bytes after base_sequence[] and low_perm[], so 64-bit gathers stay in bounds
+
+typedef struct slice_hash {
+    char config[32];                    // e.g., "SKX_28", "ICX_40", "SPR_60"
+    int num_slices;                     // largest slice number in the base sequence + 1
+    long base_len;                      // number of entries in the base sequence (power of 2)
+    int base_bits;                      // log2(base_len)
+    int low_bit;                        // lowest address bit used by the permutation select masks
+    int high_bit;                       // highest address bit for which the masks have been validated
+    uint64_t masks[SLICE_HASH_NUM_MASKS];
+    int num_masks_used;                 // index of the highest non-zero mask + 1
+    int8_t *base_sequence;              // base_len slice numbers
+    uint64_t page_masks[SLICE_HASH_NUM_MASKS];  // the part of each mask at or above SLICE_HASH_PAGE_SHIFT
+    int low_perm_bits;                  // number of mask bits in [low_bit, SLICE_HASH_PAGE_SHIFT)
+    uint16_t *low_perm;                 // permutation contribution of address bits [low_bit, SLICE_HASH_PAGE_SHIFT)
+    uint64_t memo_page[SLICE_HASH_MEMO_ENTRIES];    // 2MiB page number held in each memo slot
+    uint16_t memo_perm[SLICE_HASH_MEMO_ENTRIES];    // permutation contribution of that page's address bits
+} slice_hash_t;
+
+// Load BaseSequence_<config>-slice.tbl and PermSelectMasks_<config>-slice.tbl from results_dir.
+// Returns 0 on success, non-zero (with a message on stderr) on failure.
+int slice_hash_load(slice_hash_t *h, const char *results_dir, const char *config);
+void slice_hash_free(slice_hash_t *h);
+
+// Full permutation for a physical address, computed directly from the masks (no memo).
+uint32_t slice_hash_perm_of(const slice_hash_t *h, uint64_t paddr);
+// Permutation contribution of the address bits at or above SLICE_HASH_PAGE_SHIFT.
+uint32_t slice_hash_page_perm(const slice_hash_t *h, uint64_t paddr);
+
+// Slice owning the cache line containing paddr.  Updates the 2MiB-page memo, so a
+// slice_hash_t must not be shared between threads without external locking.
+int slice_hash_slice_of(slice_hash_t *h, uint64_t paddr);
+
+// Non-zero if every address bit set in paddr is at or below the validated high_bit.
+int slice_hash_address_validated(const slice_hash_t *h, uint64_t paddr);
+
+// -----------------------------------------------------------------------------------------
+// Batch interface (slice_hash_batch.c)
+// slice_hash_slices_of() writes the slice of each of the n physical addresses.  It does not
+// touch the memo, so a single slice_hash_t can be used by many threads concurrently.
+// The kernel is chosen from the CPUID feature flags on first use, or explicitly with
+// slice_hash_select_kernel() (which falls back to scalar if the kernel is not supported).
+#define SLICE_HASH_KERNEL_AUTO 0
+#define SLICE_HASH_KERNEL_SCALAR 1
+#define SLICE_HASH_KERNEL_AVX2 2
+#define SLICE_HASH_KERNEL_AVX512 3
+#define SLICE_HASH_KERNEL_GFNI 4
+
+void slice_hash_slices_of(const slice_hash_t *h, const uint64_t *paddr, int8_t *slices, size_t n);
+int slice_hash_select_kernel(int kernel);
+int slice_hash_kernel_supported(int kernel);
+int slice_hash_current_kernel();
+const char *slice_hash_kernel_name(int kernel);
+
+// -----------------------------------------------------------------------------------------
+// Inverse interface (slice_hash_inverse.c)
+// Streams the physical addresses of all cache lines in [lo, hi) owned by one slice, in
+// ascending order, at a cost proportional to the number of lines produced.
+typedef struct slice_hash_iter {
+    const slice_hash_t *h;
+    int slice;
+    uint64_t lo, hi;                    // byte range being enumerated (lo rounded up to a line)
+    uint32_t *positions;                // indices of this slice in the base sequence (ascending)
+    long num_positions;
+    uint64_t block;                     // base address of the current base_len-line block
+    uint32_t *buf;                      // line indices within the current block, ascending
+    long count, next;                   // number of entries in buf, and the next one to return
+} slice_hash_iter_t;
+
+int slice_hash_iter_init(slice_hash_iter_t *it, const slice_hash_t *h, int slice, uint64_t lo, uint64_t hi);
+int slice_hash_iter_next(slice_hash_iter_t *it, uint64_t *paddr);     // 1 if *paddr was set, 0 at the end
+size_t slice_hash_iter_fill(slice_hash_iter_t *it, uint64_t *paddr, size_t max);
+void slice_hash_iter_free(slice_hash_iter_t *it);
+
+#endif // SLICE_HASH_H
@@ -0,0 +1,420 @@
+// slice_hash_batch.c -- compute the slices of large arrays of physical addresses.
+//
+// slice_hash_slices_of() evaluates the hash for n addresses without using (or updating)
+// the 2MiB-page memo in the slice_hash_t, so one loaded hash can be shared by many threads,
+// each working on its own part of the address array.
+//
+// Kernels (selected at runtime from the CPUID feature flags):
+//   GFNI    -- AVX-512BW + GFNI: the 14 parities are computed as an 8x8 GF(2) matrix-vector
+//              product (VGF2P8AFFINEQB) on each address byte that the masks touch, followed
+//              by an XOR-reduction of the bytes.  This takes one instruction per active address
+//              byte for each group of 8 permutation bits, independent of the number of masks.
+//   AVX512  -- AVX-512F (+VPOPCNTDQ if available): one AND + POPCNT (or a shift/XOR fold)
+//              per permutation select mask, 8 addresses per instruction.  With VPOPCNTDQ
+//              this is the default (bench_slice_hash.exe compares the kernels on a given processor).
+//   AVX2    -- shift/XOR fold to 4 bits and a VPSHUFB parity lookup, 4 addresses per instruction.
+//   SCALAR  -- per-address evaluation using the 2MiB-page permutation of the previous address
+//              when it falls in the same page (the common case for arrays of cache lines).
+// The vector kernels have the same fast path: when all addresses in a vector lie in one
+// 2MiB page, the page permutation is computed once (and kept for the next vector), and only
+// the permutation bits from address bits below 2MiB (if any) are gathered from low_perm[].
+// The parity methods above are used for vectors that span 2MiB pages.
+// The selected kernel (function and id together) is published with a single atomic store, so
+// concurrent first calls, or a call racing with slice_hash_select_kernel(), are safe.
+// All vector kernels gather the slice numbers from the base sequence with 64-bit gathers,
+// which is why the base sequence and low_perm tables are padded by SLICE_HASH_TABLE_PAD bytes.
+//
+// A carry-less multiply (VPCLMULQDQ) formulation of the parity was considered, but it produces
+// one parity bit per 64x64 multiply and is strictly slower than the GFNI affine transform on
+// every processor that supports both.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+#include "slice_hash.h"
+
+typedef void (*slice_hash_kernel_fn)(const slice_hash_t *h, const uint64_t *paddr, int8_t *slices, size_t n);
+
+// -----------------------------------------------------------------------------------------
+// Scalar fallback -- also used for the tails of the vector kernels
+static void slices_of_scalar(const slice_hash_t *h, const uint64_t *paddr, int8_t *slices, size_t n)
+{
+    size_t i;
+    uint64_t page, last_page = ~0UL;
+    uint32_t page_perm = 0, index;
+    uint32_t lenmask = (uint32_t) (h->base_len - 1);
+    uint64_t lowmask = (1UL << h->low_perm_bits) - 1;
+
+    for (i=0; i<n; i++) {
+        page = paddr[i] >> SLICE_HASH_PAGE_SHIFT;
+        if (page != last_page) {
+            page_perm = slice_hash_page_perm(h, paddr[i]);
+            last_page = page;
+        }
+        index = ((uint32_t) (paddr[i] >> 6) & lenmask) ^ page_perm;
+        index ^= h->low_perm[(paddr[i] >> h->low_bit) & lowmask];
+        slices[i] = h->base_sequence[index];
+    }
+}
+
+// -----------------------------------------------------------------------------------------
+// AVX2: 4 addresses per iteration
+__attribute__((target("avx2")))
+static void slices_of_avx2(const slice_hash_t *h, const uint64_t *paddr, int8_t *slices, size_t n)
+{
+    size_t i;
+    int j;
+    const __m256i nibble_parity = _mm256_setr_epi8(0,1,1,0,1,0,0,1,1,0,0,1,0,1,1,0,
+                                                   0,1,1,0,1,0,0,1,1,0,0,1,0,1,1,0);
+    const __m256i low_nibble = _mm256_set1_epi64x(0xf);
+    const __m256i lenmask = _mm256_set1_epi64x(h->base_len - 1);
+    const __m256i lowpermmask = _mm256_set1_epi64x((1L << h->low_perm_bits) - 1);
+    // moves byte 0 of each qword to bytes 0,1 of its 128-bit lane
+    const __m256i pack_bytes = _mm256_setr_epi8(0,8,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+                                                0,8,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1);
+    __m256i masks[SLICE_HASH_NUM_MASKS];
+    __m256i x, t, perm, index, s;
+    int nm = h->num_masks_used;
+    uint64_t last_page = ~0UL;
+    uint32_t last_perm = 0;
+    uint16_t lo, hi;
+
+    for (j=0; j<nm; j++) masks[j] = _mm256_set1_epi64x(h->masks[j]);
+
+    for (i=0; i+4<=n; i+=4) {
+        x = _mm256_loadu_si256((const __m256i *) &paddr[i]);
+        t = _mm256_srli_epi64(x, SLICE_HASH_PAGE_SHIFT);
+        if (_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(t, _mm256_set1_epi64x(paddr[i] >> SLICE_HASH_PAGE_SHIFT)))) == 0xf) {
+            // all 4 addresses in one 2MiB page: page permutation plus the table for the bits below 2MiB
+            if ((paddr[i] >> SLICE_HASH_PAGE_SHIFT) != last_page) {
+                last_page = paddr[i] >> SLICE_HASH_PAGE_SHIFT;
+                last_perm = slice_hash_page_perm(h, paddr[i]);
+            }
+            perm = _mm256_set1_epi64x(last_perm);
+            if (h->low_perm_bits > 0) {
+                t = _mm256_and_si256(_mm256_srli_epi64(x, h->low_bit), lowpermmask);
+                t = _mm256_i64gather_epi64((const long long *) h->low_perm, t, 2);
+                perm = _mm256_xor_si256(perm, _mm256_and_si256(t, _mm256_set1_epi64x(0xffff)));
+            }
+        } else {
+            perm = _mm256_setzero_si256();
+            for (j=0; j<nm; j++) {
+                t = _mm256_and_si256(x, masks[j]);
+                t = _mm256_xor_si256(t, _mm256_srli_epi64(t, 32));
+                t = _mm256_xor_si256(t, _mm256_srli_epi64(t, 16));
+                t = _mm256_xor_si256(t, _mm256_srli_epi64(t, 8));
+                t = _mm256_xor_si256(t, _mm256_srli_epi64(t, 4));
+                t = _mm256_shuffle_epi8(nibble_parity, _mm256_and_si256(t, low_nibble));
+                perm = _mm256_or_si256(perm, _mm256_slli_epi64(t, j));
+            }
+        }
+        index = _mm256_and_si256(_mm256_srli_epi64(x, 6), lenmask);
+        index = _mm256_xor_si256(index, perm);
+        s = _mm256_i64gather_epi64((const long long *) h->base_sequence, index, 1);
+        s = _mm256_shuffle_epi8(s, pack_bytes);
+        lo = (uint16_t) _mm256_extract_epi16(s, 0);
+        hi = (uint16_t) _mm256_extract_epi16(s, 8);
+        memcpy(&slices[i], &lo, 2);
+        memcpy(&slices[i+2], &hi, 2);
+    }
+    slices_of_scalar(h, &paddr[i], &slices[i], n-i);
+}
+
+// -----------------------------------------------------------------------------------------
+// AVX-512: 8 addresses per iteration.  The three AVX-512 kernels share the same-page fast
+// path and the final gather, and differ only in how they compute the general permutation.
+
+// Permutation for 8 addresses that all lie in the 2MiB page of paddr0
+__attribute__((target("avx512f")))
+static inline __m512i same_page_perm_512(const slice_hash_t *h, __m512i x, uint32_t page_perm)
+{
+    __m512i perm, t;
+
+    perm = _mm512_set1_epi64(page_perm);
+    if (h->low_perm_bits > 0) {
+        t = _mm512_and_si512(_mm512_srli_epi64(x, h->low_bit), _mm512_set1_epi64((1L << h->low_perm_bits) - 1));
+        t = _mm512_i64gather_epi64(t, (const void *) h->low_perm, 2);
+        perm = _mm512_xor_si512(perm, _mm512_and_si512(t, _mm512_set1_epi64(0xffff)));
+    }
+    return(perm);
+}
+
+__attribute__((target("avx512f")))
+static inline int same_page_512(__m512i x, uint64_t paddr0)
+{
+    return(_mm512_cmpeq_epi64_mask(_mm512_srli_epi64(x, SLICE_HASH_PAGE_SHIFT),
+                _mm512_set1_epi64(paddr0 >> SLICE_HASH_PAGE_SHIFT)) == 0xff);
+}
+
+__attribute__((target("avx512f")))
+static inline void gather_store_512(const slice_hash_t *h, __m512i x, __m512i perm, int8_t *slices)
+{
+    __m512i index, s;
+
+    index = _mm512_and_si512(_mm512_srli_epi64(x, 6), _mm512_set1_epi64(h->base_len - 1));
+    index = _mm512_xor_si512(index, perm);
+    s = _mm512_i64gather_epi64(index, (const void *) h->base_sequence, 1);
+    _mm_storel_epi64((__m128i *) slices, _mm512_cvtepi64_epi8(s));
+}
+
+// The loop shared by the AVX-512 kernels; GENERAL_PERM(x) computes the full permutation
+#define AVX512_SLICES_LOOP(GENERAL_PERM)                                            \
+    for (i=0; i+8<=n; i+=8) {                                                       \
+        x = _mm512_loadu_si512((const void *) &paddr[i]);                           \
+        if (same_page_512(x, paddr[i])) {                                           \
+            if ((paddr[i] >> SLICE_HASH_PAGE_SHIFT) != last_page) {                 \
+                last_page = paddr[i] >> SLICE_HASH_PAGE_SHIFT;                      \
+                last_perm = slice_hash_page_perm(h, paddr[i]);                      \
+            }                                                                       \
+            perm = same_page_perm_512(h, x, last_perm);                             \
+        } else {                                                                    \
+            perm = GENERAL_PERM(x);                                                 \
+        }                                                                           \
+        gather_store_512(h, x, perm, &slices[i]);                                   \
+    }                                                                               \
+    slices_of_scalar(h, &paddr[i], &slices[i], n-i);
+
+__attribute__((target("avx512f")))
+static inline __m512i parity_fold_512(__m512i t)
+{
+    t = _mm512_xor_si512(t, _mm512_srli_epi64(t, 32));
+    t = _mm512_xor_si512(t, _mm512_srli_epi64(t, 16));
+    t = _mm512_xor_si512(t, _mm512_srli_epi64(t, 8));
+    t = _mm512_xor_si512(t, _mm512_srli_epi64(t, 4));
+    t = _mm512_xor_si512(t, _mm512_srli_epi64(t, 2));
+    t = _mm512_xor_si512(t, _mm512_srli_epi64(t, 1));
+    return(_mm512_and_si512(t, _mm512_set1_epi64(1)));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512i fold_perm_512(const __m512i *masks, int nm, __m512i x)
+{
+    __m512i perm = _mm512_setzero_si512();
+    int j;
+
+    for (j=0; j<nm; j++) {
+        perm = _mm512_or_si512(perm, _mm512_slli_epi64(parity_fold_512(_mm512_and_si512(x, masks[j])), j));
+    }
+    return(perm);
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static inline __m512i popcnt_perm_512(const __m512i *masks, int nm, __m512i x)
+{
+    __m512i perm = _mm512_setzero_si512();
+    __m512i t;
+    int j;
+
+    for (j=0; j<nm; j++) {
+        t = _mm512_and_si512(_mm512_popcnt_epi64(_mm512_and_si512(x, masks[j])), _mm512_set1_epi64(1));
+        perm = _mm512_or_si512(perm, _mm512_slli_epi64(t, j));
+    }
+    return(perm);
+}
+
+__attribute__((target("avx512f")))
+static void slices_of_avx512(const slice_hash_t *h, const uint64_t *paddr, int8_t *slices, size_t n)
+{
+    size_t i;
+    int j;
+    __m512i masks[SLICE_HASH_NUM_MASKS];
+    __m512i x, perm;
+    int nm = h->num_masks_used;
+    uint64_t last_page = ~0UL;
+    uint32_t last_perm = 0;
+
+    for (j=0; j<nm; j++) masks[j] = _mm512_set1_epi64(h->masks[j]);
+#define FOLD_PERM(x) fold_perm_512(masks, nm, x)
+    AVX512_SLICES_LOOP(FOLD_PERM)
+#undef FOLD_PERM
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static void slices_of_avx512_popcnt(const slice_hash_t *h, const uint64_t *paddr, int8_t *slices, size_t n)
+{
+    size_t i;
+    int j;
+    __m512i masks[SLICE_HASH_NUM_MASKS];
+    __m512i x, perm;
+    int nm = h->num_masks_used;
+    uint64_t last_page = ~0UL;
+    uint32_t last_perm = 0;
+
+    for (j=0; j<nm; j++) masks[j] = _mm512_set1_epi64(h->masks[j]);
+#define POPCNT_PERM(x) popcnt_perm_512(masks, nm, x)
+    AVX512_SLICES_LOOP(POPCNT_PERM)
+#undef POPCNT_PERM
+}
+
+// -----------------------------------------------------------------------------------------
+// GFNI + AVX-512BW: 8 addresses per iteration.
+// For address byte b, the 8x8 bit matrix A_b has row i = byte b of mask (8*g + i), where g
+// selects permutation bits 0-7 or 8-13.  VGF2P8AFFINEQB computes A_b times every byte of
+// the address; only byte b is kept, and the 8 kept bytes are then XOR-reduced to one byte.
+// VGF2P8AFFINEQB takes output bit i from matrix byte (7-i).
+static uint64_t gfni_matrix(const slice_hash_t *h, int group, int b)
+{
+    uint64_t matrix = 0;
+    int i, m;
+
+    for (i=0; i<8; i++) {
+        m = 8*group + i;
+        if (m < SLICE_HASH_NUM_MASKS) {
+            matrix |= ((h->masks[m] >> (8*b)) & 0xffUL) << (8*(7-i));
+        }
+    }
+    return(matrix);
+}
+
+typedef struct {
+    int num_groups;                     // 1 if at most 8 masks are used, else 2
+    int num_active;                     // number of address bytes touched by any mask
+    __m512i matrix[2][8];
+    __mmask64 keep_byte[8];
+} gfni_setup_t;
+
+__attribute__((target("avx512f,avx512bw,gfni")))
+static inline __m512i gfni_perm_512(const gfni_setup_t *g, __m512i x)
+{
+    __m512i acc[2];
+    int grp, k;
+
+    for (grp=0; grp<g->num_groups; grp++) {
+        acc[grp] = _mm512_setzero_si512();
+        for (k=0; k<g->num_active; k++) {
+            acc[grp] = _mm512_mask_mov_epi8(acc[grp], g->keep_byte[k], _mm512_gf2p8affine_epi64_epi8(x, g->matrix[grp][k], 0));
+        }
+        acc[grp] = _mm512_xor_si512(acc[grp], _mm512_srli_epi64(acc[grp], 32));
+        acc[grp] = _mm512_xor_si512(acc[grp], _mm512_srli_epi64(acc[grp], 16));
+        acc[grp] = _mm512_xor_si512(acc[grp], _mm512_srli_epi64(acc[grp], 8));
+        acc[grp] = _mm512_and_si512(acc[grp], _mm512_set1_epi64(0xff));
+    }
+    if (g->num_groups == 2) return(_mm512_or_si512(acc[0], _mm512_slli_epi64(acc[1], 8)));
+    return(acc[0]);
+}
+
+__attribute__((target("avx512f,avx512bw,gfni")))
+static void slices_of_gfni(const slice_hash_t *h, const uint64_t *paddr, int8_t *slices, size_t n)
+{
+    size_t i;
+    int b, grp, k;
+    gfni_setup_t g;
+    __m512i x, perm;
+    uint64_t allmasks = 0;
+    uint64_t last_page = ~0UL;
+    uint32_t last_perm = 0;
+
+    for (k=0; k<SLICE_HASH_NUM_MASKS; k++) allmasks |= h->masks[k];
+    g.num_groups = (h->num_masks_used > 8) ? 2 : 1;
+    g.num_active = 0;
+    for (b=0; b<8; b++) {
+        if ((allmasks >> (8*b)) & 0xffUL) {
+            for (grp=0; grp<g.num_groups; grp++) g.matrix[grp][g.num_active] = _mm512_set1_epi64(gfni_matrix(h, grp, b));
+            g.keep_byte[g.num_active] = (__mmask64) (0x0101010101010101UL << b);
+            g.num_active++;
+        }
+    }
+#define GFNI_PERM(x) gfni_perm_512(&g, x)
+    AVX512_SLICES_LOOP(GFNI_PERM)
+#undef GFNI_PERM
+}
+
+// -----------------------------------------------------------------------------------------
+// Runtime dispatch
+
+static const char *kernel_names[] = { "auto", "scalar", "avx2", "avx512", "gfni" };
+
+typedef struct {
+    int kernel;
+    slice_hash_kernel_fn fn;
+} kernel_entry_t;
+
+static const kernel_entry_t kernel_scalar = { SLICE_HASH_KERNEL_SCALAR, slices_of_scalar };
+static const kernel_entry_t kernel_avx2 = { SLICE_HASH_KERNEL_AVX2, slices_of_avx2 };
+static const kernel_entry_t kernel_avx512 = { SLICE_HASH_KERNEL_AVX512, slices_of_avx512 };
+static const kernel_entry_t kernel_avx512_popcnt = { SLICE_HASH_KERNEL_AVX512, slices_of_avx512_popcnt };
+static const kernel_entry_t kernel_gfni = { SLICE_HASH_KERNEL_GFNI, slices_of_gfni };
+
+static const kernel_entry_t *selected = NULL;   // written and read only with __atomic builtins
+
+static const kernel_entry_t *selected_entry()
+{
+    const kernel_entry_t *e = __atomic_load_n(&selected, __ATOMIC_ACQUIRE);
+
+    if (e == NULL) {
+        slice_hash_select_kernel(SLICE_HASH_KERNEL_AUTO);
+        e = __atomic_load_n(&selected, __ATOMIC_ACQUIRE);
+    }
+    return(e);
+}
+
+int slice_hash_kernel_supported(int kernel)
+{
+    __builtin_cpu_init();
+    switch (kernel) {
+        case SLICE_HASH_KERNEL_AUTO:
+        case SLICE_HASH_KERNEL_SCALAR:
+            return(1);
+        case SLICE_HASH_KERNEL_AVX2:
+            return(__builtin_cpu_supports("avx2"));
+        case SLICE_HASH_KERNEL_AVX512:
+            return(__builtin_cpu_supports("avx512f"));
+        case SLICE_HASH_KERNEL_GFNI:
+            return(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("gfni"));
+        default:
+            return(0);
+    }
+}
+
+int slice_hash_select_kernel(int kernel)
+{
+    const kernel_entry_t *e;
+
+    // AVX-512 with VPOPCNTQ is preferred over GFNI when both are available
+    if (kernel == SLICE_HASH_KERNEL_AUTO) {
+        if (slice_hash_kernel_supported(SLICE_HASH_KERNEL_AVX512) && __builtin_cpu_supports("avx512vpopcntdq")) {
+            kernel = SLICE_HASH_KERNEL_AVX512;
+        } else {
+            for (kernel=SLICE_HASH_KERNEL_GFNI; kernel>SLICE_HASH_KERNEL_SCALAR; kernel--) {
+                if (slice_hash_kernel_supported(kernel)) break;
+            }
+        }
+    }
+    if (!slice_hash_kernel_supported(kernel)) {
+        fprintf(stderr,"WARNING: slice_hash kernel %s is not supported on this processor, using scalar\n",slice_hash_kernel_name(kernel));
+        kernel = SLICE_HASH_KERNEL_SCALAR;
+    }
+    switch (kernel) {
+        case SLICE_HASH_KERNEL_AVX2:
+            e = &kernel_avx2;
+            break;
+        case SLICE_HASH_KERNEL_AVX512:
+            e = __builtin_cpu_supports("avx512vpopcntdq") ? &kernel_avx512_popcnt : &kernel_avx512;
+            break;
+        case SLICE_HASH_KERNEL_GFNI:
+            e = &kernel_gfni;
+            break;
+        default:
+            e = &kernel_scalar;
+            break;
+    }
+    __atomic_store_n(&selected, e, __ATOMIC_RELEASE);
+    return(kernel);
+}
+
+const char *slice_hash_kernel_name(int kernel)
+{
+    if (kernel < 0 || kernel > SLICE_HASH_KERNEL_GFNI) return("unknown");
+    return(kernel_names[kernel]);
+}
+
+int slice_hash_current_kernel()
+{
+    return(selected_entry()->kernel);
+}
+
+void slice_hash_slices_of(const slice_hash_t *h, const uint64_t *paddr, int8_t *slices, size_t n)
+{
+    selected_entry()->fn(h, paddr, slices, n);
+}
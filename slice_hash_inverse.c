@@ -0,0 +1,146 @@
+// slice_hash_inverse.c -- enumerate the cache lines in a physical address range owned by one slice
+//
+// Every block of base_len cache lines (2^low_bit Bytes, aligned) uses a single permutation p,
+// since the permutation select masks only use address bits at or above low_bit.  The line
+// at index i of the block belongs to slice k exactly when BaseSequence[i ^ p] == k, so the
+// lines owned by slice k in that block are { pos ^ p : pos in positions_k }, where positions_k
+// is the (fixed) list of indices of k in the base sequence.  The iterator computes p once per
+// block and emits those lines directly, so no evaluation is spent on lines of other slices.
+//
+// Lines are produced in ascending address order.  Within a block, ascending order of pos ^ p
+// is obtained from the sorted positions_k by walking them as an implicit binary trie from the
+// top index bit down, visiting the "1" half first at each bit where p has a 1.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "slice_hash.h"
+
+// Append (positions[lo..hi-1] ^ p) in ascending order to out[]; all entries of positions[lo..hi-1]
+// agree in the index bits above "bit" and are sorted.
+static void emit_xor_sorted(const uint32_t *positions, long lo, long hi, int bit, uint32_t p, uint32_t *out, long *nout)
+{
+    long split, a, b;
+    int first;
+
+    if (lo >= hi) return;
+    if (bit < 0 || hi - lo == 1) {
+        for (a=lo; a<hi; a++) out[(*nout)++] = positions[a] ^ p;
+        return;
+    }
+    // entries with this bit clear come first in the sorted list
+    a = lo;
+    b = hi;
+    while (a < b) {
+        split = (a + b) / 2;
+        if (positions[split] & (1U << bit)) b = split; else a = split + 1;
+    }
+    split = a;
+    first = (p >> bit) & 1;
+    if (first == 0) {
+        emit_xor_sorted(positions, lo, split, bit-1, p, out, nout);
+        emit_xor_sorted(positions, split, hi, bit-1, p, out, nout);
+    } else {
+        emit_xor_sorted(positions, split, hi, bit-1, p, out, nout);
+        emit_xor_sorted(positions, lo, split, bit-1, p, out, nout);
+    }
+}
+
+// Fill the buffer with the line indices of the current block that lie in [lo,hi)
+static void load_block(slice_hash_iter_t *it)
+{
+    const slice_hash_t *h = it->h;
+    uint64_t block_bytes = 64UL * (uint64_t) h->base_len;
+    uint64_t line;
+    uint32_t p;
+    long i, k;
+
+    it->count = 0;
+    it->next = 0;
+    p = slice_hash_perm_of(h, it->block);
+    emit_xor_sorted(it->positions, 0, it->num_positions, h->base_bits-1, p, it->buf, &it->count);
+    // only the first and last blocks of the range can be partially covered
+    if (it->block < it->lo || it->block + block_bytes > it->hi) {
+        k = 0;
+        for (i=0; i<it->count; i++) {
+            line = it->block + 64UL * it->buf[i];
+            if (line >= it->lo && line < it->hi) it->buf[k++] = it->buf[i];
+        }
+        it->count = k;
+    }
+}
+
+int slice_hash_iter_init(slice_hash_iter_t *it, const slice_hash_t *h, int slice, uint64_t lo, uint64_t hi)
+{
+    long i, n;
+
+    memset(it, 0, sizeof(*it));
+    if (slice < 0 || slice >= h->num_slices) {
+        fprintf(stderr,"ERROR: slice_hash_iter_init() slice %d is not in 0..%d for %s\n",slice,h->num_slices-1,h->config);
+        return(1);
+    }
+    it->h = h;
+    it->slice = slice;
+    it->lo = (lo + 63) & ~63UL;         // first whole cache line in the range
+    it->hi = hi;
+
+    n = 0;
+    for (i=0; i<h->base_len; i++) if (h->base_sequence[i] == slice) n++;
+    it->positions = (uint32_t *) malloc((n+1) * sizeof(uint32_t));
+    it->buf = (uint32_t *) malloc((n+1) * sizeof(uint32_t));
+    if (it->positions == NULL || it->buf == NULL) {
+        fprintf(stderr,"ERROR: slice_hash_iter_init() out of memory\n");
+        slice_hash_iter_free(it);
+        return(1);
+    }
+    n = 0;
+    for (i=0; i<h->base_len; i++) if (h->base_sequence[i] == slice) it->positions[n++] = (uint32_t) i;
+    it->num_positions = n;
+
+    it->block = it->lo & ~(64UL * (uint64_t) h->base_len - 1);
+    if (it->lo < it->hi && n > 0) load_block(it);
+    return(0);
+}
+
+void slice_hash_iter_free(slice_hash_iter_t *it)
+{
+    free(it->positions);
+    free(it->buf);
+    it->positions = NULL;
+    it->buf = NULL;
+}
+
+// advance to the next block that has lines in the range -- returns 0 at the end of the range
+static int next_block(slice_hash_iter_t *it)
+{
+    uint64_t block_bytes = 64UL * (uint64_t) it->h->base_len;
+
+    while (it->next >= it->count) {
+        if (it->block + block_bytes >= it->hi || it->block + block_bytes < it->block) return(0);
+        it->block += block_bytes;
+        load_block(it);
+    }
+    return(1);
+}
+
+int slice_hash_iter_next(slice_hash_iter_t *it, uint64_t *paddr)
+{
+    if (it->num_positions == 0 || !next_block(it)) return(0);
+    *paddr = it->block + 64UL * it->buf[it->next++];
+    return(1);
+}
+
+size_t slice_hash_iter_fill(slice_hash_iter_t *it, uint64_t *paddr, size_t max)
+{
+    size_t n = 0;
+    long i, stop;
+
+    if (it->num_positions == 0) return(0);
+    while (n < max && next_block(it)) {
+        stop = it->next + (long) (max - n);
+        if (stop > it->count) stop = it->count;
+        for (i=it->next; i<stop; i++) paddr[n++] = it->block + 64UL * it->buf[i];
+        it->next = stop;
+    }
+    return(n);
+}
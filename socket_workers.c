@@ -0,0 +1,307 @@
+// socket_workers.c -- map cache lines on all sockets concurrently (compiled with -DPER_SOCKET_WORKERS)
+//
+// discover_topology() reads the sockets (physical_package_id of each online logical processor)
+// and the NUMA nodes with memory from sysfs.  Each node is assigned to the socket whose CHAs home
+// its memory: the socket of its processors, or -- for nodes without processors, such as HBM in
+// flat mode or CXL memory -- the socket of the nearest node with processors (sysfs "distance").
+//
+// run_socket_workers() starts one thread per socket.  Each worker pins itself to the first
+// processor of its socket, reads only that socket's CHA counters (cha_counts[socket] and
+// msr_fd[socket]), and for each node of its socket allocates a buffer of WORKER_PAGES_PER_NODE
+// 2MiB pages bound to that node (raw mbind() system call, so libnuma is not needed), maps up to
+// PAGES_MAPPED new pages from it, and writes the PADDR_*.map files.  Because every worker only
+// loads from memory homed on its own socket, the workers do not disturb each other's counts.
+
+#ifndef WORKER_PAGES_PER_NODE
+#define WORKER_PAGES_PER_NODE 64        // 128 MiB per NUMA node
+#endif
+#define MAX_NUMA_NODES 64
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+#ifndef MPOL_MF_STRICT
+#define MPOL_MF_STRICT (1<<0)
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE (1<<1)
+#endif
+
+typedef struct {
+    int num_sockets;
+    int package_id[NUM_SOCKETS];        // physical_package_id of each socket index
+    int first_cpu[NUM_SOCKETS];         // lowest-numbered online logical processor in each socket
+    int num_cpus[NUM_SOCKETS];
+    int num_nodes;                      // NUMA nodes with memory
+    int node_id[MAX_NUMA_NODES];
+    int node_socket[MAX_NUMA_NODES];    // socket index whose CHAs home the node's memory
+    int node_has_cpus[MAX_NUMA_NODES];
+} topology_t;
+
+typedef struct {
+    topology_t *topo;
+    int socket;                         // socket index
+    const cha_pmon_t *pmon;             // CHA MSR addresses (cha_pmon.c)
+    int *msr_fd;                        // indexed by socket index
+    int num_chas;
+    pthread_t thread;
+    int status;                         // 0 if the worker completed
+    long pages_mapped;
+    long pages_skipped;                 // already mapped, or not backed by a 2MiB-aligned physical page
+    long lines_by_cha[NUM_CHA_BOXES];
+    line_mapper_t line_mapper;
+    msr_batch_t cha_batch;
+} socket_worker_t;
+
+// Read the first line of a sysfs file into buf -- returns 0 on success
+static int read_sysfs_line(const char *path, char *buf, int len)
+{
+    FILE *fp;
+
+    buf[0] = '\0';
+    fp = fopen(path, "r");
+    if (fp == NULL) return(1);
+    if (fgets(buf, len, fp) == NULL) buf[0] = '\0';
+    fclose(fp);
+    buf[strcspn(buf, "\n")] = '\0';
+    return(0);
+}
+
+// Parse a sysfs list such as "0-27,56-83" -- returns the number of entries stored in out[]
+static int parse_list(const char *list, int *out, int max)
+{
+    const char *p = list;
+    char *end;
+    long first, last, i;
+    int n = 0;
+
+    while (*p != '\0') {
+        first = strtol(p, &end, 10);
+        if (end == p) break;
+        last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p+1, &end, 10);
+            p = end;
+        }
+        for (i=first; i<=last && n<max; i++) out[n++] = (int) i;
+        if (*p == ',') p++;
+    }
+    return(n);
+}
+
+// Returns the number of sockets found, or 0 if the topology cannot be read from sysfs
+int discover_topology(topology_t *t)
+{
+    char path[128], buf[4096];
+    static int cpus[16384];
+    int nodes[MAX_NUMA_NODES], node_cpus[1];
+    int num_cpus, num_nodes, i, j, s, pkg, best, best_distance;
+    int distances[MAX_NUMA_NODES], num_distances;
+    int all_nodes[MAX_NUMA_NODES], num_all_nodes;
+
+    memset(t, 0, sizeof(*t));
+    if (read_sysfs_line("/sys/devices/system/cpu/online", buf, sizeof(buf)) != 0) return(0);
+    num_cpus = parse_list(buf, cpus, 16384);
+    for (i=0; i<num_cpus; i++) {
+        sprintf(path,"/sys/devices/system/cpu/cpu%d/topology/physical_package_id",cpus[i]);
+        if (read_sysfs_line(path, buf, sizeof(buf)) != 0) return(0);
+        pkg = atoi(buf);
+        for (s=0; s<t->num_sockets; s++) if (t->package_id[s] == pkg) break;
+        if (s == t->num_sockets) {
+            if (t->num_sockets == NUM_SOCKETS) {
+                printf("WARNING: more than NUM_SOCKETS=%d sockets -- ignoring package %d\n",NUM_SOCKETS,pkg);
+                continue;
+            }
+            t->package_id[s] = pkg;
+            t->first_cpu[s] = cpus[i];
+            t->num_sockets++;
+        }
+        t->num_cpus[s]++;
+    }
+
+    // the sysfs "distance" file of each node lists the distances to all online nodes, in order
+    if (read_sysfs_line("/sys/devices/system/node/online", buf, sizeof(buf)) != 0) return(0);
+    num_all_nodes = parse_list(buf, all_nodes, MAX_NUMA_NODES);
+    if (read_sysfs_line("/sys/devices/system/node/has_memory", buf, sizeof(buf)) != 0) {
+        read_sysfs_line("/sys/devices/system/node/online", buf, sizeof(buf));
+    }
+    num_nodes = parse_list(buf, nodes, MAX_NUMA_NODES);
+    // first pass: nodes with processors belong to the socket of their first processor
+    for (i=0; i<num_nodes; i++) {
+        t->node_id[i] = nodes[i];
+        t->node_socket[i] = -1;
+        sprintf(path,"/sys/devices/system/node/node%d/cpulist",nodes[i]);
+        read_sysfs_line(path, buf, sizeof(buf));
+        if (parse_list(buf, node_cpus, 1) == 1) {
+            t->node_has_cpus[i] = 1;
+            sprintf(path,"/sys/devices/system/cpu/cpu%d/topology/physical_package_id",node_cpus[0]);
+            read_sysfs_line(path, buf, sizeof(buf));
+            pkg = atoi(buf);
+            for (s=0; s<t->num_sockets; s++) if (t->package_id[s] == pkg) t->node_socket[i] = s;
+        }
+    }
+    // second pass: nodes without processors belong to the socket of the nearest node with processors
+    for (i=0; i<num_nodes; i++) {
+        if (t->node_has_cpus[i]) continue;
+        sprintf(path,"/sys/devices/system/node/node%d/distance",nodes[i]);
+        read_sysfs_line(path, buf, sizeof(buf));
+        num_distances = 0;
+        for (char *p=strtok(buf," "); p!=NULL && num_distances<MAX_NUMA_NODES; p=strtok(NULL," ")) distances[num_distances++] = atoi(p);
+        best = -1;
+        best_distance = 1<<30;
+        for (j=0; j<num_nodes; j++) {
+            if (!t->node_has_cpus[j] || t->node_socket[j] < 0) continue;
+            for (s=0; s<num_all_nodes && s<num_distances; s++) {
+                if (all_nodes[s] == nodes[j] && distances[s] < best_distance) {
+                    best_distance = distances[s];
+                    best = t->node_socket[j];
+                }
+            }
+        }
+        t->node_socket[i] = best;
+    }
+    t->num_nodes = num_nodes;
+
+    for (s=0; s<t->num_sockets; s++) {
+        printf("TOPOLOGY: socket %d package %d %d logical processors, first %d, nodes",s,t->package_id[s],t->num_cpus[s],t->first_cpu[s]);
+        for (i=0; i<num_nodes; i++) {
+            if (t->node_socket[i] == s) printf(" %d%s",t->node_id[i],t->node_has_cpus[i]?"":"(no cpus)");
+        }
+        printf("\n");
+    }
+    for (i=0; i<num_nodes; i++) {
+        if (t->node_socket[i] < 0) printf("WARNING: node %d could not be assigned to a socket -- not mapped\n",t->node_id[i]);
+    }
+    return(t->num_sockets);
+}
+
+// Bind the calling thread to one logical processor -- raw system call, no _GNU_SOURCE needed
+static int pin_to_cpu(int cpu)
+{
+    uint64_t mask[16384/64];
+
+    memset(mask, 0, sizeof(mask));
+    mask[cpu/64] = 1UL << (cpu%64);
+    return((int) syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask));
+}
+
+// Map the pages of a buffer bound to one NUMA node
+static void map_node(socket_worker_t *w, int node, int8_t *cha)
+{
+    size_t len = WORKER_PAGES_PER_NODE * MYPAGESIZE;
+    uint64_t nodemask[MAX_NUMA_NODES/64+1];
+    unsigned long pagemapentry;
+    uint64_t paddr, paddrs[WORKER_PAGES_PER_NODE];
+    char *raw, *buf;
+    long j, k, line_number, order[WORKER_PAGES_PER_NODE];
+    int new_pages = 0;
+
+    raw = mmap(NULL, len + MYPAGESIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+    if (raw == MAP_FAILED) {
+        printf("ERROR: socket %d: mmap of %ld Bytes for node %d failed: %s\n",w->socket,len,node,strerror(errno));
+        return;
+    }
+    buf = (char *) (((uintptr_t) raw + MYPAGESIZE - 1) & ~(uintptr_t)(MYPAGESIZE - 1));
+    memset(nodemask, 0, sizeof(nodemask));
+    nodemask[node/64] = 1UL << (node%64);
+    if (syscall(SYS_mbind, buf, len, MPOL_BIND, nodemask, MAX_NUMA_NODES+1, MPOL_MF_STRICT|MPOL_MF_MOVE) != 0) {
+        printf("ERROR: socket %d: mbind to node %d failed: %s\n",w->socket,node,strerror(errno));
+        munmap(raw, len + MYPAGESIZE);
+        return;
+    }
+#ifdef MYHUGEPAGE_THP
+    madvise(buf, len, MADV_HUGEPAGE);
+#endif
+    for (j=0; j<len/sizeof(double); j++) ((double *) buf)[j] = 1.0;
+
+    // pages with a checkpoint first (checkpoint.c)
+    for (j=0; j<WORKER_PAGES_PER_NODE; j++) {
+        pagemapentry = get_pagemap_entry(buf + j*MYPAGESIZE);
+        paddrs[j] = (pagemapentry & (unsigned long) 0x007FFFFFFFFFFFFF) << 12;
+        order[j] = j;
+    }
+    checkpoint_first(paddrs, order, WORKER_PAGES_PER_NODE);
+
+    for (k=0; k<WORKER_PAGES_PER_NODE && new_pages<PAGES_MAPPED; k++) {
+        j = order[k];
+        paddr = paddrs[j];
+        if (paddr == 0 || (paddr & 0x1fffffUL) != 0) {
+            printf("WARNING: socket %d node %d page %ld paddr 0x%.12lx is not a 2MiB-aligned physical page -- skipped\n",w->socket,node,j,paddr);
+            w->pages_skipped++;
+            continue;
+        }
+        if (read_map_file(paddr, cha) == 1) {
+            w->pages_skipped++;
+            continue;
+        }
+        map_page(&w->line_mapper, (double *)(buf + j*MYPAGESIZE), paddr, cha);
+        write_map_file(paddr, cha, (int) w->pages_mapped);
+        for (line_number=0; line_number<32768; line_number++) w->lines_by_cha[cha[line_number]]++;
+        w->pages_mapped++;
+        new_pages++;
+    }
+    munmap(raw, len + MYPAGESIZE);
+}
+
+void *socket_worker(void *arg)
+{
+    socket_worker_t *w = (socket_worker_t *) arg;
+    topology_t *t = w->topo;
+    int8_t *cha;
+    int i, cpu = t->first_cpu[w->socket];
+
+    w->status = 1;
+    if (pin_to_cpu(cpu) != 0) {
+        printf("ERROR: socket %d: failed to bind to cpu %d: %s\n",w->socket,cpu,strerror(errno));
+        return(NULL);
+    }
+    if (line_mapper_setup(&w->line_mapper, &w->cha_batch, w->pmon, w->socket, cpu, w->msr_fd, w->num_chas) != 0) return(NULL);
+    cha = (int8_t *) malloc(32768);
+    if (cha == NULL) return(NULL);
+    for (i=0; i<t->num_nodes; i++) {
+        if (t->node_socket[i] == w->socket) map_node(w, t->node_id[i], cha);
+    }
+    free(cha);
+    w->status = 0;
+    return(NULL);
+}
+
+// Run one worker per socket and report the results -- returns the number of pages mapped
+long run_socket_workers(topology_t *t, const cha_pmon_t *pmon, int *msr_fd, int CHA_per_socket)
+{
+    static socket_worker_t workers[NUM_SOCKETS];
+    long total_pages = 0;
+    int s, tile;
+
+    get_pagemap_entry(&s);              // opens the pagemap file before the threads share it
+#ifdef CHECKPOINT
+    checkpoint_install();               // signal handlers and atexit() once, before any worker starts
+#endif // CHECKPOINT
+    for (s=0; s<t->num_sockets; s++) {
+        memset(&workers[s], 0, sizeof(socket_worker_t));
+        workers[s].topo = t;
+        workers[s].socket = s;
+        workers[s].pmon = pmon;
+        workers[s].msr_fd = msr_fd;
+        workers[s].num_chas = CHA_per_socket;
+        if (pthread_create(&workers[s].thread, NULL, socket_worker, &workers[s]) != 0) {
+            printf("ERROR: failed to start the worker for socket %d\n",s);
+            exit(7);
+        }
+    }
+    for (s=0; s<t->num_sockets; s++) {
+        pthread_join(workers[s].thread, NULL);
+    }
+    for (s=0; s<t->num_sockets; s++) {
+        socket_worker_t *w = &workers[s];
+        printf("------------\n");
+        printf("SOCKET %d: %s, %ld new 2MiB pages mapped, %ld pages skipped, %ld tries, globalsum %d\n",
+                s, (w->status == 0) ? "completed" : "FAILED", w->pages_mapped, w->pages_skipped, w->line_mapper.totaltries, w->line_mapper.globalsum);
+        if (w->line_mapper.cha_batch != NULL) line_mapper_report_all(&w->line_mapper);
+        printf("LINES_BY_CHA socket %d\n",s);
+        for (tile=0; tile<CHA_per_socket; tile++) printf("%d %ld\n",tile,w->lines_by_cha[tile]);
+        total_pages += w->pages_mapped;
+    }
+    printf("INFO: %ld new 2MiB pages have been mapped on %d sockets\n",total_pages,t->num_sockets);
+    return(total_pages);
+}
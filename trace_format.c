@@ -0,0 +1,60 @@
+// trace_format.c -- binary trace of the tries of the full measurement (written by mapper_trace.c, read by trace_replay.c)
+//
+// A trace file is a trace_header_t followed by records of header.record_size Bytes: the fixed
+// part of trace_record_t followed by header.num_chas 32-bit counter deltas (the deltas of the
+// CHAs beyond num_chas are not stored).  Records are in the order they were drained from the
+// per-socket ring buffers, so the records of different sockets are interleaved; the records of
+// one socket are in the order of its tries.  records and dropped are filled in when the trace is
+// closed (dropped: tries not recorded because the ring buffer of their socket was full).
+
+#define TRACE_MAGIC 0x314543415254334cUL     // "L3TRACE1"
+#define TRACE_MAX_CHAS 64
+
+typedef struct {
+    uint64_t magic;
+    uint32_t signature;                 // CPUID signature of the processor
+    int32_t num_chas;
+    int32_t nflushes;                   // load/flush iterations per try
+    int32_t record_size;                // Bytes per record in the file
+    double tsc_hz;                      // 0 if unknown
+    double goodness1_min, goodness2_max, goodness3_max;     // the limits used by the mapper (goodness.c)
+    int32_t owner_permille;
+    int32_t reserved;
+    uint64_t records;
+    uint64_t dropped;
+} trace_header_t;
+
+typedef struct {
+    uint64_t tsc;                       // rdtscp() after the second counter snapshot of the try
+    uint64_t paddr;                     // physical address of the line
+    uint32_t line_number;               // within its 2MiB page
+    uint16_t try_number;                // 1, 2, ... for each line
+    int8_t socket;
+    int8_t cha;                         // the CHA chosen, -1 if the try was rejected
+    uint8_t pass;                       // GOODNESS_* bits
+    uint8_t reserved[3];
+    float goodness[3];
+    uint32_t delta[TRACE_MAX_CHAS];     // only num_chas are stored in the file
+} trace_record_t;
+
+#define TRACE_RECORD_FIXED ((int) offsetof(trace_record_t, delta))
+
+// Open a trace file and read its header -- returns NULL if it cannot be read or is not a trace
+FILE *trace_open_read(const char *filename, trace_header_t *hdr)
+{
+    FILE *fp = fopen(filename, "r");
+
+    if (fp == NULL) return(NULL);
+    if (fread(hdr, sizeof(*hdr), 1, fp) != 1 || hdr->magic != TRACE_MAGIC || hdr->num_chas < 1 || hdr->num_chas > TRACE_MAX_CHAS
+            || hdr->record_size != TRACE_RECORD_FIXED + 4*hdr->num_chas) {
+        fclose(fp);
+        return(NULL);
+    }
+    return(fp);
+}
+
+// Read the next record -- returns 1, or 0 at the end of the file
+int trace_read_record(FILE *fp, const trace_header_t *hdr, trace_record_t *rec)
+{
+    return(fread(rec, hdr->record_size, 1, fp) == 1);
+}
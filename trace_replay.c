@@ -0,0 +1,174 @@
+// trace_replay.c -- replay a binary trace of the mapper through the goodness tests
+//
+// Usage: trace_replay.exe TRACE_FILE [goodness1_min goodness2_max goodness3_max owner_permille]
+//
+// Reads a trace written by the mapper with L3_TRACE=<file> (mapper_trace.c, trace_format.c) and
+// replays every recorded try through goodness_classify() (goodness.c):
+//   - with the limits recorded in the header, and checks that every decision is reproduced,
+//   - with the limits given on the command line (default: the recorded ones).  The tries of each
+//     line are replayed in order until the first one accepted with the new limits, which gives
+//     the number of tries the line would have needed, and the CHA it would have been assigned.
+//     Lines for which no recorded try passes the new limits are reported as unresolved.
+// For the noise diagnosis, the tries rejected by each test are counted, and for each CHA the
+// report gives its mean counter delta when it does not own the line (per 1000 load/flush
+// iterations), the tries where it reached the owner count without owning the line, and the
+// rejected tries where it had the largest count apart from the leading CHA.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifndef MIN
+#define MIN(x,y) ((x)<(y)?(x):(y))
+#endif
+#ifndef MAX
+#define MAX(x,y) ((x)>(y)?(x):(y))
+#endif
+
+#include "goodness.c"
+#include "trace_format.c"
+
+#define MAX_SOCKETS 128
+#define TRIES_BINS 16                   // bin k: lines with k+1 tries, the last bin is 16 or more
+
+typedef struct {
+    int active;                         // a line is in progress
+    uint64_t paddr;
+    int recorded_cha;                   // CHA of the accepted recorded try, -1 until then
+    int new_cha;                        // CHA of the first try accepted with the new limits, -1 until then
+    int new_tries;
+    int tries;
+} line_state_t;
+
+static long lines, lines_changed, lines_unresolved, tries_new;
+static long recorded_histogram[TRIES_BINS], new_histogram[TRIES_BINS];
+
+static void finish_line(line_state_t *ls)
+{
+    if (!ls->active) return;
+    lines++;
+    recorded_histogram[MIN(ls->tries, TRIES_BINS) - 1]++;
+    if (ls->new_cha < 0) {
+        lines_unresolved++;
+    } else {
+        tries_new += ls->new_tries;
+        new_histogram[MIN(ls->new_tries, TRIES_BINS) - 1]++;
+        if (ls->new_cha != ls->recorded_cha) {
+            lines_changed++;
+            printf("CHANGED: paddr 0x%.12lx recorded CHA %d, CHA %d with the new limits\n",ls->paddr,ls->recorded_cha,ls->new_cha);
+        }
+    }
+    ls->active = 0;
+}
+
+int main(int argc, char **argv)
+{
+    static line_state_t state[MAX_SOCKETS];
+    static double noise_sum[TRACE_MAX_CHAS];
+    static long noise_tries[TRACE_MAX_CHAS], extra_owner[TRACE_MAX_CHAS], worst_noise[TRACE_MAX_CHAS];
+    trace_header_t hdr;
+    trace_record_t rec;
+    goodness_limits_t recorded, limits;
+    goodness_t g;
+    long delta[TRACE_MAX_CHAS];
+    long tries = 0, accepted = 0, mismatched = 0, failed[4] = {0};
+    line_state_t *ls;
+    int tile, k, good, cha, leader;
+    FILE *fp;
+
+    if (argc != 2 && argc != 6) {
+        fprintf(stderr,"Usage: %s TRACE_FILE [goodness1_min goodness2_max goodness3_max owner_permille]\n",argv[0]);
+        return(1);
+    }
+    fp = trace_open_read(argv[1], &hdr);
+    if (fp == NULL) {
+        fprintf(stderr,"ERROR: cannot read a trace from %s\n",argv[1]);
+        return(2);
+    }
+    recorded.goodness1_min = hdr.goodness1_min;
+    recorded.goodness2_max = hdr.goodness2_max;
+    recorded.goodness3_max = hdr.goodness3_max;
+    recorded.owner_permille = hdr.owner_permille;
+    limits = recorded;
+    if (argc == 6) {
+        limits.goodness1_min = atof(argv[2]);
+        limits.goodness2_max = atof(argv[3]);
+        limits.goodness3_max = atof(argv[4]);
+        limits.owner_permille = atoi(argv[5]);
+    }
+    printf("TRACE: CPUID signature 0x%x, %d CHAs, %d load/flush iterations per try, %lu tries recorded, %lu dropped\n",
+            hdr.signature,hdr.num_chas,hdr.nflushes,hdr.records,hdr.dropped);
+    printf("TRACE: recorded limits goodness1 > %g, goodness2 < %g, goodness3 < %g, owner >= %d/1000\n",
+            recorded.goodness1_min,recorded.goodness2_max,recorded.goodness3_max,recorded.owner_permille);
+    printf("TRACE: replay limits   goodness1 > %g, goodness2 < %g, goodness3 < %g, owner >= %d/1000\n",
+            limits.goodness1_min,limits.goodness2_max,limits.goodness3_max,limits.owner_permille);
+    if (hdr.dropped != 0) printf("WARNING: %lu tries were dropped while tracing -- the lines they belong to are incomplete\n",hdr.dropped);
+
+    while (trace_read_record(fp, &hdr, &rec)) {
+        tries++;
+        for (tile=0; tile<hdr.num_chas; tile++) delta[tile] = rec.delta[tile];
+
+        // the recorded decision must be reproduced with the recorded limits
+        good = goodness_classify(&recorded, delta, hdr.num_chas, hdr.nflushes, &g);
+        cha = good ? g.cha : -1;
+        if (g.pass != rec.pass || cha != rec.cha) mismatched++;
+        accepted += good;
+        if (!(g.pass & GOODNESS_PASS1)) failed[0]++;
+        if (!(g.pass & GOODNESS_PASS2)) failed[1]++;
+        if (!(g.pass & GOODNESS_PASS3)) failed[2]++;
+        if (!(g.pass & GOODNESS_ONE_OWNER)) failed[3]++;
+
+        // noise: the deltas of the CHAs that do not own the line
+        if (g.found >= 1) {
+            for (tile=0; tile<hdr.num_chas; tile++) {
+                if (tile == g.cha) continue;
+                noise_sum[tile] += 1000.0 * (double) delta[tile] / (double) hdr.nflushes;
+                noise_tries[tile]++;
+                if (delta[tile] >= (hdr.nflushes*recorded.owner_permille)/1000) extra_owner[tile]++;
+            }
+        }
+        if (!good && hdr.num_chas > 1) {
+            for (tile=0, leader=0; tile<hdr.num_chas; tile++) if (delta[tile] > delta[leader]) leader = tile;
+            k = (leader == 0) ? 1 : 0;
+            for (tile=0; tile<hdr.num_chas; tile++) if (tile != leader && delta[tile] > delta[k]) k = tile;
+            worst_noise[k]++;
+        }
+
+        // the lines of each socket are consecutive in the trace, starting with try 1
+        if (rec.socket < 0 || rec.socket >= MAX_SOCKETS) continue;
+        ls = &state[(int) rec.socket];
+        if (rec.try_number == 1 || !ls->active || ls->paddr != rec.paddr) {
+            finish_line(ls);
+            memset(ls, 0, sizeof(*ls));
+            ls->active = 1;
+            ls->paddr = rec.paddr;
+            ls->recorded_cha = -1;
+            ls->new_cha = -1;
+        }
+        ls->tries++;
+        if (good) ls->recorded_cha = g.cha;
+        if (ls->new_cha < 0) {
+            ls->new_tries++;
+            if (goodness_classify(&limits, delta, hdr.num_chas, hdr.nflushes, &g)) ls->new_cha = g.cha;
+        }
+    }
+    fclose(fp);
+    for (k=0; k<MAX_SOCKETS; k++) finish_line(&state[k]);
+
+    printf("REPLAY: %ld tries, %ld accepted, %ld not reproduced by the classifier with the recorded limits\n",tries,accepted,mismatched);
+    printf("REPLAY: rejected by goodness1 %ld, goodness2 %ld, goodness3 %ld, owner count %ld\n",failed[0],failed[1],failed[2],failed[3]);
+    printf("REPLAY: %ld lines, %f tries per line recorded, %f tries per resolved line with the replay limits\n",
+            lines,(double)tries/(double)MAX(lines,1),(double)tries_new/(double)MAX(lines-lines_unresolved,1));
+    printf("REPLAY: %ld lines assigned to a different CHA, %ld lines unresolved with the replay limits\n",lines_changed,lines_unresolved);
+    printf("TRIES_PER_LINE recorded replay\n");
+    for (k=0; k<TRIES_BINS; k++) {
+        if (recorded_histogram[k] != 0 || new_histogram[k] != 0) printf("%d%s %ld %ld\n",k+1,(k==TRIES_BINS-1)?"+":"",recorded_histogram[k],new_histogram[k]);
+    }
+    printf("NOISE_BY_CHA cha mean_per_1000 second_owner_tries worst_in_rejected_tries\n");
+    for (tile=0; tile<hdr.num_chas; tile++) {
+        printf("%d %f %ld %ld\n",tile,noise_sum[tile]/(double)MAX(noise_tries[tile],1),extra_owner[tile],worst_noise[tile]);
+    }
+    return(mismatched != 0 ? 3 : 0);
+}
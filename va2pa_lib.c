@@ -10,6 +10,48 @@
 // declarations that calling routines will need
 void print_pagemap_entry(unsigned long long pagemap_entry);
 unsigned long long get_pagemap_entry( void * va );
+int open_pagemap(pid_t pid);
+long get_pagemap_entries(int pagemap_fd, unsigned long va, long num_pages, unsigned long long *entries);
+
+// -----------------------------------------------------------------------------------------
+// Open /proc/$pid/pagemap for any process (pid 0 is the current process).
+//   Returns the file descriptor, or -1 (caller should check errno).
+//   Reading another process's pagemap requires ptrace access to that process, and the
+//   page frame numbers are only shown to processes with CAP_SYS_ADMIN (they read as 0 otherwise).
+
+int open_pagemap(pid_t pid)
+{
+	char filename[32];		// needs 15 characters for the "/proc/" and "/pagemap", plus enough for the PID
+
+	if (pid == 0) pid = getpid();
+	sprintf(filename,"/proc/%d/pagemap",pid);
+	return(open(filename, O_RDONLY));
+}
+
+// -----------------------------------------------------------------------------------------
+// Bulk version of get_pagemap_entry(): read the entries of num_pages consecutive 4KiB pages
+// starting at virtual address va, with one pread per 4096 entries instead of one per page.
+//   Returns the number of entries read -- less than num_pages if the range runs past the end
+//   of the address space -- or -1 on error (caller should check errno).
+//   Entries are returned uninterpreted, as in get_pagemap_entry().
+
+#define PAGEMAP_ENTRIES_PER_READ 4096
+
+long get_pagemap_entries(int pagemap_fd, unsigned long va, long num_pages, unsigned long long *entries)
+{
+	ssize_t ret;
+	long done = 0, n;
+
+	while (done < num_pages) {
+		n = num_pages - done;
+		if (n > PAGEMAP_ENTRIES_PER_READ) n = PAGEMAP_ENTRIES_PER_READ;
+		ret = pread(pagemap_fd, &entries[done], n*8, (off_t) (((va >> 12) + done) << 3));
+		if (ret < 0) return(-1);
+		done += ret / 8;
+		if (ret < n*8) break;	// end of the address space
+	}
+	return(done);
+}
 
 // -----------------------------------------------------------------------------------------
 // Function to take any pointer and look up the entry in /proc/$pid/pagemap
@@ -27,18 +69,14 @@ unsigned long long get_pagemap_entry( void * va )
 	ssize_t ret;
 	off_t myoffset;
 
-	pid_t mypid;
-	char filename[32];		// needs 15 characters for the "/proc/" and "/pagemap", plus enough for the PID
 	unsigned long long result;
 	static int pagemap_fd;
 	static int initialized=0;
 
-	// on first call: get process pid, open /proc/$pid/pagemap, and save the file descriptor for subsequent calls
+	// on first call: open /proc/$pid/pagemap for this process, and save the file descriptor for subsequent calls
 	if (initialized == 0) {
-		mypid = getpid();
-		sprintf(filename,"/proc/%d/pagemap",mypid);
-		pagemap_fd = open(filename, O_RDONLY);
-		if (pagemap_fd == 0) {
+		pagemap_fd = open_pagemap(0);
+		if (pagemap_fd == -1) {
 			return(0UL);		// user must check errno if a zero value is returned
 		}
 		initialized = 1;